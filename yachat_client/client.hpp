@@ -8,6 +8,7 @@
 #include <QTcpSocket>
 
 #include "config.hpp"
+#include "frame.hpp"
 #include "packet.hpp"
 
 class Client final : public QObject {
@@ -15,8 +16,11 @@ class Client final : public QObject {
 
  public:
   explicit Client(Config &config) : config_(config) {
-    connect(&socket_, &QTcpSocket::connected, this, []() {
+    connect(&socket_, &QTcpSocket::connected, this, [=]() {
       qDebug() << "[CLIENT | ON CONNECTED] Connected to server!";
+      if (config_.GetBinaryCodec()) {
+        SendSetCodec(packet::packet_t::header_t::codec_t::BINARY);
+      }
     });
     connect(&socket_, &QTcpSocket::disconnected, this, [=]() {
       qDebug() << "[CLIENT | ON DISCONNECTED] Disconnected";
@@ -44,81 +48,106 @@ class Client final : public QObject {
   inline auto getPassword() const -> QString { return password_; }
   inline auto getSessionID() const -> QString { return session_id_; }
 
-  void SendRegister(const QString &username, const QString &password) {
-    const auto req = packet::RegisterRequest(username, password).to_json();
-    socket_.write(req.toJson(QJsonDocument::Indented));
-    socket_.flush();
+  // every Send* returns the id of the request, the response to it carries
+  // the same id in its header
+
+  QString SendRegister(const QString &username, const QString &password) {
+    return send_(packet::RegisterRequest(username, password));
   }
 
-  void SendLogIn(const QString &username, const QString &password) {
+  QString SendLogIn(const QString &username, const QString &password) {
     username_ = username;
     password_ = password;
-    const auto req = packet::LoginRequest(username_, password_).to_json();
-    socket_.write(req.toJson(QJsonDocument::Indented));
-    socket_.flush();
+    return send_(packet::LoginRequest(username_, password_));
   }
 
-  void SendLogOut() {
-    const auto req = packet::LogoutRequest(username_, session_id_).to_json();
-    socket_.write(req.toJson(QJsonDocument::Indented));
-    socket_.flush();
+  QString SendLogOut() {
+    return send_(packet::LogoutRequest(username_, session_id_));
   }
 
-  void SendSendMsg(const QString &target_username, const QString &message) {
-    const auto req =
-        packet::SendMsgRequest(username_, session_id_, target_username, message)
-            .to_json();
-    socket_.write(req.toJson(QJsonDocument::Indented));
-    socket_.flush();
+  QString SendSendMsg(const QString &target_username, const QString &message) {
+    return send_(packet::SendMsgRequest(username_, session_id_,
+                                        target_username, message));
   }
 
-  void SendGetMsgs(const QString &target_username) {
-    const auto req =
-        packet::GetMsgsRequest(username_, session_id_, target_username)
-            .to_json();
-    socket_.write(req.toJson(QJsonDocument::Indented));
-    socket_.flush();
+  // before/after are message cursors and limit the page size, see
+  // packet::GetMsgsRequest; the defaults fetch the whole conversation
+  QString SendGetMsgs(const QString &target_username, quint64 before = 0,
+                      quint64 after = 0, quint64 limit = 0) {
+    return send_(packet::GetMsgsRequest(username_, session_id_,
+                                        target_username, before, after, limit));
   }
 
-  void SendGetAllMsgs() {
-    const auto req =
-        packet::GetAllMsgsRequest(username_, session_id_).to_json();
-    socket_.write(req.toJson(QJsonDocument::Indented));
-    socket_.flush();
+  // since is the high-water mark of the last sync, 0 fetches everything
+  QString SendGetAllMsgs(quint64 since = 0) {
+    return send_(packet::GetAllMsgsRequest(username_, session_id_, since));
+  }
+
+  QString SendGetInbox() {
+    return send_(packet::GetInboxRequest(username_, session_id_));
+  }
+
+  // resets the unread count of the conversation with target_username
+  QString SendRead(const QString &target_username) {
+    return send_(packet::ReadRequest(username_, session_id_, target_username));
+  }
+
+  // every later request is encoded in the new format right away, responses
+  // switch over once the server has processed this one
+  QString SendSetCodec(packet::packet_t::header_t::codec_t codec) {
+    const auto request_id = send_(packet::SetCodecRequest(codec));
+    codec_ = codec;
+    return request_id;
   }
 
+  // number of requests still waiting for their response
+  inline auto getInFlight() const -> qsizetype { return in_flight_.size(); }
+
  private slots:
   void onReadyRead_() {
-    QByteArray requestData = socket_.readAll();
-    QString requestString = QString::fromUtf8(requestData);
-    QJsonDocument requestJson = QJsonDocument::fromJson(requestString.toUtf8());
-
-    auto header_monad = packet::jsonExtractPacketHeader(requestJson);
-    if (header_monad.error) {
-      qDebug() << "[CLIENT | ON READY READ] Error parsing received JSON "
-                  "[header section]";
+    if (decoder_.readFrom(&socket_) < 0) {
+      qDebug() << "[CLIENT | ON READY READ] Error reading from socket";
       return;
     }
 
-    const auto header = header_monad.unwrap();
-    const auto command = header.command;
+    for (auto frame_monad = decoder_.next(); !frame_monad.error;
+         frame_monad = decoder_.next()) {
+      processFrame_(frame_monad.data);
+    }
 
-    process_(command, header, std::move(requestJson));
+    if (decoder_.malformed()) {
+      qDebug() << "[CLIENT | ON READY READ] Frame size limit exceeded, "
+                  "disconnecting";
+      socket_.disconnectFromHost();
+    }
   }
 
  signals:
-  void respNotifyReceived(packet::packet_t::header_t::status_t, const QString &,
-                          const QString &);
+  // the new message from the user and its id, or no message and 0 if the
+  // server only tells who wrote
+  void respNotifyReceived(
+      packet::packet_t::header_t::status_t, const QString &, const QString &,
+      const QList<packet::packet_t::payload_t::target_t::message_t> &,
+      quint64);
+  // the last argument is the id of the request answered
   void respStatusReceived(packet::packet_t::header_t::status_t,
-                          const QString &);
+                          const QString &, const QString &);
   void respAuthReceived(packet::packet_t::header_t::status_t, const QString &);
+  // the last argument is the cursor of the next page, 0 if there is none
   void respMsgsReceived(
       packet::packet_t::header_t::status_t, const QString &, const QString &,
-      const QList<packet::packet_t::payload_t::target_t::message_t> &);
+      const QList<packet::packet_t::payload_t::target_t::message_t> &,
+      quint64);
+  // the last argument is the high-water mark to pass as since next time
   void respAllMsgsReceived(
       packet::packet_t::header_t::status_t, const QString &,
       const QHash<QString,
-                  QList<packet::packet_t::payload_t::target_t::message_t>> &);
+                  QList<packet::packet_t::payload_t::target_t::message_t>> &,
+      quint64);
+  // the conversations, the most recent one first
+  void respInboxReceived(
+      packet::packet_t::header_t::status_t, const QString &,
+      const QList<packet::packet_t::payload_t::target_t::conversation_t> &);
 
  private:
   Config &config_;
@@ -126,21 +155,75 @@ class Client final : public QObject {
   QString username_;
   QString password_;
   QString session_id_;
+  frame::Decoder decoder_;
+  packet::packet_t::header_t::codec_t codec_ =
+      packet::packet_t::header_t::codec_t::JSON;
+  quint64 last_request_id_ = 0;
+  QHash<QString, packet::packet_t::header_t::command_t>
+      in_flight_;  // <request id, command>
+
+  QString send_(packet::Request &&req) {
+    req.header_request_id = QString::number(++last_request_id_);
+    in_flight_.insert(
+        req.header_request_id,
+        packet::packet_t::header_t::QStringToCommand(req.header_command));
+
+    if (codec_ == packet::packet_t::header_t::codec_t::BINARY) {
+      socket_.write(frame::encode(req.to_binary()));
+    } else {
+      socket_.write(
+          frame::encode(req.to_json().toJson(QJsonDocument::Compact)));
+    }
+    socket_.flush();
+
+    return req.header_request_id;
+  }
+
+  // both wire formats may arrive on one connection around a SETCODEC, they
+  // are told apart by the first byte of the frame
+  void processFrame_(const QByteArray &requestData) {
+    common::result_t<packet::wire_packet_t> packet_monad;
+    if (packet::isBinaryPacket(requestData)) {
+      packet_monad = packet::binaryDecodePacket(requestData);
+    } else {
+      packet_monad =
+          packet::jsonExtractPacket(QJsonDocument::fromJson(requestData));
+    }
+
+    if (packet_monad.error) {
+      qDebug() << "[CLIENT | ON READY READ] Error parsing received packet "
+                  "[header section]";
+      return;
+    }
+
+    auto response = packet_monad.unwrap();
+    const auto header = response.header;
+    const auto command = header.command;
+
+    // notifications are pushed by the server and answer no request
+    if (!header.request_id.isEmpty() && !in_flight_.remove(header.request_id)) {
+      qDebug() << "[CLIENT | ON READY READ] Response to an unknown request"
+               << header.request_id;
+    }
+
+    process_(command, header, std::move(response));
+  }
 
   void process_(packet::packet_t::header_t::command_t command,
-                packet::packet_t::header_t header, QJsonDocument &&packetData) {
+                packet::packet_t::header_t header,
+                packet::wire_packet_t &&response) {
     switch (command) {
       case packet::packet_t::header_t::command_t::STATUS: {
         const auto status = header.status;
         const auto msg = header.msg;
-        emit respStatusReceived(status, msg);
+        emit respStatusReceived(status, msg, header.request_id);
         break;
       };
       case packet::packet_t::header_t::command_t::AUTH: {
-        auto auth_data_monad = packet::jsonExtractAuthData(packetData);
+        auto auth_data_monad = response.auth_data;
         if (auth_data_monad.error) {
-          qDebug() << "[CLIENT | PROCESS AUTH] Error parsing received JSON "
-                      "[auth data section]";
+          qDebug() << "[CLIENT | PROCESS AUTH] Error parsing received "
+                      "packet [auth data section]";
           return;
         }
 
@@ -155,10 +238,10 @@ class Client final : public QObject {
         break;
       };
       case packet::packet_t::header_t::command_t::ALLMSGS: {
-        auto target_data_monad = packet::jsonExtractTargetData(packetData);
+        auto target_data_monad = response.target;
         if (target_data_monad.error) {
-          qDebug() << "[CLIENT | PROCESS ALLMSGS] Error parsing received JSON "
-                      "[target data section]";
+          qDebug() << "[CLIENT | PROCESS ALLMSGS] Error parsing received "
+                      "packet [target data section]";
           return;
         }
 
@@ -166,16 +249,17 @@ class Client final : public QObject {
         const auto msg = header.msg;
 
         const auto all_messages = target_data_monad.data.all_messages;
+        const auto last = target_data_monad.data.last;
 
-        emit respAllMsgsReceived(status, msg, all_messages);
+        emit respAllMsgsReceived(status, msg, all_messages, last);
 
         break;
       };
       case packet::packet_t::header_t::command_t::MSGS: {
-        auto target_data_monad = packet::jsonExtractTargetData(packetData);
+        auto target_data_monad = response.target;
         if (target_data_monad.error) {
-          qDebug() << "[CLIENT | PROCESS MSGS] Error parsing received JSON "
-                      "[target data section]";
+          qDebug() << "[CLIENT | PROCESS MSGS] Error parsing received "
+                      "packet [target data section]";
           return;
         }
 
@@ -184,16 +268,34 @@ class Client final : public QObject {
 
         const auto username = target_data_monad.data.username;
         const auto messages = target_data_monad.data.messages;
+        const auto next = target_data_monad.data.next;
 
-        emit respMsgsReceived(status, msg, username, messages);
+        emit respMsgsReceived(status, msg, username, messages, next);
+
+        break;
+      };
+      case packet::packet_t::header_t::command_t::INBOX: {
+        auto target_data_monad = response.target;
+        if (target_data_monad.error) {
+          qDebug() << "[CLIENT | PROCESS INBOX] Error parsing received "
+                      "packet [target data section]";
+          return;
+        }
+
+        const auto status = header.status;
+        const auto msg = header.msg;
+
+        const auto inbox = target_data_monad.data.inbox;
+
+        emit respInboxReceived(status, msg, inbox);
 
         break;
       };
       case packet::packet_t::header_t::command_t::NOTIFY: {
-        auto target_data_monad = packet::jsonExtractTargetData(packetData);
+        auto target_data_monad = response.target;
         if (target_data_monad.error) {
-          qDebug() << "[CLIENT | PROCESS NOTIFY] Error parsing received JSON "
-                      "[target data section]";
+          qDebug() << "[CLIENT | PROCESS NOTIFY] Error parsing received "
+                      "packet [target data section]";
           return;
         }
 
@@ -201,8 +303,10 @@ class Client final : public QObject {
         const auto msg = header.msg;
 
         const auto username = target_data_monad.data.username;
+        const auto messages = target_data_monad.data.messages;
+        const auto message_id = target_data_monad.data.last;
 
-        emit respNotifyReceived(status, msg, username);
+        emit respNotifyReceived(status, msg, username, messages, message_id);
 
         break;
       };
@@ -22,12 +22,16 @@ class Config final {
 
     server_ip_ = dat.value("serverip").toString();
     server_port_ = dat.value("serverport").toString().toUInt();
+    // "json" (default) or "binary", the latter is negotiated on connect
+    binary_codec_ = dat.value("codec").toString() == "binary";
   }
 
   auto GetIP() const -> QString { return server_ip_; }
   auto GetPort() const -> quint16 { return server_port_; }
+  auto GetBinaryCodec() const -> bool { return binary_codec_; }
 
  private:
   QString server_ip_;
   quint16 server_port_;
+  bool binary_codec_ = false;
 };
@@ -15,6 +15,8 @@ namespace request_json_tags {
 
 constexpr auto header = "header";
 constexpr auto header_command = "command";
+constexpr auto header_request_id = "id";
+constexpr auto header_codec = "codec";
 constexpr auto payload = "payload";
 constexpr auto payload_auth_data = "auth_data";
 constexpr auto payload_auth_data_username = "username";
@@ -23,6 +25,10 @@ constexpr auto payload_auth_data_session_id = "session_id";
 constexpr auto payload_target = "target";
 constexpr auto payload_target_username = "username";
 constexpr auto payload_target_message = "message";
+constexpr auto payload_target_before = "before";
+constexpr auto payload_target_after = "after";
+constexpr auto payload_target_limit = "limit";
+constexpr auto payload_target_since = "since";
 
 };  // namespace request_json_tags
 
@@ -32,6 +38,7 @@ constexpr auto header = "header";
 constexpr auto header_command = "command";
 constexpr auto header_status = "status";
 constexpr auto header_msg = "msg";
+constexpr auto header_request_id = "id";
 constexpr auto payload = "payload";
 constexpr auto payload_auth_data = "auth_data";
 constexpr auto payload_auth_data_session_id = "session_id";
@@ -40,6 +47,13 @@ constexpr auto payload_target_username = "username";
 constexpr auto payload_target_messages = "messages";
 constexpr auto payload_target_messages_y = "y";
 constexpr auto payload_target_messages_t = "t";
+constexpr auto payload_target_next = "next";
+constexpr auto payload_target_last = "last";
+constexpr auto payload_target_inbox = "inbox";
+constexpr auto payload_target_inbox_username = "username";
+constexpr auto payload_target_inbox_last = "last";
+constexpr auto payload_target_inbox_message = "message";
+constexpr auto payload_target_inbox_unread = "unread";
 constexpr auto payload_target_all_messages = "all_messages";
 constexpr auto payload_target_all_messages_username = "username";
 constexpr auto payload_target_all_messages_messages = "messages";
@@ -48,6 +62,42 @@ constexpr auto payload_target_all_messages_messages_y = "y";
 
 };  // namespace response_json_tags
 
+namespace binary_tags {
+
+// every binary packet starts with this byte, a JSON document never does
+constexpr quint8 marker = 0x00;
+
+constexpr quint8 header_msg = 1;
+constexpr quint8 header_request_id = 2;
+constexpr quint8 header_codec = 3;
+constexpr quint8 payload_auth_data = 16;
+constexpr quint8 payload_auth_data_username = 17;
+constexpr quint8 payload_auth_data_password = 18;
+constexpr quint8 payload_auth_data_session_id = 19;
+constexpr quint8 payload_target = 32;
+constexpr quint8 payload_target_username = 33;
+constexpr quint8 payload_target_message = 34;
+constexpr quint8 payload_target_messages = 35;
+constexpr quint8 payload_target_all_messages = 36;
+constexpr quint8 payload_target_before = 37;
+constexpr quint8 payload_target_after = 38;
+constexpr quint8 payload_target_limit = 39;
+constexpr quint8 payload_target_next = 40;
+constexpr quint8 payload_target_since = 41;
+constexpr quint8 payload_target_last = 42;
+constexpr quint8 payload_target_inbox = 43;
+constexpr quint8 message = 48;
+constexpr quint8 message_side = 49;
+constexpr quint8 message_message = 50;
+constexpr quint8 conversation = 64;
+constexpr quint8 conversation_username = 65;
+constexpr quint8 conversation_messages = 66;
+constexpr quint8 conversation_last_message_id = 67;
+constexpr quint8 conversation_last_message = 68;
+constexpr quint8 conversation_unread = 69;
+
+};  // namespace binary_tags
+
 struct packet_t {
   struct header_t {
     enum class command_t : quint16 {
@@ -62,7 +112,11 @@ struct packet_t {
       MSGS,          // res (server -> client)
       GETALLMSGS,    // req (client -> server)
       ALLMSGS,       // res (server -> client)
-    } command;
+      SETCODEC,      // req (client -> server)
+      GETINBOX,      // req (client -> server)
+      INBOX,         // res (server -> client)
+      READ,          // req (client -> server)
+    } command{};
 
     [[maybe_unused]] static QString commandToQString(command_t c) noexcept {
       return QString::number(static_cast<quint16>(c));
@@ -75,7 +129,7 @@ struct packet_t {
     enum class status_t : quint16 {
       OK = 0,
       FAIL,
-    } status;  // res (server -> client)
+    } status{};  // res (server -> client)
 
     [[maybe_unused]] static QString statusToQString(status_t s) noexcept {
       return QString::number(static_cast<quint16>(s));
@@ -86,6 +140,18 @@ struct packet_t {
     }
 
     QString msg;  // res (server -> client)
+
+    // req, res (client -> server, server -> client)
+    // optional, echoed back in the response so that several requests can be
+    // in flight on one connection and answered out of order
+    QString request_id;
+
+    // wire format of the packets following a SETCODEC request, in both
+    // directions; JSON unless the client opts in
+    enum class codec_t : quint16 {
+      JSON = 0,
+      BINARY,
+    } codec{};  // req (client -> server)
   } header;
 
   struct __attribute_maybe_unused__ payload_t {
@@ -100,14 +166,528 @@ struct packet_t {
         QString side;
         QString message;
       };
+      // a line of the inbox
+      struct conversation_t {
+        QString username;
+        quint64 last_message_id = 0;
+        QString last_message;  // the first characters only
+        quint64 unread = 0;    // messages received since the last READ
+      };
       QString username;  // req, res (client -> server, server -> client)
       QString message;   // req (client -> server)
       QList<message_t> messages;                      // res (server -> client)
       QHash<QString, QList<message_t>> all_messages;  // res (server -> client)
+      QList<conversation_t> inbox;                    // res (server -> client)
+
+      // keyset pagination of GETMSGS on message_id, 0 means unset
+      quint64 before = 0;  // req, only messages older than this one
+      quint64 after = 0;   // req, only messages newer than this one
+      quint64 limit = 0;   // req, page size, 0 - the whole conversation
+      quint64 next = 0;    // res, cursor of the next page in the same
+                           // direction, 0 - there are no more messages
+
+      // delta sync of GETALLMSGS, 0 means a full one
+      quint64 since = 0;  // req, only messages newer than this one
+      quint64 last = 0;   // res, highest message_id the client has now, the
+                          // since of its next sync; in NOTIFY the id of
+                          // the pushed message
     } target;
   } payload;
 };
 
+// a packet as it travels over the wire, payload sections missing from it are
+// left in the error state
+struct wire_packet_t {
+  packet_t::header_t header;
+  common::result_t<packet_t::payload_t::auth_data_t> auth_data;
+  common::result_t<packet_t::payload_t::target_t> target;
+};
+
+// Binary packet layout:
+//   marker (1 byte) | command (varint) | status (1 byte) | field*
+//   field = tag (1 byte) | value length (varint) | value
+// Strings are UTF-8, empty ones are omitted. Sections (auth data, target) and
+// list items (messages, conversations) are fields whose value is a sequence
+// of fields again. Unknown tags are skipped, so fields can be added later
+// without breaking older peers.
+namespace binary {
+
+static qsizetype varintSize(quint64 value) {
+  qsizetype size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+static void writeVarint(QByteArray& out, quint64 value) {
+  while (value >= 0x80) {
+    out.append(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.append(static_cast<char>(value));
+}
+
+static void writeField(QByteArray& out, const quint8 tag,
+                       const QByteArray& value) {
+  out.append(static_cast<char>(tag));
+  writeVarint(out, value.size());
+  out.append(value);
+}
+
+static void writeString(QByteArray& out, const quint8 tag,
+                        const QString& value) {
+  if (value.isEmpty()) {
+    return;
+  }
+  writeField(out, tag, value.toUtf8());
+}
+
+// numbers are varints, zero ones are omitted like empty strings
+static void writeNumber(QByteArray& out, const quint8 tag,
+                        const quint64 value) {
+  if (value == 0) {
+    return;
+  }
+  out.append(static_cast<char>(tag));
+  writeVarint(out, varintSize(value));
+  writeVarint(out, value);
+}
+
+static void writeMessages(
+    QByteArray& out,
+    const QList<packet_t::payload_t::target_t::message_t>& messages) {
+  for (const auto& msg : messages) {
+    const auto side = msg.side.toUtf8();
+    const auto message = msg.message.toUtf8();
+
+    // the item size is known upfront, so it's written in place
+    out.append(static_cast<char>(binary_tags::message));
+    writeVarint(out, 1 + varintSize(side.size()) + side.size() + 1 +
+                         varintSize(message.size()) + message.size());
+    writeField(out, binary_tags::message_side, side);
+    writeField(out, binary_tags::message_message, message);
+  }
+}
+
+// bounds-checked cursor over an encoded packet or one of its fields
+class Reader {
+ public:
+  Reader() = default;
+  Reader(const char* begin, const char* end) : pos_(begin), end_(end) {}
+
+  bool atEnd() const { return pos_ >= end_; }
+
+  bool readByte(quint8& value) {
+    if (atEnd()) {
+      return false;
+    }
+    value = static_cast<quint8>(*pos_++);
+    return true;
+  }
+
+  bool readVarint(quint64& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      quint8 byte;
+      if (!readByte(byte)) {
+        return false;
+      }
+      value |= static_cast<quint64>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // reads one field, its value is handed out as a nested reader
+  bool readField(quint8& tag, Reader& value) {
+    quint64 size;
+    if (!readByte(tag) || !readVarint(size) ||
+        size > static_cast<quint64>(end_ - pos_)) {
+      return false;
+    }
+    value = Reader(pos_, pos_ + size);
+    pos_ += size;
+    return true;
+  }
+
+  QString toString() const { return QString::fromUtf8(pos_, end_ - pos_); }
+
+ private:
+  const char* pos_ = nullptr;
+  const char* end_ = nullptr;
+};
+
+static bool readMessages(Reader& reader,
+                  QList<packet_t::payload_t::target_t::message_t>& messages) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    if (tag != binary_tags::message) {
+      continue;
+    }
+
+    packet_t::payload_t::target_t::message_t msg;
+    Reader field;
+    while (!value.atEnd()) {
+      if (!value.readField(tag, field)) {
+        return false;
+      }
+      if (tag == binary_tags::message_side) {
+        msg.side = field.toString();
+      } else if (tag == binary_tags::message_message) {
+        msg.message = field.toString();
+      }
+    }
+    messages.push_back(msg);
+  }
+  return true;
+}
+
+static bool readAuthData(Reader& reader,
+                         packet_t::payload_t::auth_data_t& auth_data) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    switch (tag) {
+      case binary_tags::payload_auth_data_username: {
+        auth_data.username = value.toString();
+        break;
+      };
+      case binary_tags::payload_auth_data_password: {
+        auth_data.password = value.toString();
+        break;
+      };
+      case binary_tags::payload_auth_data_session_id: {
+        auth_data.session_id = value.toString();
+        break;
+      };
+      default: {
+        break;
+      };
+    }
+  }
+  return true;
+}
+
+static bool readInbox(
+    Reader& reader,
+    QList<packet_t::payload_t::target_t::conversation_t>& inbox) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    if (tag != binary_tags::conversation) {
+      continue;
+    }
+
+    packet_t::payload_t::target_t::conversation_t conversation;
+    Reader field;
+    while (!value.atEnd()) {
+      if (!value.readField(tag, field)) {
+        return false;
+      }
+      if (tag == binary_tags::conversation_username) {
+        conversation.username = field.toString();
+      } else if (tag == binary_tags::conversation_last_message_id &&
+                 !field.readVarint(conversation.last_message_id)) {
+        return false;
+      } else if (tag == binary_tags::conversation_last_message) {
+        conversation.last_message = field.toString();
+      } else if (tag == binary_tags::conversation_unread &&
+                 !field.readVarint(conversation.unread)) {
+        return false;
+      }
+    }
+    inbox.push_back(conversation);
+  }
+  return true;
+}
+
+static bool readTarget(Reader& reader, packet_t::payload_t::target_t& target) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    switch (tag) {
+      case binary_tags::payload_target_username: {
+        target.username = value.toString();
+        break;
+      };
+      case binary_tags::payload_target_message: {
+        target.message = value.toString();
+        break;
+      };
+      case binary_tags::payload_target_before: {
+        if (!value.readVarint(target.before)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_after: {
+        if (!value.readVarint(target.after)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_limit: {
+        if (!value.readVarint(target.limit)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_next: {
+        if (!value.readVarint(target.next)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_since: {
+        if (!value.readVarint(target.since)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_last: {
+        if (!value.readVarint(target.last)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_inbox: {
+        if (!readInbox(value, target.inbox)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_messages: {
+        if (!readMessages(value, target.messages)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_all_messages: {
+        Reader conversation;
+        while (!value.atEnd()) {
+          if (!value.readField(tag, conversation)) {
+            return false;
+          }
+          if (tag != binary_tags::conversation) {
+            continue;
+          }
+
+          QString username;
+          QList<packet_t::payload_t::target_t::message_t> messages;
+          Reader field;
+          while (!conversation.atEnd()) {
+            if (!conversation.readField(tag, field)) {
+              return false;
+            }
+            if (tag == binary_tags::conversation_username) {
+              username = field.toString();
+            } else if (tag == binary_tags::conversation_messages &&
+                       !readMessages(field, messages)) {
+              return false;
+            }
+          }
+          target.all_messages[username].append(messages);
+        }
+        break;
+      };
+      default: {
+        break;
+      };
+    }
+  }
+  return true;
+}
+
+};  // namespace binary
+
+static bool isBinaryPacket(const QByteArray& data) {
+  return !data.isEmpty() &&
+         static_cast<quint8>(data.front()) == binary_tags::marker;
+}
+
+static QByteArray binaryEncodePacket(const wire_packet_t& packet) {
+  QByteArray out;
+  out.append(static_cast<char>(binary_tags::marker));
+  binary::writeVarint(out, static_cast<quint16>(packet.header.command));
+  out.append(static_cast<char>(packet.header.status));
+
+  binary::writeString(out, binary_tags::header_msg, packet.header.msg);
+  binary::writeString(out, binary_tags::header_request_id,
+                      packet.header.request_id);
+  if (packet.header.codec != packet_t::header_t::codec_t::JSON) {
+    QByteArray codec;
+    binary::writeVarint(codec, static_cast<quint16>(packet.header.codec));
+    binary::writeField(out, binary_tags::header_codec, codec);
+  }
+
+  if (!packet.auth_data.error) {
+    QByteArray auth_data;
+    binary::writeString(auth_data, binary_tags::payload_auth_data_username,
+                        packet.auth_data.data.username);
+    binary::writeString(auth_data, binary_tags::payload_auth_data_password,
+                        packet.auth_data.data.password);
+    binary::writeString(auth_data,
+                        binary_tags::payload_auth_data_session_id,
+                        packet.auth_data.data.session_id);
+    binary::writeField(out, binary_tags::payload_auth_data, auth_data);
+  }
+
+  if (!packet.target.error) {
+    const auto& target = packet.target.data;
+
+    QByteArray target_data;
+    binary::writeString(target_data, binary_tags::payload_target_username,
+                        target.username);
+    binary::writeString(target_data, binary_tags::payload_target_message,
+                        target.message);
+    binary::writeNumber(target_data, binary_tags::payload_target_before,
+                        target.before);
+    binary::writeNumber(target_data, binary_tags::payload_target_after,
+                        target.after);
+    binary::writeNumber(target_data, binary_tags::payload_target_limit,
+                        target.limit);
+    binary::writeNumber(target_data, binary_tags::payload_target_next,
+                        target.next);
+    binary::writeNumber(target_data, binary_tags::payload_target_since,
+                        target.since);
+    binary::writeNumber(target_data, binary_tags::payload_target_last,
+                        target.last);
+
+    if (!target.messages.isEmpty()) {
+      QByteArray messages;
+      binary::writeMessages(messages, target.messages);
+      binary::writeField(target_data, binary_tags::payload_target_messages,
+                         messages);
+    }
+
+    if (!target.all_messages.isEmpty()) {
+      QByteArray all_messages;
+      for (auto it = target.all_messages.cbegin();
+           it != target.all_messages.cend(); ++it) {
+        QByteArray conversation;
+        binary::writeString(conversation, binary_tags::conversation_username,
+                            it.key());
+        QByteArray messages;
+        binary::writeMessages(messages, it.value());
+        binary::writeField(conversation, binary_tags::conversation_messages,
+                           messages);
+        binary::writeField(all_messages, binary_tags::conversation,
+                           conversation);
+      }
+      binary::writeField(target_data,
+                         binary_tags::payload_target_all_messages,
+                         all_messages);
+    }
+
+    if (!target.inbox.isEmpty()) {
+      QByteArray inbox;
+      for (const auto& line : target.inbox) {
+        QByteArray conversation;
+        binary::writeString(conversation, binary_tags::conversation_username,
+                            line.username);
+        binary::writeNumber(conversation,
+                            binary_tags::conversation_last_message_id,
+                            line.last_message_id);
+        binary::writeString(conversation,
+                            binary_tags::conversation_last_message,
+                            line.last_message);
+        binary::writeNumber(conversation, binary_tags::conversation_unread,
+                            line.unread);
+        binary::writeField(inbox, binary_tags::conversation, conversation);
+      }
+      binary::writeField(target_data, binary_tags::payload_target_inbox,
+                         inbox);
+    }
+
+    binary::writeField(out, binary_tags::payload_target, target_data);
+  }
+
+  return out;
+}
+
+static auto binaryDecodePacket(const QByteArray& data)
+    -> common::result_t<wire_packet_t> {
+  binary::Reader reader(data.constData(), data.constData() + data.size());
+
+  quint8 marker;
+  quint64 command;
+  quint8 status;
+  if (!reader.readByte(marker) || marker != binary_tags::marker ||
+      !reader.readVarint(command) || !reader.readByte(status)) {
+    return {};
+  }
+
+  common::result_t<wire_packet_t> packet_monad;
+  auto& packet = packet_monad.data;
+  packet.header.command =
+      static_cast<packet_t::header_t::command_t>(command);
+  packet.header.status = static_cast<packet_t::header_t::status_t>(status);
+
+  quint8 tag;
+  binary::Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return {};
+    }
+    switch (tag) {
+      case binary_tags::header_msg: {
+        packet.header.msg = value.toString();
+        break;
+      };
+      case binary_tags::header_request_id: {
+        packet.header.request_id = value.toString();
+        break;
+      };
+      case binary_tags::header_codec: {
+        quint64 codec;
+        if (!value.readVarint(codec)) {
+          return {};
+        }
+        packet.header.codec =
+            static_cast<packet_t::header_t::codec_t>(codec);
+        break;
+      };
+      case binary_tags::payload_auth_data: {
+        if (!binary::readAuthData(value, packet.auth_data.data)) {
+          return {};
+        }
+        packet.auth_data.error = false;
+        break;
+      };
+      case binary_tags::payload_target: {
+        if (!binary::readTarget(value, packet.target.data)) {
+          return {};
+        }
+        packet.target.error = false;
+        break;
+      };
+      default: {
+        break;
+      };
+    }
+  }
+
+  packet_monad.error = false;
+  return packet_monad;
+}
+
 static auto jsonExtractPacketHeader(const QJsonDocument& jsonObj)
     -> common::result_t<packet_t::header_t> {
   common::result_t<packet_t::header_t> header_monad;
@@ -141,6 +721,12 @@ static auto jsonExtractPacketHeader(const QJsonDocument& jsonObj)
       header_status_data.toString());
   header_monad.data.msg = header_msg_data.toString();
 
+  const auto header_request_id_data =
+      header_data[response_json_tags::header_request_id];
+  if (!header_request_id_data.isUndefined()) {
+    header_monad.data.request_id = header_request_id_data.toString();
+  }
+
   return header_monad;
 }
 
@@ -196,6 +782,14 @@ static auto jsonExtractTargetData(const QJsonDocument& jsonObj)
   if (!payload_target_username_data.isUndefined()) {
     target_data_monad.data.username = payload_target_username_data.toString();
   }
+  target_data_monad.data.next =
+      payload_target_data[response_json_tags::payload_target_next]
+          .toString()
+          .toULongLong();
+  target_data_monad.data.last =
+      payload_target_data[response_json_tags::payload_target_last]
+          .toString()
+          .toULongLong();
   if (!payload_target_messages_data.isUndefined()) {
     for (const auto& message : payload_target_messages_data.toArray()) {
       const auto& msg = message.toObject();
@@ -214,6 +808,25 @@ static auto jsonExtractTargetData(const QJsonDocument& jsonObj)
       }
     }
   }
+  for (const auto& line :
+       payload_target_data[response_json_tags::payload_target_inbox]
+           .toArray()) {
+    const auto line_obj = line.toObject();
+    packet_t::payload_t::target_t::conversation_t conversation;
+    conversation.username =
+        line_obj[response_json_tags::payload_target_inbox_username].toString();
+    conversation.last_message_id =
+        line_obj[response_json_tags::payload_target_inbox_last]
+            .toString()
+            .toULongLong();
+    conversation.last_message =
+        line_obj[response_json_tags::payload_target_inbox_message].toString();
+    conversation.unread =
+        line_obj[response_json_tags::payload_target_inbox_unread]
+            .toString()
+            .toULongLong();
+    target_data_monad.data.inbox.push_back(conversation);
+  }
   if (!payload_target_all_messages_data.isUndefined()) {
     for (const auto& one_user_msgs :
          payload_target_all_messages_data.toArray()) {
@@ -252,8 +865,25 @@ static auto jsonExtractTargetData(const QJsonDocument& jsonObj)
   return target_data_monad;
 }
 
+static auto jsonExtractPacket(const QJsonDocument& jsonObj)
+    -> common::result_t<wire_packet_t> {
+  const auto header_monad = jsonExtractPacketHeader(jsonObj);
+  if (header_monad.error) {
+    return {};
+  }
+
+  common::result_t<wire_packet_t> packet_monad;
+  packet_monad.error = false;
+  packet_monad.data.header = header_monad.data;
+  packet_monad.data.auth_data = jsonExtractAuthData(jsonObj);
+  packet_monad.data.target = jsonExtractTargetData(jsonObj);
+
+  return packet_monad;
+}
+
 struct Request {
   QString header_command;
+  QString header_request_id;  // set by the client right before sending
 
   Request(packet::packet_t::header_t::command_t header_command)
       : header_command(
@@ -261,6 +891,33 @@ struct Request {
   ~Request() = default;
 
   virtual QJsonDocument to_json() { return {}; };
+  virtual wire_packet_t to_packet() { return headerToPacket_(); };
+
+  QByteArray to_binary() { return binaryEncodePacket(to_packet()); }
+
+ protected:
+  wire_packet_t headerToPacket_() const {
+    wire_packet_t packet;
+
+    packet.header.command =
+        packet::packet_t::header_t::QStringToCommand(header_command);
+    packet.header.request_id = header_request_id;
+
+    return packet;
+  }
+
+  QJsonObject headerToJson_() const {
+    QJsonObject header_json;
+
+    header_json.insert(packet::request_json_tags::header_command,
+                       header_command);
+    if (!header_request_id.isEmpty()) {
+      header_json.insert(packet::request_json_tags::header_request_id,
+                         header_request_id);
+    }
+
+    return header_json;
+  }
 };
 
 struct AuthenRequest : public Request {
@@ -274,9 +931,18 @@ struct AuthenRequest : public Request {
         payload_auth_data_username(payload_auth_data_username),
         payload_auth_data_password(payload_auth_data_password) {}
 
+  wire_packet_t to_packet() {
+    auto packet = headerToPacket_();
+
+    packet.auth_data.error = false;
+    packet.auth_data.data.username = payload_auth_data_username;
+    packet.auth_data.data.password = payload_auth_data_password;
+
+    return packet;
+  }
+
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject auth_data_json;
 
@@ -288,8 +954,7 @@ struct AuthenRequest : public Request {
     payload_json.insert(packet::request_json_tags::payload_auth_data,
                         auth_data_json);
 
-    header_json.insert(packet::request_json_tags::header_command,
-                       header_command);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::request_json_tags::payload, payload_json);
     response.insert(packet::request_json_tags::header, header_json);
@@ -324,9 +989,18 @@ struct AuthRequest : public Request {
         payload_auth_data_username(payload_auth_data_username),
         payload_auth_data_session_id(payload_auth_data_session_id) {}
 
+  wire_packet_t to_packet() {
+    auto packet = headerToPacket_();
+
+    packet.auth_data.error = false;
+    packet.auth_data.data.username = payload_auth_data_username;
+    packet.auth_data.data.session_id = payload_auth_data_session_id;
+
+    return packet;
+  }
+
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject auth_data_json;
 
@@ -339,8 +1013,7 @@ struct AuthRequest : public Request {
     payload_json.insert(packet::request_json_tags::payload_auth_data,
                         auth_data_json);
 
-    header_json.insert(packet::request_json_tags::header_command,
-                       header_command);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::request_json_tags::payload, payload_json);
     response.insert(packet::request_json_tags::header, header_json);
@@ -370,9 +1043,18 @@ struct SendMsgRequest : public AuthRequest {
         payload_target_username(payload_target_username),
         payload_target_message(payload_target_message) {}
 
+  wire_packet_t to_packet() {
+    auto packet = AuthRequest::to_packet();
+
+    packet.target.error = false;
+    packet.target.data.username = payload_target_username;
+    packet.target.data.message = payload_target_message;
+
+    return packet;
+  }
+
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject auth_data_json;
     QJsonObject target_json;
@@ -392,8 +1074,7 @@ struct SendMsgRequest : public AuthRequest {
     payload_json.insert(packet::request_json_tags::payload_auth_data,
                         auth_data_json);
 
-    header_json.insert(packet::request_json_tags::header_command,
-                       header_command);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::request_json_tags::payload, payload_json);
     response.insert(packet::request_json_tags::header, header_json);
@@ -403,25 +1084,60 @@ struct SendMsgRequest : public AuthRequest {
   }
 };
 
+// without a cursor and a limit the whole conversation is returned, with a
+// limit only the newest messages, older pages are fetched with the next
+// cursor of the response as before
 struct GetMsgsRequest : public AuthRequest {
   QString payload_target_username;
+  quint64 payload_target_before;
+  quint64 payload_target_after;
+  quint64 payload_target_limit;
 
   GetMsgsRequest(const QString& payload_auth_data_username,
                  const QString& payload_auth_data_session_id,
-                 const QString& payload_target_username)
+                 const QString& payload_target_username,
+                 const quint64 payload_target_before = 0,
+                 const quint64 payload_target_after = 0,
+                 const quint64 payload_target_limit = 0)
       : AuthRequest(packet::packet_t::header_t::command_t::GETMSGS,
                     payload_auth_data_username, payload_auth_data_session_id),
-        payload_target_username(payload_target_username) {}
+        payload_target_username(payload_target_username),
+        payload_target_before(payload_target_before),
+        payload_target_after(payload_target_after),
+        payload_target_limit(payload_target_limit) {}
+
+  wire_packet_t to_packet() {
+    auto packet = AuthRequest::to_packet();
+
+    packet.target.error = false;
+    packet.target.data.username = payload_target_username;
+    packet.target.data.before = payload_target_before;
+    packet.target.data.after = payload_target_after;
+    packet.target.data.limit = payload_target_limit;
+
+    return packet;
+  }
 
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject auth_data_json;
     QJsonObject target_json;
 
     target_json.insert(packet::request_json_tags::payload_target_username,
                        payload_target_username);
+    if (payload_target_before != 0) {
+      target_json.insert(packet::request_json_tags::payload_target_before,
+                         QString::number(payload_target_before));
+    }
+    if (payload_target_after != 0) {
+      target_json.insert(packet::request_json_tags::payload_target_after,
+                         QString::number(payload_target_after));
+    }
+    if (payload_target_limit != 0) {
+      target_json.insert(packet::request_json_tags::payload_target_limit,
+                         QString::number(payload_target_limit));
+    }
 
     auth_data_json.insert(packet::request_json_tags::payload_auth_data_username,
                           payload_auth_data_username);
@@ -433,8 +1149,7 @@ struct GetMsgsRequest : public AuthRequest {
     payload_json.insert(packet::request_json_tags::payload_auth_data,
                         auth_data_json);
 
-    header_json.insert(packet::request_json_tags::header_command,
-                       header_command);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::request_json_tags::payload, payload_json);
     response.insert(packet::request_json_tags::header, header_json);
@@ -444,17 +1159,95 @@ struct GetMsgsRequest : public AuthRequest {
   }
 };
 
+// with since only the messages newer than it are returned, the response
+// carries the since of the next sync
 struct GetAllMsgsRequest : public AuthRequest {
+  quint64 payload_target_since;
+
   GetAllMsgsRequest(const QString& payload_auth_data_username,
-                    const QString& payload_auth_data_session_id)
+                    const QString& payload_auth_data_session_id,
+                    const quint64 payload_target_since = 0)
       : AuthRequest(packet::packet_t::header_t::command_t::GETALLMSGS,
+                    payload_auth_data_username, payload_auth_data_session_id),
+        payload_target_since(payload_target_since) {}
+
+  wire_packet_t to_packet() {
+    auto packet = AuthRequest::to_packet();
+
+    if (payload_target_since != 0) {
+      packet.target.error = false;
+      packet.target.data.since = payload_target_since;
+    }
+
+    return packet;
+  }
+
+  QJsonDocument to_json() {
+    QJsonObject response;
+    QJsonObject payload_json;
+    QJsonObject auth_data_json;
+
+    auth_data_json.insert(packet::request_json_tags::payload_auth_data_username,
+                          payload_auth_data_username);
+    auth_data_json.insert(
+        packet::request_json_tags::payload_auth_data_session_id,
+        payload_auth_data_session_id);
+
+    if (payload_target_since != 0) {
+      QJsonObject target_json;
+      target_json.insert(packet::request_json_tags::payload_target_since,
+                         QString::number(payload_target_since));
+      payload_json.insert(packet::request_json_tags::payload_target,
+                          target_json);
+    }
+    payload_json.insert(packet::request_json_tags::payload_auth_data,
+                        auth_data_json);
+
+    const auto header_json = headerToJson_();
+
+    response.insert(packet::request_json_tags::payload, payload_json);
+    response.insert(packet::request_json_tags::header, header_json);
+
+    QJsonDocument doc(response);
+    return doc;
+  }
+};
+
+struct GetInboxRequest : public AuthRequest {
+  GetInboxRequest(const QString& payload_auth_data_username,
+                  const QString& payload_auth_data_session_id)
+      : AuthRequest(packet::packet_t::header_t::command_t::GETINBOX,
                     payload_auth_data_username, payload_auth_data_session_id) {}
+};
+
+// resets the unread count of the conversation with the target user
+struct ReadRequest : public AuthRequest {
+  QString payload_target_username;
+
+  ReadRequest(const QString& payload_auth_data_username,
+              const QString& payload_auth_data_session_id,
+              const QString& payload_target_username)
+      : AuthRequest(packet::packet_t::header_t::command_t::READ,
+                    payload_auth_data_username, payload_auth_data_session_id),
+        payload_target_username(payload_target_username) {}
+
+  wire_packet_t to_packet() {
+    auto packet = AuthRequest::to_packet();
+
+    packet.target.error = false;
+    packet.target.data.username = payload_target_username;
+
+    return packet;
+  }
 
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject auth_data_json;
+    QJsonObject target_json;
+
+    target_json.insert(packet::request_json_tags::payload_target_username,
+                       payload_target_username);
 
     auth_data_json.insert(packet::request_json_tags::payload_auth_data_username,
                           payload_auth_data_username);
@@ -462,11 +1255,11 @@ struct GetAllMsgsRequest : public AuthRequest {
         packet::request_json_tags::payload_auth_data_session_id,
         payload_auth_data_session_id);
 
+    payload_json.insert(packet::request_json_tags::payload_target, target_json);
     payload_json.insert(packet::request_json_tags::payload_auth_data,
                         auth_data_json);
 
-    header_json.insert(packet::request_json_tags::header_command,
-                       header_command);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::request_json_tags::payload, payload_json);
     response.insert(packet::request_json_tags::header, header_json);
@@ -476,4 +1269,35 @@ struct GetAllMsgsRequest : public AuthRequest {
   }
 };
 
+// switches the wire format of every following packet, in both directions
+struct SetCodecRequest : public Request {
+  packet::packet_t::header_t::codec_t header_codec;
+
+  SetCodecRequest(packet::packet_t::header_t::codec_t header_codec)
+      : Request(packet::packet_t::header_t::command_t::SETCODEC),
+        header_codec(header_codec) {}
+
+  wire_packet_t to_packet() {
+    auto packet = headerToPacket_();
+
+    packet.header.codec = header_codec;
+
+    return packet;
+  }
+
+  QJsonDocument to_json() {
+    QJsonObject response;
+
+    auto header_json = headerToJson_();
+    header_json.insert(
+        packet::request_json_tags::header_codec,
+        QString::number(static_cast<quint16>(header_codec)));
+
+    response.insert(packet::request_json_tags::header, header_json);
+
+    QJsonDocument doc(response);
+    return doc;
+  }
+};
+
 };  // namespace packet
\ No newline at end of file
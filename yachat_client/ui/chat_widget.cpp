@@ -39,7 +39,13 @@ ChatWidget::ChatWidget(Client& client) : client_(client) {
 
     setLayout(main_layout);
 
-    client_.SendGetAllMsgs();
+    // a new session always starts with a full sync
+    all_messages_.clear();
+    last_message_id_ = 0;
+    syncing_ = false;
+    resync_ = false;
+    pending_sends_.clear();
+    sync_();
 
     loginWidget_->close();
 
@@ -55,39 +61,126 @@ ChatWidget::ChatWidget(Client& client) : client_(client) {
     // process send
     connect(sendButton, &QPushButton::clicked, this, [this, messageField]() {
       const auto& msg = messageField->toPlainText();
-      client_.SendSendMsg(selected_user_, msg);
-      client_.SendGetMsgs(selected_user_);
+      pending_sends_.insert(client_.SendSendMsg(selected_user_, msg),
+                            {selected_user_, msg});
     });
 
+    // the message is shown once the server answers OK; failures are
+    // reported by the login widget
+    connect(&client_, &Client::respStatusReceived, this,
+            [this](packet::packet_t::header_t::status_t status,
+                   const QString&, const QString& request_id) {
+              const auto sent = pending_sends_.take(request_id);
+              if (sent.first.isEmpty() ||
+                  status != packet::packet_t::header_t::status_t::OK) {
+                return;
+              }
+
+              all_messages_[sent.first].push_back(
+                  {packet::response_json_tags::payload_target_messages_y,
+                   sent.second});
+              showUser_(sent.first, 0);
+              if (selected_user_ == sent.first) {
+                updateMessages_(selected_user_);
+              }
+            });
+
     // process get all msgs response
     connect(
         &client_, &Client::respAllMsgsReceived, this,
         [this](packet::packet_t::header_t::status_t status, const QString& msg,
                QHash<QString,
                      QList<packet::packet_t::payload_t::target_t::message_t>>
-                   all_messages) {
+                   all_messages,
+               quint64 last) {
+          syncing_ = false;
           if (status == packet::packet_t::header_t::status_t::OK) {
-            usersList_->clear();
-            foreach (const auto& username, all_messages.keys()) {
-              usersList_->addItem(username);
+            if (last_message_id_ == 0) {
+              all_messages_ = all_messages;
+            } else if (last > last_message_id_) {
+              // a delta, the messages are newer than everything shown
+              for (auto it = all_messages.cbegin(); it != all_messages.cend();
+                   ++it) {
+                all_messages_[it.key()].append(it.value());
+              }
             }
-            all_messages_ = all_messages;
+            // a server without delta sync reports no mark, every sync is a
+            // full one then
+            last_message_id_ = qMax(last_message_id_, last);
+
+            // the users list is built from the inbox, it comes with the
+            // unread counts
+            client_.SendGetInbox();
             updateMessages_(selected_user_);
           } else {
             QMessageBox::warning(this, "Failure", msg, QMessageBox::Ok);
           }
+
+          if (resync_) {
+            resync_ = false;
+            sync_();
+          }
         });
 
-    // process notify response
-    connect(&client_, &Client::respNotifyReceived, this,
-            [this](packet::packet_t::header_t::status_t status,
-                   const QString& msg, const QString& username) {
-              if (status == packet::packet_t::header_t::status_t::OK) {
-                client_.SendGetMsgs(username);
-              } else {
-                QMessageBox::warning(this, "Failure", msg, QMessageBox::Ok);
-              }
-            });
+    // process inbox response
+    connect(
+        &client_, &Client::respInboxReceived, this,
+        [this](packet::packet_t::header_t::status_t status, const QString& msg,
+               const QList<
+                   packet::packet_t::payload_t::target_t::conversation_t>&
+                   inbox) {
+          if (status != packet::packet_t::header_t::status_t::OK) {
+            QMessageBox::warning(this, "Failure", msg, QMessageBox::Ok);
+            return;
+          }
+
+          usersList_->clear();
+          // shown from the oldest one, each one goes on top
+          for (auto it = inbox.crbegin(); it != inbox.crend(); ++it) {
+            auto unread = it->unread;
+            // the open conversation is read as soon as it's shown
+            if (unread > 0 && it->username == selected_user_) {
+              client_.SendRead(it->username);
+              unread = 0;
+            }
+            showUser_(it->username, unread);
+          }
+        });
+
+    // process notify response, the new message is appended as it is; the
+    // server still counts it unread if its conversation is open, that's
+    // settled by the next inbox
+    connect(
+        &client_, &Client::respNotifyReceived, this,
+        [this](packet::packet_t::header_t::status_t status, const QString& msg,
+               const QString& username,
+               const QList<packet::packet_t::payload_t::target_t::message_t>&
+                   messages,
+               quint64 message_id) {
+          if (status != packet::packet_t::header_t::status_t::OK) {
+            QMessageBox::warning(this, "Failure", msg, QMessageBox::Ok);
+            return;
+          }
+
+          // a server that doesn't push messages only says who wrote
+          if (message_id == 0) {
+            sync_();
+            return;
+          }
+
+          // messages to oneself are already shown once the send is OK
+          if (username == client_.getUsername()) {
+            return;
+          }
+
+          all_messages_[username].append(messages);
+          if (selected_user_ == username) {
+            showUser_(username, 0);
+            updateMessages_(selected_user_);
+          } else {
+            showUser_(username, messages.size());
+          }
+        });
 
     // process get msgs response
     connect(
@@ -109,13 +202,48 @@ ChatWidget::ChatWidget(Client& client) : client_(client) {
     // process get messages for selected user
     connect(usersList_.get(), &QListWidget::itemClicked, this,
             [this](QListWidgetItem* item) {
-              QString username = item->text();
+              const auto username = item->data(Qt::UserRole).toString();
+              if (item->data(Qt::UserRole + 1).toULongLong() > 0) {
+                client_.SendRead(username);
+                item->setData(Qt::UserRole + 1, 0);
+                item->setText(username);
+              }
               selected_user_ = username;
               updateMessages_(selected_user_);
             });
   });
 }
 
+void ChatWidget::sync_() {
+  if (syncing_) {
+    resync_ = true;
+    return;
+  }
+
+  syncing_ = true;
+  client_.SendGetAllMsgs(last_message_id_);
+}
+
+void ChatWidget::showUser_(const QString& username, quint64 unread) {
+  QListWidgetItem* item = nullptr;
+  for (int i = 0; i < usersList_->count(); ++i) {
+    if (usersList_->item(i)->data(Qt::UserRole).toString() == username) {
+      item = usersList_->takeItem(i);
+      break;
+    }
+  }
+  if (!item) {
+    item = new QListWidgetItem();
+    item->setData(Qt::UserRole, username);
+  }
+
+  unread += item->data(Qt::UserRole + 1).toULongLong();
+  item->setData(Qt::UserRole + 1, unread);
+  item->setText(unread > 0 ? username + " (" + QString::number(unread) + ")"
+                           : username);
+  usersList_->insertItem(0, item);
+}
+
 void ChatWidget::updateMessages_(const QString& username) {
   messagesList_->clear();
   foreach (const auto& msg, all_messages_[username]) {
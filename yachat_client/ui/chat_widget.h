@@ -1,8 +1,10 @@
 #ifndef CHAT_WIDGET_H
 #define CHAT_WIDGET_H
 
+#include <QHash>
 #include <QLabel>
 #include <QListWidget>
+#include <QPair>
 #include <QTextEdit>
 #include <QWidget>
 #include <memory>
@@ -37,6 +39,16 @@ class ChatWidget final : public QWidget {
   QHash<QString, QList<packet::packet_t::payload_t::target_t::message_t>>
       all_messages_;
   QString selected_user_;
+  // all_messages_ holds every message up to this id, later syncs only fetch
+  // the newer ones; one sync is in flight at a time
+  quint64 last_message_id_ = 0;
+  bool syncing_ = false;
+  bool resync_ = false;
+  // <request id, <target username, message>> of unanswered SENDMSGs
+  QHash<QString, QPair<QString, QString>> pending_sends_;
+  void sync_();
+  // moves the user on top of the users list, adding unread to its count
+  void showUser_(const QString& username, quint64 unread);
   void updateMessages_(const QString& username);
   void addMessageToList_(std::shared_ptr<QListWidget> list,
                          MessageBlock* msgBlock);
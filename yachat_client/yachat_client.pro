@@ -14,6 +14,7 @@ SOURCES += \
 HEADERS += \
     common.hpp \
     config.hpp \
+    frame.hpp \
     packet.hpp \
     client.hpp \
     ui/login_widget.h \
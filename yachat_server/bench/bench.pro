@@ -0,0 +1,10 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+        client_bench \
+        dataset_gen \
+        db_bench \
+        loadgen \
+        packet_bench \
+        query_bench \
+        request_bench
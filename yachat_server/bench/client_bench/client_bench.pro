@@ -0,0 +1,9 @@
+QT = core
+
+CONFIG += c++17 cmdline
+
+SOURCES += \
+        main.cpp
+
+# the client's packet.hpp, not the server's
+INCLUDEPATH += .. ../../../yachat_client
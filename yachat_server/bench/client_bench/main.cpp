@@ -0,0 +1,276 @@
+// Measures the client's side of the wire, built against yachat_client's
+// packet.hpp:
+//   requests  - the *Request builders, JSON and binary encode, one per
+//               command
+//   responses - jsonExtractPacket (after QJsonDocument::fromJson) and
+//               binaryDecodePacket, one per response type, with histories
+//               from empty to 10k messages
+// The responses are laid out as the server sends them. Reports the packet
+// size, ns/op, heap bytes/op and allocations/op. Run on a release build,
+// e.g. `./client_bench 200000`.
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <cstdlib>
+
+#include "measure.hpp"
+#include "packet.hpp"
+
+namespace {
+
+using bench::measure;
+using bench::report;
+using bench::scaled;
+using command_t = packet::packet_t::header_t::command_t;
+using status_t = packet::packet_t::header_t::status_t;
+using message_t = packet::packet_t::payload_t::target_t::message_t;
+
+QList<message_t> history(const int size) {
+  QList<message_t> messages;
+  for (int i = 0; i < size; ++i) {
+    messages.push_back({i % 2 ? "y" : "t",
+                        "message number " + QString::number(i) +
+                            ", long enough to look like a real one"});
+  }
+  return messages;
+}
+
+QJsonArray messagesJson(const QList<message_t>& messages) {
+  QJsonArray messages_json;
+  for (const auto& message : messages) {
+    messages_json.append(QJsonObject{{message.side, message.message}});
+  }
+  return messages_json;
+}
+
+// the JSON the server sends for the packet, see the *Response builders of
+// the server
+QByteArray responseJson(const packet::wire_packet_t& response) {
+  QJsonObject header{
+      {packet::response_json_tags::header_command,
+       packet::packet_t::header_t::commandToQString(response.header.command)},
+      {packet::response_json_tags::header_status,
+       packet::packet_t::header_t::statusToQString(response.header.status)},
+      {packet::response_json_tags::header_msg, response.header.msg},
+      {packet::response_json_tags::header_request_id,
+       response.header.request_id}};
+
+  QJsonObject payload;
+  if (!response.auth_data.error) {
+    payload.insert(packet::response_json_tags::payload_auth_data,
+                   QJsonObject{{packet::response_json_tags::
+                                    payload_auth_data_session_id,
+                                response.auth_data.data.session_id}});
+  }
+  if (!response.target.error) {
+    const auto& target = response.target.data;
+    QJsonObject target_json;
+    if (!target.username.isEmpty()) {
+      target_json.insert(packet::response_json_tags::payload_target_username,
+                         target.username);
+    }
+    if (response.header.command == command_t::MSGS ||
+        !target.messages.isEmpty()) {
+      target_json.insert(packet::response_json_tags::payload_target_messages,
+                         messagesJson(target.messages));
+    }
+    if (response.header.command == command_t::ALLMSGS) {
+      QJsonArray all_messages;
+      for (auto it = target.all_messages.cbegin();
+           it != target.all_messages.cend(); ++it) {
+        all_messages.append(QJsonObject{
+            {packet::response_json_tags::payload_target_all_messages_username,
+             it.key()},
+            {packet::response_json_tags::payload_target_all_messages_messages,
+             messagesJson(it.value())}});
+      }
+      target_json.insert(
+          packet::response_json_tags::payload_target_all_messages,
+          all_messages);
+    }
+    if (response.header.command == command_t::INBOX) {
+      QJsonArray inbox;
+      for (const auto& line : target.inbox) {
+        inbox.append(QJsonObject{
+            {packet::response_json_tags::payload_target_inbox_username,
+             line.username},
+            {packet::response_json_tags::payload_target_inbox_last,
+             QString::number(line.last_message_id)},
+            {packet::response_json_tags::payload_target_inbox_message,
+             line.last_message},
+            {packet::response_json_tags::payload_target_inbox_unread,
+             QString::number(line.unread)}});
+      }
+      target_json.insert(packet::response_json_tags::payload_target_inbox,
+                         inbox);
+    }
+    if (target.next != 0) {
+      target_json.insert(packet::response_json_tags::payload_target_next,
+                         QString::number(target.next));
+    }
+    if (target.last != 0) {
+      target_json.insert(packet::response_json_tags::payload_target_last,
+                         QString::number(target.last));
+    }
+    payload.insert(packet::response_json_tags::payload_target, target_json);
+  }
+
+  QJsonObject json{{packet::response_json_tags::header, header}};
+  if (!payload.isEmpty()) {
+    json.insert(packet::response_json_tags::payload, payload);
+  }
+  return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+packet::wire_packet_t response(const command_t command, const QString& msg) {
+  packet::wire_packet_t response;
+  response.header.command = command;
+  response.header.status = status_t::OK;
+  response.header.msg = msg;
+  response.header.request_id = "42";
+  return response;
+}
+
+packet::wire_packet_t response(
+    const command_t command, const QString& msg,
+    const packet::packet_t::payload_t::target_t& target) {
+  auto wire = response(command, msg);
+  wire.target.error = false;
+  wire.target.data = target;
+  return wire;
+}
+
+// the request id is set right before sending, as the client does
+void compareRequest(const QString& name, packet::Request& request,
+                    const int iterations) {
+  request.header_request_id = "42";
+  const auto json = request.to_json().toJson(QJsonDocument::Compact);
+  const auto binary = request.to_binary();
+
+  report(name, "json encode", json.size(), measure(iterations, [&]() {
+           return request.to_json().toJson(QJsonDocument::Compact).size();
+         }));
+  report(name, "binary encode", binary.size(), measure(iterations, [&]() {
+           return request.to_binary().size();
+         }));
+}
+
+void compare(const QString& name, const packet::wire_packet_t& response,
+             const int iterations) {
+  const auto json = responseJson(response);
+  const auto binary = packet::binaryEncodePacket(response);
+
+  report(name, "json decode", json.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::jsonExtractPacket(QJsonDocument::fromJson(json))
+                   .error);
+         }));
+  report(name, "binary decode", binary.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::binaryDecodePacket(binary).error);
+         }));
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  const auto iterations =
+      qMax(argc > 1 ? QString(argv[1]).toInt() : 100000, 1);
+
+  bench::header("packet", "path");
+
+  const QString username = "alice";
+  const QString password = "correct horse battery staple";
+  const QString session_id = "1804289383";
+
+  packet::RegisterRequest register_request(username, password);
+  compareRequest("register", register_request, iterations);
+  packet::LoginRequest login(username, password);
+  compareRequest("login", login, iterations);
+  packet::LogoutRequest logout(username, session_id);
+  compareRequest("logout", logout, iterations);
+  packet::SendMsgRequest sendmsg(username, session_id, "bob",
+                                 "hello there, \"bob\"\nhow are you doing?");
+  compareRequest("sendmsg", sendmsg, iterations);
+  packet::GetMsgsRequest getmsgs(username, session_id, "bob", 0, 0, 50);
+  compareRequest("getmsgs", getmsgs, iterations);
+  packet::GetAllMsgsRequest getallmsgs(username, session_id);
+  compareRequest("getallmsgs", getallmsgs, iterations);
+  packet::GetAllMsgsRequest getallmsgs_since(username, session_id, 1187);
+  compareRequest("getallmsgs-since", getallmsgs_since, iterations);
+  packet::GetInboxRequest getinbox(username, session_id);
+  compareRequest("getinbox", getinbox, iterations);
+  packet::ReadRequest read(username, session_id, "bob");
+  compareRequest("read", read, iterations);
+  packet::SetCodecRequest setcodec(packet::packet_t::header_t::codec_t::BINARY);
+  compareRequest("setcodec", setcodec, iterations);
+
+  compare("status",
+          response(command_t::STATUS, "Command 'sendmsg' completed"),
+          iterations);
+
+  auto auth = response(command_t::AUTH, "Command 'login' completed");
+  auth.auth_data.error = false;
+  auth.auth_data.data.session_id = session_id;
+  compare("auth", auth, iterations);
+
+  packet::packet_t::payload_t::target_t notify_target;
+  notify_target.username = username;
+  compare("notify", response(command_t::NOTIFY, "Notify", notify_target),
+          iterations);
+  notify_target.messages = {{"t", "see you at noon then"}};
+  notify_target.last = 1205;
+  compare("notify-message",
+          response(command_t::NOTIFY, "Notify", notify_target), iterations);
+
+  for (const auto size : {0, 1, 100, 1000, 10000}) {
+    packet::packet_t::payload_t::target_t target;
+    target.username = "bob";
+    target.messages = history(size);
+    compare("msgs-" + QString::number(size),
+            response(command_t::MSGS, "Command 'getmsgs' completed", target),
+            scaled(iterations, size));
+  }
+
+  // conversations x messages each
+  for (const auto& shape : QList<QPair<int, int>>{
+           {0, 0}, {1, 10}, {20, 50}, {100, 100}}) {
+    packet::packet_t::payload_t::target_t target;
+    for (int i = 0; i < shape.first; ++i) {
+      target.all_messages.insert("user" + QString::number(i),
+                                 history(shape.second));
+    }
+    target.last = 1205;
+    compare("allmsgs-" + QString::number(shape.first) + "x" +
+                QString::number(shape.second),
+            response(command_t::ALLMSGS, "Command 'getallmsgs' completed",
+                     target),
+            scaled(iterations, shape.first * shape.second));
+  }
+
+  for (const auto size : {0, 10, 1000}) {
+    packet::packet_t::payload_t::target_t target;
+    for (int i = 0; i < size; ++i) {
+      target.inbox.push_back({"user" + QString::number(i),
+                              static_cast<quint64>(1000 + i),
+                              "the beginning of the last message",
+                              static_cast<quint64>(i % 5)});
+    }
+    compare("inbox-" + QString::number(size),
+            response(command_t::INBOX, "Command 'getinbox' completed",
+                     target),
+            scaled(iterations, size));
+  }
+
+  bench::out << "checksum " << bench::sink << "\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+// The shape of a generated dataset, shared by dataset_gen, which writes it,
+// and query_bench, which has to hit the same hot users and conversations.
+// Users are numbered from 0, user n is "user<n>" with user_id n + 1. How
+// much a user writes follows a Zipf distribution over the users, and whom
+// to follows one over a fixed list of contacts per user, so a few users and
+// a few conversations of each user carry most of the messages.
+
+#include <QList>
+#include <QRandomGenerator>
+#include <QString>
+#include <algorithm>
+#include <cmath>
+
+namespace bench {
+
+// ranks from 0 to size - 1, rank r drawn with a probability proportional to
+// 1 / (r + 1)^exponent; exponent 0 is uniform
+class Zipf {
+ public:
+  Zipf(const qint64 size, const double exponent) {
+    cdf_.reserve(size);
+    double total = 0;
+    for (qint64 rank = 0; rank < size; ++rank) {
+      total += 1.0 / std::pow(static_cast<double>(rank + 1), exponent);
+      cdf_.push_back(total);
+    }
+    for (auto& probability : cdf_) {
+      probability /= total;
+    }
+  }
+
+  qint64 size() const { return cdf_.size(); }
+
+  // a binary search of the cumulative distribution
+  qint64 operator()(QRandomGenerator& random) const {
+    const auto it = std::upper_bound(cdf_.cbegin(), cdf_.cend(),
+                                     random.generateDouble());
+    return qMin<qint64>(it - cdf_.cbegin(), cdf_.size() - 1);
+  }
+
+ private:
+  QList<double> cdf_;
+};
+
+QString username(const qint64 user) { return "user" + QString::number(user); }
+
+quint64 userId(const qint64 user) { return user + 1; }
+
+// the rank-th contact of user, any other user, the same on every run;
+// users must be at least 2
+qint64 contact(const qint64 user, const qint64 rank, const qint64 users) {
+  // splitmix64 of (user, rank)
+  quint64 mixed = static_cast<quint64>(user) * 0x9e3779b97f4a7c15ULL +
+                  static_cast<quint64>(rank) + 1;
+  mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+  mixed ^= mixed >> 31;
+
+  const auto peer = static_cast<qint64>(mixed % (users - 1));
+  return peer >= user ? peer + 1 : peer;
+}
+
+// the parameters both tools must agree on
+struct shape_t {
+  double skew = 1.0;          // Zipf exponent of the users' activity
+  qint64 contacts = 50;       // peers a user writes to
+  double contact_skew = 1.0;  // Zipf exponent over a user's contacts
+};
+
+// draws (user, peer) pairs the way the dataset's conversations are spread
+class Conversations {
+ public:
+  Conversations(const qint64 users, const shape_t& shape)
+      : users_(users),
+        activity_(users, shape.skew),
+        contacts_(qMin(shape.contacts, users - 1), shape.contact_skew) {}
+
+  qint64 user(QRandomGenerator& random) const { return activity_(random); }
+
+  qint64 peer(const qint64 user, QRandomGenerator& random) const {
+    return contact(user, contacts_(random), users_);
+  }
+
+ private:
+  qint64 users_;
+  Zipf activity_;
+  Zipf contacts_;
+};
+
+};  // namespace bench
@@ -0,0 +1,229 @@
+// Generates a database to run DB's queries against at scale: users and the
+// messages between them, a few users writing most of the messages and each
+// user writing mostly to a few of its contacts (see dataset.hpp). The
+// messages are bulk loaded into the initial schema, then the database is
+// migrated to the latest version, which builds the indexes and the
+// conversation summaries in one pass each, e.g.
+// `./dataset_gen /tmp/10m.sqlite --users 100000 --messages 10000000`.
+// The file is recreated on every run.
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QString>
+#include <QTextStream>
+#include <cstdlib>
+#include <utility>
+
+#include "dataset.hpp"
+#include "db.hpp"
+#include "migration.hpp"
+
+namespace {
+
+QTextStream out(stdout);
+
+struct options_t {
+  QString path;
+  qint64 users = 100000;
+  qint64 messages = 10000000;
+  bench::shape_t shape;
+  quint32 seed = 1;
+  qint64 batch = 100000;  // rows per transaction
+  int min_length = 10;
+  int max_length = 200;
+};
+
+bool generateUsers(const options_t& options) {
+  auto sdb = QSqlDatabase::database();
+  QSqlQuery query(sdb);
+
+  sdb.transaction();
+  query.prepare("INSERT INTO users (user_id, username, password) VALUES (?, "
+                "?, ?)");
+  for (qint64 user = 0; user < options.users; ++user) {
+    query.addBindValue(bench::userId(user));
+    query.addBindValue(bench::username(user));
+    query.addBindValue("password");
+    if (!query.exec()) {
+      out << "Can't add a user: " << query.lastError().text() << Qt::endl;
+      sdb.rollback();
+      return false;
+    }
+  }
+  return sdb.commit();
+}
+
+bool generateMessages(const options_t& options) {
+  auto sdb = QSqlDatabase::database();
+  QSqlQuery query(sdb);
+  query.prepare(
+      "INSERT INTO messages (from_user_id, to_user_id, message) VALUES (?, ?, "
+      "?)");
+
+  const bench::Conversations conversations(options.users, options.shape);
+  QRandomGenerator random(options.seed);
+
+  QString filler;
+  while (filler.size() < options.max_length) {
+    filler += "the quick brown fox jumps over the lazy dog ";
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  for (qint64 i = 0; i < options.messages; ++i) {
+    if (i % options.batch == 0) {
+      if (i != 0 && !sdb.commit()) {
+        return false;
+      }
+      sdb.transaction();
+    }
+
+    // replies are as likely as first messages, so both users of a
+    // conversation write to it
+    auto from = conversations.user(random);
+    auto to = conversations.peer(from, random);
+    if (random.bounded(2)) {
+      std::swap(from, to);
+    }
+
+    query.addBindValue(bench::userId(from));
+    query.addBindValue(bench::userId(to));
+    query.addBindValue(filler.left(random.bounded(options.min_length,
+                                                  options.max_length + 1)));
+    if (!query.exec()) {
+      out << "Can't add a message: " << query.lastError().text() << Qt::endl;
+      sdb.rollback();
+      return false;
+    }
+
+    if ((i + 1) % 1000000 == 0) {
+      out << (i + 1) / 1000000 << "M messages, "
+          << (i + 1) * 1000 / qMax<qint64>(timer.elapsed(), 1) << "/s"
+          << Qt::endl;
+    }
+  }
+  return sdb.commit();
+}
+
+options_t parse(const QCoreApplication& app) {
+  options_t options;
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Generates a yachat_server database for benchmarks");
+  parser.addHelpOption();
+  parser.addPositionalArgument("path", "Database file, recreated.");
+
+  const QCommandLineOption usersOption(
+      {"u", "users"}, "Users, at least 2.", "count",
+      QString::number(options.users));
+  const QCommandLineOption messagesOption(
+      {"m", "messages"}, "Messages between them.", "count",
+      QString::number(options.messages));
+  const QCommandLineOption skewOption(
+      "skew", "Zipf exponent of how much each user writes, 0 is uniform.",
+      "exponent", QString::number(options.shape.skew));
+  const QCommandLineOption contactsOption(
+      "contacts", "Peers each user writes to.", "count",
+      QString::number(options.shape.contacts));
+  const QCommandLineOption contactSkewOption(
+      "contact-skew",
+      "Zipf exponent of whom among its contacts a user writes to.",
+      "exponent", QString::number(options.shape.contact_skew));
+  const QCommandLineOption seedOption("seed", "Random seed.", "seed",
+                                      QString::number(options.seed));
+  const QCommandLineOption batchOption(
+      "batch", "Rows inserted per transaction.", "count",
+      QString::number(options.batch));
+  const QCommandLineOption lengthOption(
+      "length", "Shortest and longest message.", "min,max",
+      QString("%1,%2").arg(options.min_length).arg(options.max_length));
+
+  parser.addOption(usersOption);
+  parser.addOption(messagesOption);
+  parser.addOption(skewOption);
+  parser.addOption(contactsOption);
+  parser.addOption(contactSkewOption);
+  parser.addOption(seedOption);
+  parser.addOption(batchOption);
+  parser.addOption(lengthOption);
+  parser.process(app);
+
+  if (parser.positionalArguments().size() != 1) {
+    parser.showHelp(EXIT_FAILURE);
+  }
+
+  options.path = parser.positionalArguments().first();
+  options.users = qMax<qint64>(parser.value(usersOption).toLongLong(), 2);
+  options.messages =
+      qMax<qint64>(parser.value(messagesOption).toLongLong(), 0);
+  options.shape.skew = qMax(parser.value(skewOption).toDouble(), 0.0);
+  options.shape.contacts =
+      qMax<qint64>(parser.value(contactsOption).toLongLong(), 1);
+  options.shape.contact_skew =
+      qMax(parser.value(contactSkewOption).toDouble(), 0.0);
+  options.seed = parser.value(seedOption).toUInt();
+  options.batch = qMax<qint64>(parser.value(batchOption).toLongLong(), 1);
+
+  const auto lengths = parser.value(lengthOption).split(',');
+  if (lengths.size() == 2) {
+    options.min_length = qMax(lengths[0].toInt(), 1);
+    options.max_length = qMax(lengths[1].toInt(), options.min_length);
+  }
+
+  return options;
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  const auto options = parse(a);
+
+  QFile::remove(options.path);
+  QFile::remove(options.path + "-wal");
+  QFile::remove(options.path + "-shm");
+  if (!db::db.open(options.path, 1)) {
+    return EXIT_FAILURE;
+  }
+
+  // nothing is lost if the machine dies mid-run, the file is regenerated
+  QSqlQuery pragma(QSqlDatabase::database());
+  pragma.exec("PRAGMA synchronous=OFF");
+
+  QElapsedTimer timer;
+  timer.start();
+  if (!generateUsers(options)) {
+    return EXIT_FAILURE;
+  }
+  out << options.users << " users in " << timer.elapsed() << " ms"
+      << Qt::endl;
+
+  timer.restart();
+  if (!generateMessages(options)) {
+    return EXIT_FAILURE;
+  }
+  out << options.messages << " messages in " << timer.elapsed() << " ms"
+      << Qt::endl;
+
+  timer.restart();
+  if (!migration::run(QSqlDatabase::database())) {
+    return EXIT_FAILURE;
+  }
+  out << "migrated to v" << migration::latest() << " in " << timer.elapsed()
+      << " ms" << Qt::endl;
+
+  pragma.exec("PRAGMA wal_checkpoint(TRUNCATE)");
+
+  out << "skew " << options.shape.skew << ", contacts "
+      << options.shape.contacts << ", contact skew "
+      << options.shape.contact_skew
+      << " (pass the same to query_bench)" << Qt::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,9 @@
+QT = core
+QT += sql
+
+CONFIG += c++17 cmdline
+
+SOURCES += \
+        main.cpp
+
+INCLUDEPATH += ../../src
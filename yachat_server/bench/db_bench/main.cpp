@@ -0,0 +1,239 @@
+// Measures DB::getMsgs (the whole conversation and a 50 message page) and
+// DB::getAllMsgs latency on a generated database, first on the initial
+// schema (full table scans), then after migrating it to the latest version
+// (conversation indexes), and again with the conversation tail cache, which
+// getMsgs warms up. Then loads the history of one
+// user with a large one, as on login, the old way (a username query per
+// message) and the current one, and the delta of a reconnect.
+//   db_bench <path> [messages] [users] [samples] [history]
+// e.g. `./db_bench /tmp/bench.sqlite 1000000` and `... 10000000`. The file
+// is recreated on every run.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QString>
+#include <QTextStream>
+#include <algorithm>
+#include <functional>
+
+#include "db.hpp"
+#include "migration.hpp"
+
+namespace {
+
+QTextStream out(stdout);
+
+bool generate(const qint64 messages, const int users) {
+  auto sdb = QSqlDatabase::database();
+  QSqlQuery query(sdb);
+
+  sdb.transaction();
+  query.prepare("INSERT INTO users (username, password) VALUES (?, ?)");
+  for (int i = 0; i < users; ++i) {
+    query.addBindValue("user" + QString::number(i));
+    query.addBindValue("password");
+    if (!query.exec()) {
+      return false;
+    }
+  }
+
+  query.prepare(
+      "INSERT INTO messages (from_user_id, to_user_id, message) VALUES (?, ?, "
+      "?)");
+  auto* random = QRandomGenerator::global();
+  for (qint64 i = 0; i < messages; ++i) {
+    query.addBindValue(random->bounded(users) + 1);
+    query.addBindValue(random->bounded(users) + 1);
+    query.addBindValue("message number " + QString::number(i) +
+                       ", long enough to look like a real one");
+    if (!query.exec()) {
+      return false;
+    }
+  }
+  return sdb.commit();
+}
+
+// adds a user with history messages spread over up to 100 peers, returns
+// its id
+quint64 generateHistory(const qint64 history, const int users) {
+  auto sdb = QSqlDatabase::database();
+  QSqlQuery query(sdb);
+
+  sdb.transaction();
+  query.prepare("INSERT INTO users (username, password) VALUES (?, ?)");
+  query.addBindValue("heavy");
+  query.addBindValue("password");
+  query.exec();
+  const auto user_id = query.lastInsertId().toULongLong();
+
+  query.prepare(
+      "INSERT INTO messages (from_user_id, to_user_id, message) VALUES (?, ?, "
+      "?)");
+  for (qint64 i = 0; i < history; ++i) {
+    const auto peer_id = i % qMin(users, 100) + 1;
+    query.addBindValue(i % 2 ? user_id : peer_id);
+    query.addBindValue(i % 2 ? peer_id : user_id);
+    query.addBindValue("history message " + QString::number(i));
+    query.exec();
+  }
+  sdb.commit();
+
+  return user_id;
+}
+
+// getAllMsgs as it was before the peer names were resolved per conversation
+qsizetype legacyAllMsgs(const quint64 user_id) {
+  QHash<QString, QList<packet::packet_t::payload_t::target_t::message_t>>
+      all_messages;
+
+  QSqlQuery usernameQuery(QSqlDatabase::database());
+  QSqlQuery query(QSqlDatabase::database());
+  query.prepare(
+      "SELECT from_user_id, to_user_id, message FROM messages WHERE "
+      "from_user_id == ? OR to_user_id == ?");
+  query.addBindValue(user_id);
+  query.addBindValue(user_id);
+  query.exec();
+
+  while (query.next()) {
+    const auto sender_id = query.value(0).toULongLong();
+    const auto rec_id = query.value(1).toULongLong();
+
+    usernameQuery.prepare("SELECT username FROM users WHERE user_id == ?");
+    usernameQuery.addBindValue(sender_id != user_id ? sender_id : rec_id);
+    usernameQuery.exec();
+    usernameQuery.next();
+
+    all_messages[usernameQuery.value(0).toString()].push_back(
+        {sender_id == user_id ? "y" : "t", query.value(2).toString()});
+  }
+
+  return all_messages.size();
+}
+
+// runs op for every sample and prints the latency distribution
+void measure(const QString& name, const int samples,
+             const std::function<void(int)>& op) {
+  QList<qint64> latencies_us;
+  for (int i = 0; i < samples; ++i) {
+    QElapsedTimer timer;
+    timer.start();
+    op(i);
+    latencies_us.push_back(timer.nsecsElapsed() / 1000);
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+
+  qint64 total_us = 0;
+  for (const auto latency_us : latencies_us) {
+    total_us += latency_us;
+  }
+
+  out << qSetFieldWidth(24) << Qt::left << name << Qt::right
+      << qSetFieldWidth(12) << total_us / samples
+      << latencies_us[samples / 2] << latencies_us[samples * 99 / 100]
+      << latencies_us.back() << qSetFieldWidth(0) << Qt::endl;
+}
+
+void run(const QString& schema, const int users, const int samples) {
+  // the same pseudo-random users for both schemas
+  QRandomGenerator random(samples);
+  QList<QPair<int, int>> pairs;
+  for (int i = 0; i < samples; ++i) {
+    pairs.push_back(
+        {random.bounded(users) + 1, random.bounded(users) + 1});
+  }
+
+  measure("getMsgs " + schema, samples, [&](const int i) {
+    db::db.getMsgs(pairs[i].first, pairs[i].second);
+  });
+  db::page_t page;
+  page.limit = 50;
+  measure("visitMsgs page " + schema, samples, [&](const int i) {
+    db::db.visitMsgs(pairs[i].first, pairs[i].second,
+                     [](const QString&, const QString&) {}, page);
+  });
+  measure("getAllMsgs " + schema, samples,
+          [&](const int i) { db::db.getAllMsgs(pairs[i].first); });
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  if (argc < 2) {
+    out << "usage: db_bench <path> [messages] [users] [samples] [history]"
+        << Qt::endl;
+    return EXIT_FAILURE;
+  }
+
+  const QString path = argv[1];
+  const qint64 messages = argc > 2 ? QString(argv[2]).toLongLong() : 1000000;
+  const int users = qMax(argc > 3 ? QString(argv[3]).toInt() : 1000, 1);
+  const int samples = qMax(argc > 4 ? QString(argv[4]).toInt() : 20, 1);
+  const qint64 history = argc > 5 ? QString(argv[5]).toLongLong() : 50000;
+
+  QFile::remove(path);
+  if (!db::db.open(path, 1)) {
+    return EXIT_FAILURE;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  if (!generate(messages, users)) {
+    out << "Can't generate the database" << Qt::endl;
+    return EXIT_FAILURE;
+  }
+  out << messages << " messages between " << users << " users generated in "
+      << timer.elapsed() << " ms" << Qt::endl;
+
+  out << qSetFieldWidth(24) << Qt::left << "query" << Qt::right
+      << qSetFieldWidth(12) << "avg us"
+      << "p50 us"
+      << "p99 us"
+      << "max us" << qSetFieldWidth(0) << Qt::endl;
+
+  run("(v1)", users, samples);
+
+  timer.restart();
+  if (!migration::run(QSqlDatabase::database())) {
+    return EXIT_FAILURE;
+  }
+  out << "migrated to v" << migration::latest() << " in " << timer.elapsed()
+      << " ms" << Qt::endl;
+
+  run("(v" + QString::number(migration::latest()) + ")", users, samples);
+
+  db::db.configureTailCache(50, 64 * 1024 * 1024);
+  run("(tail cache)", users, samples);
+  const auto tail_stats = db::db.tailCacheStats();
+  out << "tail cache hits " << tail_stats.hits << ", misses "
+      << tail_stats.misses << ", ~" << tail_stats.bytes / 1024 << " KiB"
+      << Qt::endl;
+
+  const auto user_id = generateHistory(history, users);
+  out << "login history of " << history << " messages" << Qt::endl;
+  measure("getAllMsgs legacy", qMin(samples, 5),
+          [&](int) { legacyAllMsgs(user_id); });
+  measure("getAllMsgs", qMin(samples, 5),
+          [&](int) { db::db.getAllMsgs(user_id); });
+  measure("visitAllMsgs", qMin(samples, 5), [&](int) {
+    db::db.visitAllMsgs(
+        user_id, [](const QString&, const QString&, const QString&) {});
+  });
+
+  // a reconnect that missed the last 100 messages of the history
+  QSqlQuery max_id(QSqlDatabase::database());
+  max_id.exec("SELECT MAX(message_id) FROM messages");
+  max_id.next();
+  const auto since = max_id.value(0).toULongLong() - qMin<qint64>(history, 100);
+  measure("visitAllMsgs since", qMin(samples, 5), [&](int) {
+    db::db.visitAllMsgs(
+        user_id, [](const QString&, const QString&, const QString&) {},
+        since);
+  });
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,552 @@
+// Puts a running server under load from simulated chat users: opens one
+// connection per user, registers and logs every user in, then sends a
+// weighted mix of SENDMSG, GETMSGS and GETALLMSGS at a fixed total rate.
+// Requests are sent on schedule whether or not the earlier ones have been
+// answered (open loop), so a slow server shows up in the latencies instead
+// of lowering the load. Reports throughput and p50/p99/p999 latency per
+// command, e.g.
+// `./loadgen --users 2000 --rate 5000 --duration 30 --mix 70,25,5`.
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QRandomGenerator>
+#include <QString>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+
+#include "frame.hpp"
+#include "packet.hpp"
+
+namespace {
+
+using command_t = packet::packet_t::header_t::command_t;
+
+QTextStream out(stdout);
+
+struct options_t {
+  QString host = "127.0.0.1";
+  quint16 port = 1234;
+  int users = 100;
+  double rate = 1000;  // requests per second, over every connection
+  int duration = 10;   // seconds of load, login excluded
+  int drain = 5;       // seconds to wait for late answers
+  // weights of SENDMSG, GETMSGS and GETALLMSGS
+  int sendmsg_weight = 70;
+  int getmsgs_weight = 25;
+  int getallmsgs_weight = 5;
+  int page = 50;  // GETMSGS limit
+  QString prefix = "loadgen";
+};
+
+// the three commands under load, in report order
+constexpr command_t load_commands[] = {command_t::SENDMSG, command_t::GETMSGS,
+                                       command_t::GETALLMSGS};
+constexpr int load_command_count = std::size(load_commands);
+
+const char* commandName(const int index) {
+  static constexpr const char* names[] = {"sendmsg", "getmsgs", "getallmsgs"};
+  return names[index];
+}
+
+struct command_stats_t {
+  quint64 sent = 0;
+  quint64 ok = 0;
+  quint64 failed = 0;
+  QList<qint64> latencies_us;  // of every answer, failures included
+};
+
+QByteArray request(const command_t command, const QString& request_id,
+                   const QJsonObject& payload) {
+  QJsonObject request{
+      {packet::request_json_tags::header,
+       QJsonObject{{packet::request_json_tags::header_command,
+                    packet::packet_t::header_t::commandToQString(command)},
+                   {packet::request_json_tags::header_request_id,
+                    request_id}}}};
+  if (!payload.isEmpty()) {
+    request.insert(packet::request_json_tags::payload, payload);
+  }
+  return frame::encode(QJsonDocument(request).toJson(QJsonDocument::Compact));
+}
+
+// one simulated user on its own connection
+class Client : public QObject {
+ public:
+  // called for every answer matched with its request
+  using answer_t = std::function<void(int command, bool ok, qint64 us)>;
+
+  Client(const options_t& options, const QString& username,
+         const QElapsedTimer& clock, answer_t on_answer,
+         QObject* parent = nullptr)
+      : QObject(parent),
+        options_(options),
+        username_(username),
+        clock_(clock),
+        on_answer_(std::move(on_answer)) {
+    connect(&socket_, &QTcpSocket::connected, this, [this]() {
+      send_(command_t::REGISTER, -1, authData_(true), {});
+    });
+    connect(&socket_, &QTcpSocket::readyRead, this, [this]() { read_(); });
+    connect(&socket_, &QTcpSocket::errorOccurred, this, [this]() {
+      if (!failed_) {
+        failed_ = true;
+        out << "connection of " << username_
+            << " failed: " << socket_.errorString() << "\n";
+        out.flush();
+      }
+    });
+  }
+
+  void start() { socket_.connectToHost(options_.host, options_.port); }
+
+  bool ready() const { return !session_id_.isEmpty(); }
+  bool failed() const { return failed_; }
+  qsizetype outstanding() const { return pending_.size(); }
+  const QString& username() const { return username_; }
+
+  // command is an index into load_commands, peer the user it's about
+  void load(const int command, const QString& peer) {
+    QJsonObject target;
+    switch (load_commands[command]) {
+      case command_t::SENDMSG:
+        target.insert(packet::request_json_tags::payload_target_username,
+                      peer);
+        target.insert(packet::request_json_tags::payload_target_message,
+                      "message " + QString::number(++sent_messages_) +
+                          " from " + username_);
+        break;
+      case command_t::GETMSGS:
+        target.insert(packet::request_json_tags::payload_target_username,
+                      peer);
+        target.insert(packet::request_json_tags::payload_target_limit,
+                      QString::number(options_.page));
+        break;
+      default:
+        // a delta sync from the previous answer on
+        if (since_ != 0) {
+          target.insert(packet::request_json_tags::payload_target_since,
+                        QString::number(since_));
+        }
+        break;
+    }
+    send_(load_commands[command], command, authData_(false), target);
+  }
+
+ private:
+  struct pending_t {
+    command_t command{};
+    int load_command = -1;  // -1 for the login sequence
+    qint64 sent_ns = 0;
+  };
+
+  const options_t& options_;
+  QString username_;
+  const QElapsedTimer& clock_;
+  answer_t on_answer_;
+
+  QTcpSocket socket_;
+  frame::Decoder decoder_;
+  QHash<QString, pending_t> pending_;  // <request id, request>
+  quint64 next_request_id_ = 0;
+  quint64 sent_messages_ = 0;
+  quint64 since_ = 0;
+  QString session_id_;
+  bool failed_ = false;
+
+  QJsonObject authData_(const bool with_password) const {
+    QJsonObject auth_data{
+        {packet::request_json_tags::payload_auth_data_username, username_}};
+    if (with_password) {
+      auth_data.insert(packet::request_json_tags::payload_auth_data_password,
+                       "loadgen password");
+    } else {
+      auth_data.insert(packet::request_json_tags::payload_auth_data_session_id,
+                       session_id_);
+    }
+    return auth_data;
+  }
+
+  void send_(const command_t command, const int load_command,
+             const QJsonObject& auth_data, const QJsonObject& target) {
+    const auto request_id = QString::number(++next_request_id_);
+    QJsonObject payload{{packet::request_json_tags::payload_auth_data,
+                         auth_data}};
+    if (!target.isEmpty()) {
+      payload.insert(packet::request_json_tags::payload_target, target);
+    }
+
+    pending_.insert(request_id, {command, load_command, clock_.nsecsElapsed()});
+    socket_.write(request(command, request_id, payload));
+  }
+
+  void read_() {
+    if (decoder_.readFrom(&socket_) < 0) {
+      return;
+    }
+
+    forever {
+      const auto frame_monad = decoder_.next();
+      if (frame_monad.error) {
+        break;
+      }
+      process_(QJsonDocument::fromJson(frame_monad.data).object());
+    }
+  }
+
+  void process_(const QJsonObject& response) {
+    const auto header =
+        response[packet::response_json_tags::header].toObject();
+    const auto request_id =
+        header[packet::response_json_tags::header_request_id].toString();
+    const auto target = response[packet::response_json_tags::payload]
+                            .toObject()[packet::response_json_tags::
+                                            payload_target]
+                            .toObject();
+
+    // pushed messages answer nothing
+    const auto it = pending_.find(request_id);
+    if (request_id.isEmpty() || it == pending_.end()) {
+      return;
+    }
+    const auto sent = *it;
+    pending_.erase(it);
+
+    const auto ok =
+        header[packet::response_json_tags::header_status].toString() ==
+        packet::packet_t::header_t::statusToQString(
+            packet::packet_t::header_t::status_t::OK);
+
+    switch (sent.command) {
+      case command_t::REGISTER:
+        // the user may be left from an earlier run, logging in tells
+        send_(command_t::LOGIN, -1, authData_(true), {});
+        return;
+      case command_t::LOGIN:
+        if (ok) {
+          session_id_ =
+              response[packet::response_json_tags::payload]
+                  .toObject()[packet::response_json_tags::payload_auth_data]
+                  .toObject()[packet::response_json_tags::
+                                  payload_auth_data_session_id]
+                  .toString();
+        } else if (!failed_) {
+          failed_ = true;
+          out << "login of " << username_ << " failed\n";
+          out.flush();
+        }
+        return;
+      case command_t::GETALLMSGS: {
+        const auto last =
+            target[packet::response_json_tags::payload_target_last]
+                .toString()
+                .toULongLong();
+        since_ = qMax(since_, last);
+        break;
+      }
+      default:
+        break;
+    }
+
+    if (sent.load_command >= 0) {
+      on_answer_(sent.load_command, ok,
+                 (clock_.nsecsElapsed() - sent.sent_ns) / 1000);
+    }
+  }
+};
+
+class LoadGenerator : public QObject {
+ public:
+  explicit LoadGenerator(const options_t& options, QObject* parent = nullptr)
+      : QObject(parent), options_(options) {
+    clock_.start();
+    for (int i = 0; i < options_.users; ++i) {
+      clients_.push_back(new Client(
+          options_, options_.prefix + "_" + QString::number(i), clock_,
+          [this](const int command, const bool ok, const qint64 us) {
+            record_(command, ok, us);
+          },
+          this));
+    }
+
+    connect(&timer_, &QTimer::timeout, this, [this]() { tick_(); });
+  }
+
+  void start() {
+    out << "connecting " << options_.users << " users to " << options_.host
+        << ":" << options_.port << "\n";
+    out.flush();
+    for (auto client : clients_) {
+      client->start();
+    }
+    login_started_ns_ = clock_.nsecsElapsed();
+    phase_ = phase_t::LOGIN;
+    timer_.start(1);
+  }
+
+ private:
+  enum class phase_t { LOGIN, LOAD, DRAIN };
+
+  const options_t& options_;
+  QElapsedTimer clock_;
+  QTimer timer_;  // ticks every millisecond
+  QList<Client*> clients_;
+  QList<Client*> ready_;
+  phase_t phase_ = phase_t::LOGIN;
+
+  qint64 login_started_ns_ = 0;
+  qint64 load_started_ns_ = 0;
+  qint64 drain_started_ns_ = 0;
+  qint64 last_progress_ns_ = 0;
+  quint64 scheduled_ = 0;  // requests sent since the load started
+
+  command_stats_t stats_[load_command_count];
+
+  static constexpr qint64 login_timeout_ns = 30'000'000'000;
+
+  void record_(const int command, const bool ok, const qint64 us) {
+    auto& stats = stats_[command];
+    (ok ? stats.ok : stats.failed) += 1;
+    stats.latencies_us.push_back(us);
+  }
+
+  void tick_() {
+    const auto now_ns = clock_.nsecsElapsed();
+    switch (phase_) {
+      case phase_t::LOGIN:
+        login_(now_ns);
+        break;
+      case phase_t::LOAD:
+        load_(now_ns);
+        break;
+      case phase_t::DRAIN:
+        drain_(now_ns);
+        break;
+    }
+  }
+
+  // waits for every user to be logged in (or to have failed), then starts
+  // the load with the ones that made it
+  void login_(const qint64 now_ns) {
+    const auto settled =
+        std::count_if(clients_.begin(), clients_.end(), [](const auto client) {
+          return client->ready() || client->failed();
+        });
+    if (settled < clients_.size() &&
+        now_ns - login_started_ns_ < login_timeout_ns) {
+      return;
+    }
+
+    for (auto client : clients_) {
+      if (client->ready()) {
+        ready_.push_back(client);
+      }
+    }
+    out << ready_.size() << " of " << clients_.size() << " users logged in in "
+        << (now_ns - login_started_ns_) / 1'000'000 << " ms\n";
+    out.flush();
+    if (ready_.size() < 2) {
+      out << "at least two users are needed\n";
+      QCoreApplication::exit(EXIT_FAILURE);
+      return;
+    }
+
+    phase_ = phase_t::LOAD;
+    load_started_ns_ = now_ns;
+    last_progress_ns_ = now_ns;
+  }
+
+  // sends what's due by now at the target rate, so a late tick catches up
+  void load_(const qint64 now_ns) {
+    const auto elapsed_ns = now_ns - load_started_ns_;
+    const auto duration_ns = options_.duration * 1'000'000'000LL;
+    const auto due = static_cast<quint64>(
+        options_.rate * qMin(elapsed_ns, duration_ns) / 1e9);
+
+    auto* random = QRandomGenerator::global();
+    const auto total_weight = options_.sendmsg_weight +
+                              options_.getmsgs_weight +
+                              options_.getallmsgs_weight;
+    for (; scheduled_ < due; ++scheduled_) {
+      const auto pick = static_cast<int>(random->bounded(total_weight));
+      const auto command = pick < options_.sendmsg_weight ? 0
+                           : pick < options_.sendmsg_weight +
+                                        options_.getmsgs_weight
+                               ? 1
+                               : 2;
+
+      const auto sender = random->bounded(ready_.size());
+      auto peer = random->bounded(ready_.size() - 1);
+      if (peer >= sender) {
+        ++peer;
+      }
+
+      ready_[sender]->load(command, ready_[peer]->username());
+      stats_[command].sent += 1;
+    }
+
+    if (now_ns - last_progress_ns_ >= 1'000'000'000) {
+      last_progress_ns_ = now_ns;
+      quint64 answered = 0;
+      for (const auto& stats : stats_) {
+        answered += stats.ok + stats.failed;
+      }
+      out << elapsed_ns / 1'000'000'000 << " s: sent " << scheduled_
+          << ", answered " << answered << "\n";
+      out.flush();
+    }
+
+    if (elapsed_ns >= duration_ns) {
+      phase_ = phase_t::DRAIN;
+      drain_started_ns_ = now_ns;
+    }
+  }
+
+  // waits for the answers still in flight, then reports
+  void drain_(const qint64 now_ns) {
+    qsizetype outstanding = 0;
+    for (const auto client : std::as_const(ready_)) {
+      outstanding += client->outstanding();
+    }
+    if (outstanding > 0 &&
+        now_ns - drain_started_ns_ < options_.drain * 1'000'000'000LL) {
+      return;
+    }
+
+    timer_.stop();
+    report_(outstanding);
+    QCoreApplication::exit(EXIT_SUCCESS);
+  }
+
+  static qint64 percentile_(const QList<qint64>& sorted, const double p) {
+    if (sorted.isEmpty()) {
+      return 0;
+    }
+    const auto rank =
+        static_cast<qsizetype>(p * static_cast<double>(sorted.size()));
+    return sorted[qMin(rank, sorted.size() - 1)];
+  }
+
+  void report_(const qsizetype unanswered) {
+    const auto seconds = static_cast<double>(options_.duration);
+
+    out << "\n"
+        << qSetFieldWidth(12) << Qt::left << "command" << Qt::right
+        << qSetFieldWidth(10) << "sent"
+        << "ok"
+        << "failed"
+        << "req/s"
+        << "p50 us"
+        << "p99 us"
+        << "p999 us"
+        << "max us" << qSetFieldWidth(0) << "\n";
+    for (int i = 0; i < load_command_count; ++i) {
+      auto& stats = stats_[i];
+      std::sort(stats.latencies_us.begin(), stats.latencies_us.end());
+      out << qSetFieldWidth(12) << Qt::left << commandName(i) << Qt::right
+          << qSetFieldWidth(10) << stats.sent << stats.ok << stats.failed
+          << QString::number((stats.ok + stats.failed) / seconds, 'f', 0)
+          << percentile_(stats.latencies_us, 0.5)
+          << percentile_(stats.latencies_us, 0.99)
+          << percentile_(stats.latencies_us, 0.999)
+          << (stats.latencies_us.isEmpty() ? 0 : stats.latencies_us.back())
+          << qSetFieldWidth(0) << "\n";
+    }
+    out << "unanswered " << unanswered << "\n";
+    out.flush();
+  }
+};
+
+options_t parse(const QCoreApplication& app) {
+  options_t options;
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Load generator for yachat_server");
+  parser.addHelpOption();
+
+  const QCommandLineOption hostOption("host", "Server address.", "host",
+                                      options.host);
+  const QCommandLineOption portOption({"p", "port"}, "Server port.", "port",
+                                      QString::number(options.port));
+  const QCommandLineOption usersOption(
+      {"u", "users"}, "Simulated users, one connection each.", "count",
+      QString::number(options.users));
+  const QCommandLineOption rateOption(
+      {"r", "rate"}, "Requests per second over every connection.", "rate",
+      QString::number(options.rate));
+  const QCommandLineOption durationOption(
+      {"d", "duration"}, "Seconds of load once every user is logged in.",
+      "seconds", QString::number(options.duration));
+  const QCommandLineOption drainOption(
+      "drain", "Seconds to wait for the answers still in flight.", "seconds",
+      QString::number(options.drain));
+  const QCommandLineOption mixOption(
+      "mix", "Weights of SENDMSG, GETMSGS and GETALLMSGS.", "s,g,a",
+      QString("%1,%2,%3")
+          .arg(options.sendmsg_weight)
+          .arg(options.getmsgs_weight)
+          .arg(options.getallmsgs_weight));
+  const QCommandLineOption pageOption(
+      "page", "Messages asked for by a GETMSGS.", "count",
+      QString::number(options.page));
+  const QCommandLineOption prefixOption(
+      "prefix", "Usernames are <prefix>_<n>, registered if needed.", "prefix",
+      options.prefix);
+
+  parser.addOption(hostOption);
+  parser.addOption(portOption);
+  parser.addOption(usersOption);
+  parser.addOption(rateOption);
+  parser.addOption(durationOption);
+  parser.addOption(drainOption);
+  parser.addOption(mixOption);
+  parser.addOption(pageOption);
+  parser.addOption(prefixOption);
+  parser.process(app);
+
+  options.host = parser.value(hostOption);
+  options.port = parser.value(portOption).toUShort();
+  options.users = qMax(parser.value(usersOption).toInt(), 2);
+  options.rate = qMax(parser.value(rateOption).toDouble(), 1.0);
+  options.duration = qMax(parser.value(durationOption).toInt(), 1);
+  options.drain = qMax(parser.value(drainOption).toInt(), 0);
+  options.page = qMax(parser.value(pageOption).toInt(), 1);
+  options.prefix = parser.value(prefixOption);
+
+  const auto weights = parser.value(mixOption).split(',');
+  if (weights.size() == 3) {
+    options.sendmsg_weight = qMax(weights[0].toInt(), 0);
+    options.getmsgs_weight = qMax(weights[1].toInt(), 0);
+    options.getallmsgs_weight = qMax(weights[2].toInt(), 0);
+  }
+  if (options.sendmsg_weight + options.getmsgs_weight +
+          options.getallmsgs_weight ==
+      0) {
+    options.sendmsg_weight = 1;
+  }
+
+  return options;
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  const auto options = parse(a);
+
+  LoadGenerator generator(options);
+  generator.start();
+
+  return a.exec();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// Shared by the microbenchmarks: times an operation and counts the heap
+// allocations it makes. Every benchmark is a single translation unit and
+// single threaded, so the global operator new below is its own and the
+// allocations between two reads belong to the measured code.
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QTextStream>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+static std::atomic<quint64> allocations{0};
+static std::atomic<quint64> allocated_bytes{0};
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace bench {
+
+QTextStream out(stdout);
+
+// the results are accumulated so the compiler can't drop the measured work
+qsizetype sink = 0;
+
+struct measurement_t {
+  double ns_per_op = 0;
+  double bytes_per_op = 0;   // heap bytes allocated, not freed ones
+  double allocs_per_op = 0;  // heap allocations
+};
+
+// runs op a tenth of the iterations to warm up, then measures it
+measurement_t measure(const int iterations,
+                      const std::function<qsizetype()>& op) {
+  for (int i = 0; i < iterations / 10 + 1; ++i) {
+    sink += op();
+  }
+
+  measurement_t measurement;
+  const auto allocations_before = allocations.load();
+  const auto bytes_before = allocated_bytes.load();
+  QElapsedTimer timer;
+  timer.start();
+  for (int i = 0; i < iterations; ++i) {
+    sink += op();
+  }
+  measurement.ns_per_op =
+      static_cast<double>(timer.nsecsElapsed()) / iterations;
+  measurement.bytes_per_op =
+      static_cast<double>(allocated_bytes.load() - bytes_before) / iterations;
+  measurement.allocs_per_op =
+      static_cast<double>(allocations.load() - allocations_before) /
+      iterations;
+  return measurement;
+}
+
+// big payloads get fewer iterations to keep the run time sane
+int scaled(const int iterations, const int items) {
+  return qMax(iterations / qMax(items, 1), 10);
+}
+
+void header(const QString& first, const QString& second,
+            const QString& third = "bytes") {
+  out << qSetFieldWidth(20) << Qt::left << first << qSetFieldWidth(14)
+      << second << Qt::right << qSetFieldWidth(10) << third
+      << qSetFieldWidth(14) << "ns/op"
+      << "B/op"
+      << "allocs/op" << qSetFieldWidth(0) << "\n";
+}
+
+// wire_bytes is the size of the packet, 0 where it doesn't apply
+void report(const QString& first, const QString& second,
+            const qsizetype wire_bytes, const measurement_t& measurement) {
+  out << qSetFieldWidth(20) << Qt::left << first << qSetFieldWidth(14)
+      << second << Qt::right << qSetFieldWidth(10) << wire_bytes
+      << qSetFieldWidth(14) << QString::number(measurement.ns_per_op, 'f', 1)
+      << QString::number(measurement.bytes_per_op, 'f', 1)
+      << QString::number(measurement.allocs_per_op, 'f', 1)
+      << qSetFieldWidth(0) << "\n";
+}
+
+};  // namespace bench
@@ -0,0 +1,321 @@
+// Measures every packet the server decodes and encodes, in both wire
+// formats:
+//   requests  - JSON decode (single pass), binary encode and decode, one
+//               per command
+//   responses - JSON and binary encode and decode, one per response type;
+//               MSGS and ALLMSGS also through the streaming HistoryWriter,
+//               with histories from empty to 10k messages
+// Reports the packet size, ns/op, heap bytes/op and allocations/op. Run on a
+// release build, e.g. `./packet_bench 200000`.
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <cstdlib>
+
+#include "measure.hpp"
+#include "packet.hpp"
+
+namespace {
+
+using bench::measure;
+using bench::report;
+using bench::scaled;
+using command_t = packet::packet_t::header_t::command_t;
+using status_t = packet::packet_t::header_t::status_t;
+using message_t = packet::packet_t::payload_t::target_t::message_t;
+using conversation_t = packet::packet_t::payload_t::target_t::conversation_t;
+
+QList<message_t> history(const int size) {
+  QList<message_t> messages;
+  for (int i = 0; i < size; ++i) {
+    messages.push_back({i % 2 ? "y" : "t",
+                        "message number " + QString::number(i) +
+                            ", long enough to look like a real one"});
+  }
+  return messages;
+}
+
+QHash<QString, QList<message_t>> allHistory(const int conversations,
+                                            const int size) {
+  QHash<QString, QList<message_t>> all_messages;
+  for (int i = 0; i < conversations; ++i) {
+    all_messages.insert("user" + QString::number(i), history(size));
+  }
+  return all_messages;
+}
+
+QList<conversation_t> inbox(const int size) {
+  QList<conversation_t> conversations;
+  for (int i = 0; i < size; ++i) {
+    conversations.push_back({"user" + QString::number(i),
+                             static_cast<quint64>(1000 + i),
+                             "the beginning of the last message",
+                             static_cast<quint64>(i % 5)});
+  }
+  return conversations;
+}
+
+// the JSON a client sends for the request, built the way the client does
+QByteArray requestJson(const packet::wire_packet_t& request) {
+  QJsonObject header{{packet::request_json_tags::header_command,
+                      packet::packet_t::header_t::commandToQString(
+                          request.header.command)},
+                     {packet::request_json_tags::header_request_id,
+                      request.header.request_id}};
+  if (request.header.codec != packet::packet_t::header_t::codec_t::JSON) {
+    header.insert(packet::request_json_tags::header_codec,
+                  QString::number(static_cast<quint16>(request.header.codec)));
+  }
+
+  QJsonObject payload;
+  if (!request.auth_data.error) {
+    const auto& auth_data = request.auth_data.data;
+    QJsonObject auth_data_json{
+        {packet::request_json_tags::payload_auth_data_username,
+         auth_data.username}};
+    if (!auth_data.password.isEmpty()) {
+      auth_data_json.insert(
+          packet::request_json_tags::payload_auth_data_password,
+          auth_data.password);
+    }
+    if (!auth_data.session_id.isEmpty()) {
+      auth_data_json.insert(
+          packet::request_json_tags::payload_auth_data_session_id,
+          auth_data.session_id);
+    }
+    payload.insert(packet::request_json_tags::payload_auth_data,
+                   auth_data_json);
+  }
+  if (!request.target.error) {
+    const auto& target = request.target.data;
+    QJsonObject target_json;
+    if (!target.username.isEmpty()) {
+      target_json.insert(packet::request_json_tags::payload_target_username,
+                         target.username);
+    }
+    if (!target.message.isEmpty()) {
+      target_json.insert(packet::request_json_tags::payload_target_message,
+                         target.message);
+    }
+    if (target.limit != 0) {
+      target_json.insert(packet::request_json_tags::payload_target_limit,
+                         QString::number(target.limit));
+    }
+    if (target.since != 0) {
+      target_json.insert(packet::request_json_tags::payload_target_since,
+                         QString::number(target.since));
+    }
+    payload.insert(packet::request_json_tags::payload_target, target_json);
+  }
+
+  QJsonObject json{{packet::request_json_tags::header, header}};
+  if (!payload.isEmpty()) {
+    json.insert(packet::request_json_tags::payload, payload);
+  }
+  return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+packet::wire_packet_t request(const command_t command,
+                              const bool with_password = false) {
+  packet::wire_packet_t request;
+  request.header.command = command;
+  request.header.request_id = "42";
+  request.auth_data.error = false;
+  request.auth_data.data.username = "alice";
+  if (with_password) {
+    request.auth_data.data.password = "correct horse battery staple";
+  } else {
+    request.auth_data.data.session_id = "1804289383";
+  }
+  return request;
+}
+
+packet::wire_packet_t request(const command_t command,
+                              const packet::packet_t::payload_t::target_t&
+                                  target) {
+  auto wire = request(command);
+  wire.target.error = false;
+  wire.target.data = target;
+  return wire;
+}
+
+// JSON requests are built by the client, only their decoding is measured
+void compareRequest(const QString& name,
+                    const packet::wire_packet_t& request,
+                    const int iterations) {
+  const auto json = requestJson(request);
+  const auto binary = packet::binaryEncodePacket(request);
+
+  report(name, "json decode", json.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::jsonDecodePacket(json).error);
+         }));
+  report(name, "binary encode", binary.size(), measure(iterations, [&]() {
+           return packet::binaryEncodePacket(request).size();
+         }));
+  report(name, "binary decode", binary.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::binaryDecodePacket(binary).error);
+         }));
+}
+
+// the decode rows stand for the client side, which parses what the server
+// encodes
+void compare(const QString& name, packet::Response& response,
+             const int iterations) {
+  const auto json = response.to_json().toJson(QJsonDocument::Compact);
+  const auto binary = response.to_binary();
+
+  report(name, "json encode", json.size(), measure(iterations, [&]() {
+           return response.to_json().toJson(QJsonDocument::Compact).size();
+         }));
+  report(name, "json decode", json.size(), measure(iterations, [&]() {
+           return QJsonDocument::fromJson(json).object().size();
+         }));
+  report(name, "binary encode", binary.size(), measure(iterations, [&]() {
+           return response.to_binary().size();
+         }));
+  report(name, "binary decode", binary.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::binaryDecodePacket(binary).error);
+         }));
+}
+
+packet::packet_t::header_t historyHeader(const command_t command) {
+  packet::packet_t::header_t header;
+  header.command = command;
+  header.status = status_t::OK;
+  header.msg = "Command completed";
+  header.request_id = "42";
+  return header;
+}
+
+// what the server writes for GETMSGS and GETALLMSGS: the rows go straight
+// into the frame as they are read
+void compareStream(const QString& name,
+                   const QHash<QString, QList<message_t>>& all_messages,
+                   const bool all, const int iterations) {
+  const auto header =
+      historyHeader(all ? command_t::ALLMSGS : command_t::MSGS);
+  for (const auto codec : {packet::packet_t::header_t::codec_t::JSON,
+                           packet::packet_t::header_t::codec_t::BINARY}) {
+    const auto write = [&]() {
+      QByteArray out;
+      packet::HistoryWriter writer(out, codec, header, "bob");
+      for (auto it = all_messages.cbegin(); it != all_messages.cend(); ++it) {
+        if (all) {
+          writer.conversation(it.key());
+        }
+        for (const auto& message : it.value()) {
+          writer.message(message.side, message.message);
+        }
+      }
+      writer.finish(1205);
+      return out;
+    };
+
+    const auto size = write().size();
+    report(name,
+           codec == packet::packet_t::header_t::codec_t::JSON
+               ? "json stream"
+               : "binary stream",
+           size, measure(iterations, [&]() { return write().size(); }));
+  }
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  const auto iterations =
+      qMax(argc > 1 ? QString(argv[1]).toInt() : 100000, 1);
+
+  bench::header("packet", "path");
+
+  packet::packet_t::payload_t::target_t target;
+  target.username = "bob";
+
+  auto message_target = target;
+  message_target.message = "hello there, \"bob\"\nhow are you doing?";
+
+  auto page_target = target;
+  page_target.limit = 50;
+
+  packet::packet_t::payload_t::target_t since_target;
+  since_target.since = 1187;
+
+  auto setcodec = request(command_t::SETCODEC);
+  setcodec.auth_data.error = true;
+  setcodec.header.codec = packet::packet_t::header_t::codec_t::BINARY;
+
+  compareRequest("register", request(command_t::REGISTER, true), iterations);
+  compareRequest("login", request(command_t::LOGIN, true), iterations);
+  compareRequest("logout", request(command_t::LOGOUT), iterations);
+  compareRequest("sendmsg", request(command_t::SENDMSG, message_target),
+                 iterations);
+  compareRequest("getmsgs", request(command_t::GETMSGS, page_target),
+                 iterations);
+  compareRequest("getallmsgs", request(command_t::GETALLMSGS), iterations);
+  compareRequest("getallmsgs-since",
+                 request(command_t::GETALLMSGS, since_target), iterations);
+  compareRequest("getinbox", request(command_t::GETINBOX), iterations);
+  compareRequest("read", request(command_t::READ, target), iterations);
+  compareRequest("setcodec", setcodec, iterations);
+
+  packet::StatusResponse status(command_t::STATUS, status_t::OK,
+                                "Command 'sendmsg' completed");
+  status.header_request_id = "42";
+  compare("status", status, iterations);
+
+  packet::AuthResponse auth(command_t::AUTH, status_t::OK,
+                            "Command 'login' completed", "1804289383");
+  compare("auth", auth, iterations);
+
+  packet::NotifyResponse notify(command_t::NOTIFY, status_t::OK, "Notify",
+                                "alice");
+  compare("notify", notify, iterations);
+  notify.payload_target_message_id = 1205;
+  notify.payload_target_message = {"t", "see you at noon then"};
+  compare("notify-message", notify, iterations);
+
+  for (const auto size : {0, 1, 100, 1000, 10000}) {
+    const auto messages = history(size);
+    packet::MsgsResponse msgs(command_t::MSGS, status_t::OK,
+                              "Command 'getmsgs' completed", "bob", messages);
+    const auto name = "msgs-" + QString::number(size);
+    compare(name, msgs, scaled(iterations, size));
+    compareStream(name, {{"bob", messages}}, false, scaled(iterations, size));
+  }
+
+  // conversations x messages each
+  for (const auto& shape : QList<QPair<int, int>>{
+           {0, 0}, {1, 10}, {20, 50}, {100, 100}}) {
+    const auto all_messages = allHistory(shape.first, shape.second);
+    packet::AllMsgsResponse allmsgs(command_t::ALLMSGS, status_t::OK,
+                                    "Command 'getallmsgs' completed",
+                                    all_messages);
+    const auto name = "allmsgs-" + QString::number(shape.first) + "x" +
+                      QString::number(shape.second);
+    const auto size = shape.first * shape.second;
+    compare(name, allmsgs, scaled(iterations, size));
+    compareStream(name, all_messages, true, scaled(iterations, size));
+  }
+
+  for (const auto size : {0, 10, 1000}) {
+    packet::InboxResponse inbox_response(command_t::INBOX, status_t::OK,
+                                         "Command 'getinbox' completed",
+                                         inbox(size));
+    compare("inbox-" + QString::number(size), inbox_response,
+            scaled(iterations, size));
+  }
+
+  bench::out << "checksum " << bench::sink << "\n";
+
+  return EXIT_SUCCESS;
+}
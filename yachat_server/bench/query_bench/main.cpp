@@ -0,0 +1,269 @@
+// Times DB's queries on a database made by dataset_gen: getUserExists,
+// getMsgs, a 50 message visitMsgs page, getAllMsgs and createMessage. The
+// reads run twice, once for users and conversations drawn the way the
+// dataset was generated (zipf, mostly the hot ones) and once drawn uniformly
+// (mostly cold ones). createMessage runs the way the writer does, in
+// transactions of --batch messages, and its messages stay in the database.
+// Reports the rows returned and the latency distribution in microseconds,
+// e.g. `./query_bench /tmp/10m.sqlite --samples 2000`. The shape options
+// must be the ones the database was generated with.
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QRandomGenerator>
+#include <QString>
+#include <QTextStream>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+
+#include "dataset.hpp"
+#include "db.hpp"
+
+namespace {
+
+QTextStream out(stdout);
+
+struct options_t {
+  QString path;
+  bench::shape_t shape;
+  quint32 seed = 1;
+  int samples = 1000;
+  int batch = 128;  // the writer's default batch size
+  int tail_length = 50;
+  qint64 tail_cache = 0;
+};
+
+qint64 percentile(const QList<qint64>& sorted, const double share) {
+  return sorted[qMin<qsizetype>(sorted.size() * share, sorted.size() - 1)];
+}
+
+// runs op for every sample and prints the rows it returned on average and
+// the latency distribution
+void measure(const QString& name, const int samples,
+             const std::function<qsizetype(int)>& op) {
+  QList<qint64> latencies_us;
+  qint64 rows = 0;
+  for (int i = 0; i < samples; ++i) {
+    QElapsedTimer timer;
+    timer.start();
+    rows += op(i);
+    latencies_us.push_back(timer.nsecsElapsed() / 1000);
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+
+  qint64 total_us = 0;
+  for (const auto latency_us : latencies_us) {
+    total_us += latency_us;
+  }
+
+  out << qSetFieldWidth(28) << Qt::left << name << Qt::right
+      << qSetFieldWidth(10) << rows / samples << total_us / samples
+      << percentile(latencies_us, 0.5) << percentile(latencies_us, 0.99)
+      << percentile(latencies_us, 0.999) << latencies_us.back()
+      << qSetFieldWidth(0) << Qt::endl;
+}
+
+// the same pairs on every run with the same seed
+QList<QPair<qint64, qint64>> pairs(const bench::Conversations& conversations,
+                                   const qint64 users, const bool zipf,
+                                   const options_t& options) {
+  QRandomGenerator random(options.seed);
+  QList<QPair<qint64, qint64>> pairs;
+  for (int i = 0; i < options.samples; ++i) {
+    if (zipf) {
+      const auto user = conversations.user(random);
+      pairs.push_back({user, conversations.peer(user, random)});
+    } else {
+      const auto user = random.bounded(users);
+      const auto rank =
+          random.bounded(qMin(options.shape.contacts, users - 1));
+      pairs.push_back({user, bench::contact(user, rank, users)});
+    }
+  }
+  return pairs;
+}
+
+void runReads(const QString& draw, const QList<QPair<qint64, qint64>>& pairs,
+              const int samples) {
+  measure("getUserExists " + draw, samples, [&](const int i) {
+    return db::db.getUserExists(bench::username(pairs[i].first));
+  });
+  measure("getMsgs " + draw, samples, [&](const int i) {
+    return db::db
+        .getMsgs(bench::userId(pairs[i].first),
+                 bench::userId(pairs[i].second))
+        .data.size();
+  });
+  db::page_t page;
+  page.limit = 50;
+  measure("visitMsgs page " + draw, samples, [&](const int i) {
+    qsizetype rows = 0;
+    db::db.visitMsgs(
+        bench::userId(pairs[i].first), bench::userId(pairs[i].second),
+        [&](const QString&, const QString&) { ++rows; }, page);
+    return rows;
+  });
+  // a hot user's whole history is a sizeable share of the table
+  measure("getAllMsgs " + draw, qMax(samples / 10, 1), [&](const int i) {
+    qsizetype rows = 0;
+    for (const auto& messages :
+         db::db.getAllMsgs(bench::userId(pairs[i].first)).data) {
+      rows += messages.size();
+    }
+    return rows;
+  });
+}
+
+options_t parse(const QCoreApplication& app) {
+  options_t options;
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Times yachat_server's queries on a generated database");
+  parser.addHelpOption();
+  parser.addPositionalArgument("path", "Database made by dataset_gen.");
+
+  const QCommandLineOption skewOption(
+      "skew", "Zipf exponent of how much each user writes.", "exponent",
+      QString::number(options.shape.skew));
+  const QCommandLineOption contactsOption(
+      "contacts", "Peers each user writes to.", "count",
+      QString::number(options.shape.contacts));
+  const QCommandLineOption contactSkewOption(
+      "contact-skew",
+      "Zipf exponent of whom among its contacts a user writes to.",
+      "exponent", QString::number(options.shape.contact_skew));
+  const QCommandLineOption seedOption("seed", "Random seed.", "seed",
+                                      QString::number(options.seed));
+  const QCommandLineOption samplesOption(
+      {"s", "samples"}, "Queries timed per row, a tenth for getAllMsgs.",
+      "count", QString::number(options.samples));
+  const QCommandLineOption batchOption(
+      "batch", "Messages created per transaction.", "count",
+      QString::number(options.batch));
+  const QCommandLineOption tailLengthOption(
+      "tail-length", "Most recent messages cached per conversation.", "count",
+      QString::number(options.tail_length));
+  const QCommandLineOption tailCacheOption(
+      "tail-cache",
+      "Bytes of conversation tails kept in memory, 0 disables the cache.",
+      "bytes", QString::number(options.tail_cache));
+
+  parser.addOption(skewOption);
+  parser.addOption(contactsOption);
+  parser.addOption(contactSkewOption);
+  parser.addOption(seedOption);
+  parser.addOption(samplesOption);
+  parser.addOption(batchOption);
+  parser.addOption(tailLengthOption);
+  parser.addOption(tailCacheOption);
+  parser.process(app);
+
+  if (parser.positionalArguments().size() != 1) {
+    parser.showHelp(EXIT_FAILURE);
+  }
+
+  options.path = parser.positionalArguments().first();
+  options.shape.skew = qMax(parser.value(skewOption).toDouble(), 0.0);
+  options.shape.contacts =
+      qMax<qint64>(parser.value(contactsOption).toLongLong(), 1);
+  options.shape.contact_skew =
+      qMax(parser.value(contactSkewOption).toDouble(), 0.0);
+  options.seed = parser.value(seedOption).toUInt();
+  options.samples = qMax(parser.value(samplesOption).toInt(), 1);
+  options.batch = qMax(parser.value(batchOption).toInt(), 1);
+  options.tail_length = qMax(parser.value(tailLengthOption).toInt(), 0);
+  options.tail_cache =
+      qMax<qint64>(parser.value(tailCacheOption).toLongLong(), 0);
+
+  return options;
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  const auto options = parse(a);
+
+  if (!QFile::exists(options.path)) {
+    out << "No database at " << options.path << ", see dataset_gen"
+        << Qt::endl;
+    return EXIT_FAILURE;
+  }
+  if (!db::db.open(options.path)) {
+    return EXIT_FAILURE;
+  }
+  db::db.configureTailCache(options.tail_length, options.tail_cache);
+
+  QSqlQuery count(QSqlDatabase::database());
+  count.exec("SELECT (SELECT COUNT(*) FROM users), "
+             "(SELECT COUNT(*) FROM messages)");
+  count.next();
+  const auto users = count.value(0).toLongLong();
+  const auto messages = count.value(1).toLongLong();
+  if (users < 2) {
+    out << "The database has fewer than 2 users" << Qt::endl;
+    return EXIT_FAILURE;
+  }
+  out << users << " users, " << messages << " messages" << Qt::endl;
+
+  const bench::Conversations conversations(users, options.shape);
+
+  out << qSetFieldWidth(28) << Qt::left << "query" << Qt::right
+      << qSetFieldWidth(10) << "rows"
+      << "avg us"
+      << "p50 us"
+      << "p99 us"
+      << "p999 us"
+      << "max us" << qSetFieldWidth(0) << Qt::endl;
+
+  const auto zipf_pairs = pairs(conversations, users, true, options);
+  const auto uniform_pairs = pairs(conversations, users, false, options);
+  runReads("(zipf)", zipf_pairs, options.samples);
+  runReads("(uniform)", uniform_pairs, options.samples);
+
+  measure("getUserExists (missing)", options.samples, [&](const int i) {
+    return db::db.getUserExists("nobody" + QString::number(i));
+  });
+
+  // writer-sized transactions of messages in the hot conversations
+  bool created = true;
+  measure("createMessage x" + QString::number(options.batch),
+          qMax(options.samples / 10, 1), [&](const int i) {
+            db::db.transaction();
+            for (int j = 0; j < options.batch; ++j) {
+              const auto& pair =
+                  zipf_pairs[(i * options.batch + j) % zipf_pairs.size()];
+              created &= !db::db
+                              .createMessage(bench::userId(pair.first),
+                                             bench::userId(pair.second),
+                                             "a benchmark message")
+                              .error;
+            }
+            if (!db::db.commit()) {
+              db::db.rollback();
+              created = false;
+            }
+            return options.batch;
+          });
+  if (!created) {
+    out << "Some messages couldn't be created" << Qt::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (options.tail_cache != 0) {
+    const auto tail_stats = db::db.tailCacheStats();
+    out << "tail cache hits " << tail_stats.hits << ", misses "
+        << tail_stats.misses << ", ~" << tail_stats.bytes / 1024 << " KiB"
+        << Qt::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
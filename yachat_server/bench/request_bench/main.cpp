@@ -0,0 +1,137 @@
+// Measures how JSON requests are decoded on the server, per command:
+//   roundtrip   - fromUtf8/toUtf8, QJsonDocument, one walk per section
+//   document    - QJsonDocument straight from the bytes, one walk per section
+//   single-pass - packet::jsonDecodePacket on the raw receive buffer
+// Reports ns/op, heap bytes/op and allocations/op. Run on a release build,
+// e.g. `./request_bench 200000`.
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <cstdlib>
+
+#include "measure.hpp"
+#include "packet.hpp"
+
+namespace {
+
+using bench::measure;
+using bench::report;
+
+QJsonObject header(const packet::packet_t::header_t::command_t command) {
+  return {{packet::request_json_tags::header_command,
+           packet::packet_t::header_t::commandToQString(command)},
+          {packet::request_json_tags::header_request_id, "42"}};
+}
+
+QJsonObject authData(const bool with_password) {
+  QJsonObject auth_data{
+      {packet::request_json_tags::payload_auth_data_username, "alice"}};
+  if (with_password) {
+    auth_data.insert(packet::request_json_tags::payload_auth_data_password,
+                     "correct horse battery staple");
+  } else {
+    auth_data.insert(packet::request_json_tags::payload_auth_data_session_id,
+                     "1804289383");
+  }
+  return auth_data;
+}
+
+QByteArray request(const packet::packet_t::header_t::command_t command,
+                   const QJsonObject& payload) {
+  QJsonObject request{{packet::request_json_tags::header, header(command)}};
+  if (!payload.isEmpty()) {
+    request.insert(packet::request_json_tags::payload, payload);
+  }
+  return QJsonDocument(request).toJson(QJsonDocument::Compact);
+}
+
+void compare(const QString& command, const QByteArray& data,
+             const int iterations) {
+  report(command, "roundtrip", data.size(), measure(iterations, [&]() {
+           QString requestString = QString::fromUtf8(data);
+           QJsonDocument requestJson =
+               QJsonDocument::fromJson(requestString.toUtf8());
+           return static_cast<qsizetype>(
+               packet::jsonExtractPacket(requestJson).error);
+         }));
+  report(command, "document", data.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::jsonExtractPacket(QJsonDocument::fromJson(data)).error);
+         }));
+  report(command, "single-pass", data.size(), measure(iterations, [&]() {
+           return static_cast<qsizetype>(
+               packet::jsonDecodePacket(data).error);
+         }));
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication a(argc, argv);
+
+  const auto iterations =
+      qMax(argc > 1 ? QString(argv[1]).toInt() : 100000, 1);
+
+  bench::header("command", "decoder");
+
+  using command_t = packet::packet_t::header_t::command_t;
+
+  const QJsonObject target{
+      {packet::request_json_tags::payload_target_username, "bob"}};
+  const QJsonObject target_message{
+      {packet::request_json_tags::payload_target_username, "bob"},
+      {packet::request_json_tags::payload_target_message,
+       "hello there, \"bob\"\nhow are you doing?"}};
+
+  compare("register",
+          request(command_t::REGISTER,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(true)}}),
+          iterations);
+  compare("login",
+          request(command_t::LOGIN,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(true)}}),
+          iterations);
+  compare("logout",
+          request(command_t::LOGOUT,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(false)}}),
+          iterations);
+  compare("sendmsg",
+          request(command_t::SENDMSG,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(false)},
+                   {packet::request_json_tags::payload_target,
+                    target_message}}),
+          iterations);
+  compare("getmsgs",
+          request(command_t::GETMSGS,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(false)},
+                   {packet::request_json_tags::payload_target, target}}),
+          iterations);
+  compare("getallmsgs",
+          request(command_t::GETALLMSGS,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(false)}}),
+          iterations);
+  compare("getinbox",
+          request(command_t::GETINBOX,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(false)}}),
+          iterations);
+  compare("read",
+          request(command_t::READ,
+                  {{packet::request_json_tags::payload_auth_data,
+                    authData(false)},
+                   {packet::request_json_tags::payload_target, target}}),
+          iterations);
+  compare("setcodec", request(command_t::SETCODEC, {}), iterations);
+
+  bench::out << "checksum " << bench::sink << "\n";
+
+  return EXIT_SUCCESS;
+}
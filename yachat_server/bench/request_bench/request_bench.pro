@@ -0,0 +1,8 @@
+QT = core
+
+CONFIG += c++17 cmdline
+
+SOURCES += \
+        main.cpp
+
+INCLUDEPATH += .. ../../src
@@ -1,19 +1,27 @@
 #pragma once
 
 #include <QHash>
+#include <QObject>
+#include <QReadWriteLock>
 #include <cstdlib>
 #include <ctime>
 
 #include "common.hpp"
 #include "db.hpp"
+#include "trace.hpp"
+#include "writer.hpp"
 
 namespace auth {
 
 using session_id_t = QString;
+
+// shared by every worker thread, all public members are thread-safe
 struct {
  public:
   common::result_t<session_id_t> get(const QString& username) const {
-    if (!contains(username)) {
+    QReadLocker locker(&lock_);
+
+    if (!sessions_.contains(username)) {
       return {};
     }
 
@@ -25,7 +33,9 @@ struct {
   }
 
   common::result_t<qintptr> getSocketDescriptor(const QString& username) const {
-    if (!contains(username)) {
+    QReadLocker locker(&lock_);
+
+    if (!sessions_.contains(username)) {
       return {};
     }
 
@@ -37,12 +47,20 @@ struct {
   }
 
   bool contains(const QString& username) const {
+    QReadLocker locker(&lock_);
     return sessions_.contains(username);
   }
 
+  qsizetype size() const {
+    QReadLocker locker(&lock_);
+    return sessions_.size();
+  }
+
   common::result_t<session_id_t> add(const QString& username,
                                      const qintptr socket_descriptor) {
-    if (contains(username)) {
+    QWriteLocker locker(&lock_);
+
+    if (sessions_.contains(username)) {
       return {};
     }
 
@@ -57,7 +75,9 @@ struct {
   }
 
   bool remove(const QString& username) {
-    if (!contains(username)) {
+    QWriteLocker locker(&lock_);
+
+    if (!sessions_.contains(username)) {
       return false;
     }
 
@@ -68,6 +88,8 @@ struct {
   }
 
   void forcedRemove(const qintptr socket_descriptor) {
+    QWriteLocker locker(&lock_);
+
     if (!socketContains_(socket_descriptor)) {
       return;
     }
@@ -75,7 +97,7 @@ struct {
     const auto username = socket_sessions_[socket_descriptor];
     socket_sessions_.remove(socket_descriptor);
 
-    if (!contains(username)) {
+    if (!sessions_.contains(username)) {
       return;
     }
 
@@ -83,12 +105,14 @@ struct {
   }
 
  private:
+  mutable QReadWriteLock lock_;
   QHash<QString, session_id_t> sessions_;    // <username, session_id>
                                              // only one session is allowed
   QHash<qintptr, QString> socket_sessions_;  // <socket_descriptor, username>
                                              // to reset the session after
                                              // disconnecting the client
 
+  // rand() isn't thread-safe, called under the write lock only
   session_id_t genSessionId_() const {
     constexpr int diff = 'Z' - '0';
     srand(time(0));
@@ -105,98 +129,127 @@ struct {
   }
 } sessions;
 
-bool registerUser(const QString& username, const QString& password) {
+// queues the new user on db::writer, returns false if it's rejected;
+// done(registered) is called on the thread of context once it's committed
+template <typename Continuation>
+bool registerUser(const QString& username, const QString& password,
+                  QObject* context, Continuation done) {
   if (db::db.getUserExists(username)) {
-    common::logAll(QtDebugMsg,
-                   "[AUTH | REGISTER] User " + username + " already exists");
-    return false;
-  }
-
-  if (!db::db.createUser(username, password)) {
-    common::logAll(QtDebugMsg,
-                   "[AUTH | REGISTER] Can't create user " + username);
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | REGISTER] User " + username + " already exists";
+    });
     return false;
   }
 
-  common::logAll(QtDebugMsg,
-                 "[AUTH | REGISTER] User " + username + " registered");
+  db::writer.submitUser(
+      context, username, password,
+      [username, done = std::move(done)](const bool committed) mutable {
+        if (committed) {
+          common::logAll(QtDebugMsg, [&]() {
+            return "[AUTH | REGISTER] User " + username + " registered";
+          });
+        } else {
+          common::logAll(QtDebugMsg, [&]() {
+            return "[AUTH | REGISTER] Can't create user " + username;
+          });
+        }
+        done(committed);
+      });
 
   return true;
 }
 
-common::result_t<session_id_t> logInUser(const QString& username,
-                                         const QString& password,
-                                         const qintptr socket_descriptor) {
+// the part of a log in that reads the database, safe on any thread
+bool checkCredentials(const QString& username, const QString& password) {
   if (!db::db.getUserExists(username)) {
-    common::logAll(QtDebugMsg,
-                   "[AUTH | LOG IN] User " + username + " doesn't exist");
-    return {};
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG IN] User " + username + " doesn't exist";
+    });
+    return false;
   }
 
   if (!db::db.checkUserPassword(username, password)) {
-    common::logAll(QtDebugMsg,
-                   "[AUTH | LOG IN] Invalid password for user " + username);
-    return {};
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG IN] Invalid password for user " + username;
+    });
+    return false;
   }
 
+  return true;
+}
+
+// binds a session to socket_descriptor, so it must be called on the thread
+// that owns the connection, once it's known to be still open
+common::result_t<session_id_t> logInUser(const QString& username,
+                                         const qintptr socket_descriptor) {
   const auto session_id_monad = sessions.add(username, socket_descriptor);
   if (session_id_monad.error) {
-    common::logAll(QtDebugMsg, "[AUTH | LOG IN] User " + username +
-                                   " is already logged in");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG IN] User " + username + " is already logged in";
+    });
     return {};
   }
 
-  common::logAll(QtDebugMsg, "[AUTH | LOG IN] User " + username + " logged in");
+  common::logAll(QtDebugMsg, [&]() {
+    return "[AUTH | LOG IN] User " + username + " logged in";
+  });
 
   return session_id_monad;
 }
 
 bool logOutUser(const session_id_t& session_id, const QString& username) {
   if (!db::db.getUserExists(username)) {
-    common::logAll(QtDebugMsg,
-                   "[AUTH | LOG OUT] User " + username + " doesn't exist");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG OUT] User " + username + " doesn't exist";
+    });
     return false;
   }
 
   const auto session_id_monad = sessions.get(username);
   if (session_id_monad.error) {
-    common::logAll(QtDebugMsg,
-                   "[AUTH | LOG OUT] User " + username + " is not logged in");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG OUT] User " + username + " is not logged in";
+    });
     return false;
   }
 
   if (session_id_monad.data != session_id) {
-    common::logAll(QtDebugMsg, "[AUTH | LOG OUT] Session ID " + session_id +
-                                   " is incorrect");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG OUT] Session ID " + session_id + " is incorrect";
+    });
     return false;
   }
 
   if (!sessions.remove(username)) {
-    common::logAll(
-        QtDebugMsg,
-        "[AUTH | LOG OUT] An unknown error occured while erasing the session " +
-            session_id + " of user " + username);
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | LOG OUT] An unknown error occured while erasing the "
+             "session " + session_id + " of user " + username;
+    });
     return false;
   }
 
-  common::logAll(QtDebugMsg, "[AUTH | LOG OUT] User " + username +
-                                 " logged out successfully");
+  common::logAll(QtDebugMsg, [&]() {
+    return "[AUTH | LOG OUT] User " + username + " logged out successfully";
+  });
 
   return true;
 }
 
 void forcedLogOutUser(const qintptr socket_descriptor) {
   sessions.forcedRemove(socket_descriptor);
-  common::logAll(QtDebugMsg,
-                 "[AUTH | FORCED LOG OUT] User with socket descriptor " +
-                     QString::number(socket_descriptor) +
-                     " was successfully forcibly logged out");
+  common::logAll(QtDebugMsg, [&]() {
+    return "[AUTH | FORCED LOG OUT] User with socket descriptor " +
+           QString::number(socket_descriptor) +
+           " was successfully forcibly logged out";
+  });
 }
 
 common::result_t<qintptr> getSocketDescriptor(const QString& username) {
   if (!db::db.getUserExists(username)) {
-    common::logAll(QtDebugMsg, "[AUTH | GET SOCKET DESCRIPTOR] User " +
-                                   username + " doesn't exist");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | GET SOCKET DESCRIPTOR] User " + username +
+             " doesn't exist";
+    });
     return {};
   }
 
@@ -205,22 +258,28 @@ common::result_t<qintptr> getSocketDescriptor(const QString& username) {
 
 // for external usage
 bool isAuthorized(const QString& session_id, const QString& username) {
+  const trace::Span span("auth");
+
   if (!db::db.getUserExists(username)) {
-    common::logAll(QtDebugMsg, "[AUTH | IS AUTHORIZED] User " + username +
-                                   " doesn't exist");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | IS AUTHORIZED] User " + username + " doesn't exist";
+    });
     return false;
   }
 
   const auto session_id_monad = sessions.get(username);
   if (session_id_monad.error) {
-    common::logAll(QtDebugMsg, "[AUTH | IS AUTHORIZED] User " + username +
-                                   " is not logged in");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | IS AUTHORIZED] User " + username + " is not logged in";
+    });
     return false;
   }
 
   if (session_id_monad.data != session_id) {
-    common::logAll(QtDebugMsg, "[AUTH | IS AUTHORIZED] Session ID " +
-                                   session_id + " is incorrect");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[AUTH | IS AUTHORIZED] Session ID " + session_id +
+             " is incorrect";
+    });
     return false;
   }
 
@@ -3,46 +3,28 @@
 #include <stdlib.h>
 
 #include <QCoreApplication>
-#include <QDebug>
-#include <QFile>
+#include <QString>
+#include <type_traits>
+
+#include "logger.hpp"
 
 namespace common {
 
+// lines below the logger's level are dropped right away, see Logger
 void logAll(QtMsgType type, const QString& msg) {
-  switch (type) {
-    case QtDebugMsg: {
-      qDebug().noquote() << msg;
-      break;
-    };
-    case QtWarningMsg: {
-      qWarning().noquote() << msg;
-      break;
-    };
-    case QtCriticalMsg: {
-      qCritical().noquote() << msg;
-      break;
-    };
-    case QtFatalMsg: {
-      qFatal("%s", msg.toStdString().c_str());
-      break;
-    };
-    case QtInfoMsg: {
-      qInfo().noquote() << msg;
-      break;
-    };
-    default: {
-      qDebug().noquote() << msg;
-      break;
-    };
+  if (logger.enabled(type)) {
+    logger.push(type, msg);
+  }
+}
+
+// format() is only called if the line isn't dropped, for the lines logged on
+// every request
+template <typename Format,
+          typename = std::enable_if_t<std::is_invocable_r_v<QString, Format&>>>
+void logAll(QtMsgType type, Format&& format) {
+  if (logger.enabled(type)) {
+    logger.push(type, format());
   }
-#ifdef JOURNAL
-  QFile file(JOURNAL);
-  file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append);
-  QTextStream out(&file);
-  out << QDateTime::currentDateTime().toString("(yyyy-MM-dd hh:mm:ss.zzz) ")
-      << msg << "\n";
-  out.flush();
-#endif
 }
 
 template <typename T>
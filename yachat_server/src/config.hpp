@@ -0,0 +1,159 @@
+#pragma once
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+namespace config {
+
+struct config_t {
+  quint16 port = 1234;
+  int workers = 0;  // 0 - every connection is handled on the main thread
+  int db_threads = 1;
+  int stats_interval = 60;  // seconds, 0 - disabled
+  quint16 metrics_port = 0;  // Prometheus endpoint on localhost, 0 - disabled
+  // bytes queued for one client before its requests stop being read and its
+  // notifications get dropped, reading resumes below the low watermark
+  qint64 high_watermark = 4 * 1024 * 1024;
+  qint64 low_watermark = 1024 * 1024;
+  // requests of one client read but not answered yet before its requests
+  // stop being read, reading resumes as soon as one is answered
+  int max_in_flight = 64;
+  // sent messages are committed in batches of up to batch_size, a batch
+  // waits at most batch_interval milliseconds to fill up
+  int batch_size = 128;
+  int batch_interval = 2;
+  // the last tail_length messages of each recently read conversation are
+  // kept in memory, up to tail_cache bytes in total (0 - disabled)
+  int tail_length = 50;
+  qint64 tail_cache = 16 * 1024 * 1024;
+  QtMsgType log_level = QtDebugMsg;  // less severe lines aren't logged
+  // share of the requests traced into trace_path (0 - disabled, 1 - all)
+  double trace_rate = 0;
+  QString trace_path = "trace.json";
+  QString db_path = DB_PATH;  // DB_PATH is a compile-time variable
+};
+
+config_t parse(const QCoreApplication& app) {
+  config_t config;
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Yet another chat server");
+  parser.addHelpOption();
+
+  const QCommandLineOption portOption(
+      {"p", "port"}, "Port to listen on.", "port",
+      QString::number(config.port));
+  const QCommandLineOption workersOption(
+      {"w", "workers"},
+      "Number of worker threads serving connections, 0 handles everything on "
+      "the main thread.",
+      "count", QString::number(config.workers));
+  const QCommandLineOption dbThreadsOption(
+      "db-threads", "Number of threads executing database queries.", "count",
+      QString::number(config.db_threads));
+  const QCommandLineOption statsIntervalOption(
+      "stats-interval",
+      "Seconds between two runtime statistics log lines, 0 disables them.",
+      "seconds", QString::number(config.stats_interval));
+  const QCommandLineOption metricsPortOption(
+      "metrics-port",
+      "Localhost port serving Prometheus metrics on /metrics, 0 disables it.",
+      "port", QString::number(config.metrics_port));
+  const QCommandLineOption highWatermarkOption(
+      "high-watermark",
+      "Bytes queued for a client before its requests stop being read and "
+      "notifications to it are dropped.",
+      "bytes", QString::number(config.high_watermark));
+  const QCommandLineOption lowWatermarkOption(
+      "low-watermark",
+      "Bytes queued for a client below which reading from it resumes.",
+      "bytes", QString::number(config.low_watermark));
+  const QCommandLineOption maxInFlightOption(
+      "max-in-flight",
+      "Requests of a client processed at once before its requests stop "
+      "being read.",
+      "count", QString::number(config.max_in_flight));
+  const QCommandLineOption batchSizeOption(
+      "batch-size", "Most sent messages committed in one transaction.",
+      "count", QString::number(config.batch_size));
+  const QCommandLineOption batchIntervalOption(
+      "batch-interval",
+      "Milliseconds a sent message waits for others to share its commit.",
+      "ms", QString::number(config.batch_interval));
+  const QCommandLineOption tailLengthOption(
+      "tail-length", "Most recent messages cached per conversation.",
+      "count", QString::number(config.tail_length));
+  const QCommandLineOption tailCacheOption(
+      "tail-cache",
+      "Bytes of conversation tails kept in memory, 0 disables the cache.",
+      "bytes", QString::number(config.tail_cache));
+
+  const QCommandLineOption logLevelOption(
+      "log-level",
+      "Least severe lines logged: debug, info, warning or critical.", "level",
+      "debug");
+
+  const QCommandLineOption traceRateOption(
+      "trace-rate",
+      "Share of the requests traced, from 0 (disabled) to 1 (every request).",
+      "rate", QString::number(config.trace_rate));
+  const QCommandLineOption traceFileOption(
+      "trace-file", "File the traces are written to, in Chrome trace format.",
+      "path", config.trace_path);
+
+  const QCommandLineOption dbOption(
+      "db", "SQLite database file, created and migrated if needed.", "path",
+      config.db_path);
+
+  parser.addOption(portOption);
+  parser.addOption(workersOption);
+  parser.addOption(dbThreadsOption);
+  parser.addOption(statsIntervalOption);
+  parser.addOption(metricsPortOption);
+  parser.addOption(highWatermarkOption);
+  parser.addOption(lowWatermarkOption);
+  parser.addOption(maxInFlightOption);
+  parser.addOption(batchSizeOption);
+  parser.addOption(batchIntervalOption);
+  parser.addOption(tailLengthOption);
+  parser.addOption(tailCacheOption);
+  parser.addOption(logLevelOption);
+  parser.addOption(traceRateOption);
+  parser.addOption(traceFileOption);
+  parser.addOption(dbOption);
+  parser.process(app);
+
+  config.port = parser.value(portOption).toUShort();
+  config.workers = qMax(parser.value(workersOption).toInt(), 0);
+  config.db_threads = qMax(parser.value(dbThreadsOption).toInt(), 1);
+  config.stats_interval = qMax(parser.value(statsIntervalOption).toInt(), 0);
+  config.metrics_port = parser.value(metricsPortOption).toUShort();
+  config.high_watermark =
+      qMax(parser.value(highWatermarkOption).toLongLong(), 1LL);
+  config.low_watermark =
+      qBound(0LL, parser.value(lowWatermarkOption).toLongLong(),
+             config.high_watermark);
+  config.max_in_flight = qMax(parser.value(maxInFlightOption).toInt(), 1);
+  config.batch_size = qMax(parser.value(batchSizeOption).toInt(), 1);
+  config.batch_interval = qMax(parser.value(batchIntervalOption).toInt(), 0);
+  config.tail_length = qMax(parser.value(tailLengthOption).toInt(), 1);
+  config.tail_cache = qMax(parser.value(tailCacheOption).toLongLong(), 0LL);
+  config.trace_rate =
+      qBound(0.0, parser.value(traceRateOption).toDouble(), 1.0);
+  config.trace_path = parser.value(traceFileOption);
+  config.db_path = parser.value(dbOption);
+
+  const auto log_level = parser.value(logLevelOption);
+  if (log_level == "info") {
+    config.log_level = QtInfoMsg;
+  } else if (log_level == "warning") {
+    config.log_level = QtWarningMsg;
+  } else if (log_level == "critical") {
+    config.log_level = QtCriticalMsg;
+  }
+
+  return config;
+}
+
+};  // namespace config
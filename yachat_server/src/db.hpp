@@ -4,17 +4,130 @@
 #include <QList>
 #include <QString>
 #include <QtSql>
+#include <algorithm>
+#include <functional>
+#include <limits>
 
 #include "common.hpp"
+#include "directory.hpp"
+#include "migration.hpp"
 #include "packet.hpp"
+#include "pool.hpp"
+#include "tail_cache.hpp"
 
 namespace db {
 
+// every statement DB issues, the constants double as statement cache keys
+namespace sql {
+
+constexpr auto password = "SELECT password FROM users WHERE username = ?";
+constexpr auto create_user =
+    "INSERT INTO users (username, password) VALUES (?, ?)";
+constexpr auto create_message =
+    "INSERT INTO messages (from_user_id, to_user_id, message) VALUES (?, ?, ?)";
+// the summary of one side of a conversation, unread is added up
+constexpr auto touch_conversation =
+    "INSERT INTO conversations (user_id, peer_id, last_message_id, "
+    "last_message, unread) VALUES (?, ?, ?, ?, ?) "
+    "ON CONFLICT (user_id, peer_id) DO UPDATE SET "
+    "last_message_id = excluded.last_message_id, "
+    "last_message = excluded.last_message, "
+    "unread = unread + excluded.unread";
+// every entry of a writer batch runs within its own savepoint
+constexpr auto savepoint = "SAVEPOINT entry";
+constexpr auto release_savepoint = "RELEASE entry";
+constexpr auto rollback_savepoint = "ROLLBACK TO entry";
+constexpr auto read_conversation =
+    "UPDATE conversations SET unread = 0 WHERE user_id == ? AND peer_id == ? "
+    "AND unread != 0";
+constexpr auto inbox =
+    "SELECT peer_id, last_message_id, last_message, unread FROM "
+    "conversations WHERE user_id == ? ORDER BY last_message_id DESC";
+// a conversation is one direction per half, each walking a conversation
+// index within (after, before), merged in message_id order without sorting so the
+// LIMIT stops the scan; messages to oneself are only in the first half
+constexpr auto msgs_forward =
+    "SELECT from_user_id, message, message_id FROM messages WHERE "
+    "from_user_id == ? AND to_user_id == ? AND message_id > ? AND "
+    "message_id < ? "
+    "UNION ALL "
+    "SELECT from_user_id, message, message_id FROM messages WHERE "
+    "from_user_id == ? AND to_user_id == ? AND from_user_id != to_user_id "
+    "AND message_id > ? AND message_id < ? "
+    "ORDER BY message_id LIMIT ?";
+constexpr auto msgs_backward =
+    "SELECT from_user_id, message, message_id FROM messages WHERE "
+    "from_user_id == ? AND to_user_id == ? AND message_id > ? AND "
+    "message_id < ? "
+    "UNION ALL "
+    "SELECT from_user_id, message, message_id FROM messages WHERE "
+    "from_user_id == ? AND to_user_id == ? AND from_user_id != to_user_id "
+    "AND message_id > ? AND message_id < ? "
+    "ORDER BY message_id DESC LIMIT ?";
+// each half walks one of the conversation indexes in (peer_id, message_id)
+// order, so SQLite merges them without sorting; messages to oneself are only
+// in the first half
+constexpr auto all_msgs =
+    "SELECT to_user_id AS peer_id, 1 AS own, message, message_id FROM "
+    "messages WHERE from_user_id == ? "
+    "UNION ALL "
+    "SELECT from_user_id, 0, message, message_id FROM messages WHERE "
+    "to_user_id == ? AND from_user_id != ? "
+    "ORDER BY peer_id, message_id";
+// the rows of all_msgs past a high-water mark, found through the per-user
+// indexes and sorted, the delta is expected to be small
+constexpr auto all_msgs_since =
+    "SELECT to_user_id AS peer_id, 1 AS own, message, message_id FROM "
+    "messages WHERE from_user_id == ? AND message_id > ? "
+    "UNION ALL "
+    "SELECT from_user_id, 0, message, message_id FROM messages WHERE "
+    "to_user_id == ? AND from_user_id != ? AND message_id > ? "
+    "ORDER BY peer_id, message_id";
+
+};  // namespace sql
+
+// a GETMSGS page, the fields are the ones of packet_t::payload_t::target_t
+struct page_t {
+  quint64 before = 0;
+  quint64 after = 0;
+  quint64 limit = 0;
+
+  // paging back from before (or from the newest message), otherwise the
+  // messages are read forward from after
+  bool backward() const { return limit != 0 && after == 0; }
+};
+
+// characters of the last message kept in a conversation summary
+constexpr qsizetype preview_length = 100;
+
 class DB {
  public:
   DB(const DB&) = delete;
   DB& operator=(const DB&) = delete;
 
+  // must be called once on startup, before any other member, from the thread
+  // that owns the main connection; the schema is migrated up to
+  // target_version
+  bool open(const QString& path,
+            const int target_version = migration::latest()) {
+    if (!pool_.open(path)) {
+      return false;
+    }
+
+    const auto main = pool_.connection();
+    if (!migration::run(main, target_version)) {
+      return false;
+    }
+
+    if (!directory_.load(main)) {
+      common::logAll(QtCriticalMsg, "[DB] Can't load the user directory: " +
+                                        main.lastError().text());
+      return false;
+    }
+
+    return true;
+  }
+
   static DB& getInstance() {
     if (!instance_) {
       instance_ = new DB();
@@ -22,34 +135,104 @@ class DB {
     return *instance_;
   }
 
+  // users are resolved from the in-memory directory, never from the database
+
   bool getUserExists(const QString& username) {
-    QSqlQuery query;
-    query.prepare("SELECT user_id FROM users WHERE username = ?");
-    query.addBindValue(username);
-    query.exec();
+    return !directory_.id(username).error;
+  }
 
-    if (query.next()) {
-      return true;
-    }
+  common::result_t<quint64> getUserId(const QString& username) {
+    return directory_.id(username);
+  }
 
-    return false;
+  common::result_t<QString> getUsername(const quint64 user_id) {
+    return directory_.username(user_id);
   }
 
-  common::result_t<quint64> getUserId(const QString& username) {
-    common::result_t<quint64> res;
+  // side is "y" for messages sent by from_user_id and "t" for the ones it
+  // received
+  using msg_visitor_t =
+      std::function<void(const QString& side, const QString& message)>;
+  // called for every message of every conversation of a user, conversations
+  // come one after another, in the order the messages were sent
+  using conversation_msg_visitor_t =
+      std::function<void(const QString& username, const QString& side,
+                         const QString& message)>;
+
+  // hands the page of the conversation to visitor, oldest message first; the
+  // monad holds the cursor of the next page (0 if there is none) and is an
+  // error if the page is empty. Only backward pages are buffered, they are
+  // bounded by their limit
+  common::result_t<quint64> visitMsgs(const quint64 from_user_id,
+                                      const quint64 to_user_id,
+                                      const msg_visitor_t& visitor,
+                                      const page_t& page = {}) {
+    const auto side = [&](const quint64 sender_id) {
+      return sender_id == from_user_id
+                 ? packet::response_json_tags::payload_target_messages_y
+                 : packet::response_json_tags::payload_target_messages_t;
+    };
+
+    common::result_t<quint64> next_monad;
+    next_monad.data = 0;
+
+    QList<TailCache::message_t> cached;
+    if (pageFromCache_(from_user_id, to_user_id, page, cached,
+                       next_monad.data)) {
+      for (const auto& message : cached) {
+        visitor(side(message.sender_id), message.message);
+      }
+      next_monad.error = cached.isEmpty();
+      return next_monad;
+    }
 
-    QSqlQuery query;
-    query.prepare("SELECT user_id FROM users WHERE username = ?");
-    query.addBindValue(username);
+    const auto backward = page.backward();
+    const qint64 after = page.after;
+    const qint64 before = page.before != 0
+                              ? static_cast<qint64>(page.before)
+                              : std::numeric_limits<qint64>::max();
+    // one more row than asked for tells whether there is a next page
+    const qint64 limit =
+        page.limit != 0 ? static_cast<qint64>(page.limit) + 1 : -1;
+
+    auto& query = statement_(backward ? sql::msgs_backward : sql::msgs_forward);
+    query.bindValue(0, from_user_id);
+    query.bindValue(1, to_user_id);
+    query.bindValue(2, after);
+    query.bindValue(3, before);
+    query.bindValue(4, to_user_id);
+    query.bindValue(5, from_user_id);
+    query.bindValue(6, after);
+    query.bindValue(7, before);
+    query.bindValue(8, limit);
     query.exec();
 
-    if (query.next()) {
-      res.error = false;
-      res.data = query.value(0).toUInt();
-      return res;
+    quint64 rows = 0;
+    quint64 last_id = 0;
+    QList<QPair<quint64, QString>> buffered;  // <sender id, message>
+    while (query.next()) {
+      if (page.limit != 0 && rows == page.limit) {
+        next_monad.data = last_id;
+        query.finish();
+        break;
+      }
+      ++rows;
+
+      const auto sender_id = query.value(0).toULongLong();
+      last_id = query.value(2).toULongLong();
+      if (backward) {
+        buffered.push_back({sender_id, query.value(1).toString()});
+      } else {
+        visitor(side(sender_id), query.value(1).toString());
+      }
     }
 
-    return {};
+    for (auto it = buffered.crbegin(); it != buffered.crend(); ++it) {
+      visitor(side(it->first), it->second);
+    }
+
+    next_monad.error = rows == 0;
+    return next_monad;
   }
 
   common::result_t<QList<packet::packet_t::payload_t::target_t::message_t>>
@@ -57,38 +240,73 @@ class DB {
     common::result_t<QList<packet::packet_t::payload_t::target_t::message_t>>
         res;
 
-    QSqlQuery query;
-    query.prepare(
-        "SELECT from_user_id, to_user_id, message FROM messages WHERE "
-        "from_user_id IN (?, ?) AND to_user_id IN (?, ?)");
-    query.addBindValue(from_user_id);
-    query.addBindValue(to_user_id);
-    query.addBindValue(from_user_id);
-    query.addBindValue(to_user_id);
+    res.error = visitMsgs(from_user_id, to_user_id,
+                          [&](const QString& side, const QString& message) {
+                            res.data.push_back({side, message});
+                          })
+                    .error;
+    if (res.error) {
+      return {};
+    }
+
+    return res;
+  }
+
+  // hands the rows to visitor as they are read, grouped by conversation;
+  // with since only the messages newer than it. The monad holds the highest
+  // message_id handed out (since if there are none), the next since of the
+  // user, and is an error if a full read finds no messages at all
+  common::result_t<quint64> visitAllMsgs(
+      const quint64 user_id, const conversation_msg_visitor_t& visitor,
+      const quint64 since = 0) {
+    auto& query = statement_(since != 0 ? sql::all_msgs_since : sql::all_msgs);
+    if (since != 0) {
+      query.bindValue(0, user_id);
+      query.bindValue(1, since);
+      query.bindValue(2, user_id);
+      query.bindValue(3, user_id);
+      query.bindValue(4, since);
+    } else {
+      query.bindValue(0, user_id);
+      query.bindValue(1, user_id);
+      query.bindValue(2, user_id);
+    }
     query.exec();
 
+    common::result_t<quint64> last_monad;
+    last_monad.data = since;
     bool found = false;
+    quint64 peer_id = 0;
+    QString peer_username;
     while (query.next()) {
-      found = true;
-
-      const auto sender_id = query.value(0).toUInt();
+      const auto row_peer_id = query.value(0).toULongLong();
+      const auto own = query.value(1).toBool();
       const auto message = query.value(2).toString();
+      last_monad.data = qMax(last_monad.data, query.value(3).toULongLong());
 
-      if (sender_id == from_user_id) {
-        res.data.push_back(
-            {packet::response_json_tags::payload_target_messages_y, message});
-      } else {
-        res.data.push_back(
-            {packet::response_json_tags::payload_target_messages_t, message});
+      // rows are ordered by peer, so the name is resolved once per
+      // conversation
+      if (!found || row_peer_id != peer_id) {
+        peer_id = row_peer_id;
+        peer_username = getUsername(peer_id).data;
       }
-    }
+      found = true;
 
-    if (found) {
-      res.error = false;
-      return res;
+      if (own) {
+        visitor(
+            peer_username,
+            packet::response_json_tags::payload_target_all_messages_messages_y,
+            message);
+      } else {
+        visitor(
+            peer_username,
+            packet::response_json_tags::payload_target_all_messages_messages_t,
+            message);
+      }
     }
 
-    return {};
+    last_monad.error = !found && since == 0;
+    return last_monad;
   }
 
   common::result_t<
@@ -100,113 +318,308 @@ class DB {
         QHash<QString, QList<packet::packet_t::payload_t::target_t::message_t>>>
         res;
 
-    QSqlQuery usernameQuery;
-    usernameQuery.prepare("SELECT username FROM users WHERE user_id == ?");
-    usernameQuery.addBindValue(user_id);
-    usernameQuery.exec();
-
-    if (!usernameQuery.next()) {
+    res.error = visitAllMsgs(user_id,
+                             [&](const QString& username, const QString& side,
+                                 const QString& message) {
+                               res.data[username].push_back({side, message});
+                             })
+                    .error;
+    if (res.error) {
       return {};
     }
 
-    const auto username = usernameQuery.value(0).toString();
+    return res;
+  }
 
-    QSqlQuery query;
-    query.prepare(
-        "SELECT from_user_id, to_user_id, message FROM messages WHERE "
-        "from_user_id == ? OR to_user_id == ?");
-    query.addBindValue(user_id);
-    query.addBindValue(user_id);
+  bool checkUserPassword(const QString& username, const QString& password) {
+    auto& query = statement_(sql::password);
+    query.bindValue(0, username);
     query.exec();
 
-    bool found = false;
-    while (query.next()) {
-      found = true;
+    const bool matches =
+        query.next() && query.value(0).toString() == password;
+    query.finish();
 
-      const auto sender_id = query.value(0).toUInt();
-      const auto rec_id = query.value(1).toUInt();
-      const auto message = query.value(2).toString();
+    return matches;
+  }
 
-      usernameQuery.prepare("SELECT username FROM users WHERE user_id == ?");
+  bool createUser(const QString& username, const QString& password) {
+    auto& query = statement_(sql::create_user);
+    query.bindValue(0, username);
+    query.bindValue(1, password);
+    if (!query.exec()) {
+      return false;
+    }
 
-      QString targetUsername;
-      if (sender_id != user_id) {
-        usernameQuery.addBindValue(sender_id);
-      } else {
-        usernameQuery.addBindValue(rec_id);
-      }
+    const auto user_id = query.lastInsertId().toULongLong();
+    auto& writes = transactionWrites_();
+    if (writes.transaction) {
+      writes.users.push_back({user_id, username});
+    } else {
+      directory_.add(user_id, username);
+    }
+    return true;
+  }
 
-      usernameQuery.exec();
-      usernameQuery.next();
-      targetUsername = usernameQuery.value(0).toString();
+  // also updates the conversation summaries of both users, so it belongs in
+  // a transaction; the monad holds the id of the message
+  common::result_t<quint64> createMessage(const quint64 from_user_id,
+                                          const quint64 to_user_id,
+                                          const QString& message) {
+    auto& query = statement_(sql::create_message);
+    query.bindValue(0, from_user_id);
+    query.bindValue(1, to_user_id);
+    query.bindValue(2, message);
+    if (!query.exec()) {
+      return {};
+    }
 
-      if (sender_id == user_id) {
-        res.data[targetUsername].push_back(
-            {packet::response_json_tags::payload_target_all_messages_messages_y,
-             message});
-      } else {
-        res.data[targetUsername].push_back(
-            {packet::response_json_tags::payload_target_all_messages_messages_t,
-             message});
-      }
+    const auto message_id = query.lastInsertId().toULongLong();
+
+    const auto preview = message.left(preview_length);
+    if (!touchConversation_(from_user_id, to_user_id, message_id, preview,
+                            0)) {
+      return {};
+    }
+    if (from_user_id != to_user_id &&
+        !touchConversation_(to_user_id, from_user_id, message_id, preview,
+                            1)) {
+      return {};
     }
 
-    if (found) {
-      res.error = false;
-      return res;
+    // only once every statement of the message succeeded
+    cacheMessage_(to_user_id, {message_id, from_user_id, message});
+
+    common::result_t<quint64> message_id_monad;
+    message_id_monad.error = false;
+    message_id_monad.data = message_id;
+
+    return message_id_monad;
+  }
+
+  // nothing of the conversation of user_id with peer_id is unread anymore
+  bool markRead(const quint64 user_id, const quint64 peer_id) {
+    auto& query = statement_(sql::read_conversation);
+    query.bindValue(0, user_id);
+    query.bindValue(1, peer_id);
+    return query.exec();
+  }
+
+  // the conversations of user_id, the most recent one first
+  common::result_t<
+      QList<packet::packet_t::payload_t::target_t::conversation_t>>
+  getInbox(const quint64 user_id) {
+    auto& query = statement_(sql::inbox);
+    query.bindValue(0, user_id);
+    if (!query.exec()) {
+      return {};
     }
 
-    return {};
+    common::result_t<
+        QList<packet::packet_t::payload_t::target_t::conversation_t>>
+        res;
+    while (query.next()) {
+      packet::packet_t::payload_t::target_t::conversation_t conversation;
+      conversation.username = getUsername(query.value(0).toULongLong()).data;
+      conversation.last_message_id = query.value(1).toULongLong();
+      conversation.last_message = query.value(2).toString();
+      conversation.unread = query.value(3).toULongLong();
+      res.data.push_back(conversation);
+    }
+
+    res.error = false;
+    return res;
   }
 
-  bool checkUserPassword(const QString& username, const QString& password) {
-    QSqlQuery query;
-    query.prepare("SELECT password FROM users WHERE username = ?");
-    query.addBindValue(username);
-    query.exec();
+  // the calling thread is the only one writing after startup, see
+  // ConnectionPool
+  void claimWriter() { pool_.claimWriter(); }
+
+  // transactions on the calling thread's connection, the messages and users
+  // they create reach the tail cache and the directory once they are
+  // committed
+  bool transaction() {
+    auto& writes = transactionWrites_();
+    writes.messages.clear();
+    writes.users.clear();
+    writes.transaction = pool_.connection().transaction();
+    return writes.transaction;
+  }
 
-    if (query.next()) {
-      if (query.value(0).toString() == password) {
-        return true;
-      }
+  bool commit() {
+    if (!pool_.connection().commit()) {
+      return false;  // the caller rolls back
     }
 
-    return false;
+    auto& writes = transactionWrites_();
+    for (const auto& [to_user_id, message] : writes.messages) {
+      tail_cache_.append(message.sender_id, to_user_id, message);
+    }
+    for (const auto& [user_id, username] : writes.users) {
+      directory_.add(user_id, username);
+    }
+    writes.messages.clear();
+    writes.users.clear();
+    writes.transaction = false;
+    return true;
   }
 
-  bool createUser(const QString& username, const QString& password) {
-    QSqlQuery query;
-    query.prepare("INSERT INTO users (username, password) VALUES (?, ?)");
-    query.addBindValue(username);
-    query.addBindValue(password);
-    return query.exec();
+  bool rollback() {
+    auto& writes = transactionWrites_();
+    writes.messages.clear();
+    writes.users.clear();
+    writes.transaction = false;
+    return pool_.connection().rollback();
   }
 
-  bool createMessage(const quint64 from_user_id, const quint64 to_user_id,
-                     const QString& message) {
-    QSqlQuery query;
-    query.prepare(
-        "INSERT INTO messages (from_user_id, to_user_id, message) VALUES (?, "
-        "?, ?)");
-    query.addBindValue(from_user_id);
-    query.addBindValue(to_user_id);
-    query.addBindValue(message);
-    return query.exec();
+  // within a transaction, the statements run after savepoint() are undone by
+  // rollbackToSavepoint() along with their tail cache and directory writes,
+  // or kept by releaseSavepoint(); savepoints don't nest
+  bool savepoint() {
+    auto& writes = transactionWrites_();
+    writes.savepoint_messages = writes.messages.size();
+    writes.savepoint_users = writes.users.size();
+    return statement_(sql::savepoint).exec();
+  }
+
+  bool releaseSavepoint() { return statement_(sql::release_savepoint).exec(); }
+
+  bool rollbackToSavepoint() {
+    auto& writes = transactionWrites_();
+    writes.messages.resize(
+        qMin(writes.savepoint_messages, writes.messages.size()));
+    writes.users.resize(qMin(writes.savepoint_users, writes.users.size()));
+    // ROLLBACK TO keeps the savepoint open
+    return statement_(sql::rollback_savepoint).exec() &&
+           statement_(sql::release_savepoint).exec();
+  }
+
+  // length messages of up to bytes worth of conversations, 0 disables it
+  void configureTailCache(const qsizetype length, const qsizetype bytes) {
+    tail_cache_.configure(length, bytes);
   }
 
+  tail_cache_stats_t tailCacheStats() const { return tail_cache_.stats(); }
+
+  directory_stats_t directoryStats() const { return directory_.stats(); }
+
+  statement_stats_t statementStats() const { return pool_.statementStats(); }
+
+  pool_stats_t poolStats() const { return pool_.stats(); }
+
  private:
-  QSqlDatabase sdb_;
   static DB* instance_;
 
-  DB() {
-    sdb_ = QSqlDatabase::addDatabase("QSQLITE");
-    sdb_.setDatabaseName(DB_PATH);  // DB_PATH is a compile-time variable
-    if (!sdb_.open()) {
-      common::logAll(QtFatalMsg, "[DB] " + sdb_.lastError().text());
-      exit(EXIT_FAILURE);
+  ConnectionPool pool_;
+  UserDirectory directory_;
+  TailCache tail_cache_;
+
+  // messages and users created by the calling thread's open transaction,
+  // applied to the tail cache and the directory once it's committed
+  struct transaction_writes_t {
+    bool transaction = false;
+    // <to user id, message>
+    QList<QPair<quint64, TailCache::message_t>> messages;
+    QList<QPair<quint64, QString>> users;  // <user id, username>
+    qsizetype savepoint_messages = 0;  // queued before the savepoint
+    qsizetype savepoint_users = 0;
+  };
+
+  static transaction_writes_t& transactionWrites_() {
+    thread_local transaction_writes_t writes;
+    return writes;
+  }
+
+  void cacheMessage_(const quint64 to_user_id,
+                     const TailCache::message_t& message) {
+    auto& writes = transactionWrites_();
+    if (writes.transaction) {
+      writes.messages.push_back({to_user_id, message});
+    } else {
+      tail_cache_.append(message.sender_id, to_user_id, message);
     }
   }
 
+  // a conversation missing from the tail cache is loaded on its first miss,
+  // the page is answered from it if it covers the page
+  bool pageFromCache_(const quint64 from_user_id, const quint64 to_user_id,
+                      const page_t& page, QList<TailCache::message_t>& rows,
+                      quint64& next) {
+    if (tail_cache_.page(from_user_id, to_user_id, page.before, page.after,
+                         page.limit, page.backward(), rows, next)) {
+      tail_cache_.record(true);
+      return true;
+    }
+
+    tail_cache_.record(false);
+    if (!tail_cache_.reserve(from_user_id, to_user_id)) {
+      return false;
+    }
+
+    loadTail_(from_user_id, to_user_id);
+    return tail_cache_.page(from_user_id, to_user_id, page.before, page.after,
+                            page.limit, page.backward(), rows, next);
+  }
+
+  // the newest messages of the conversation, one more than the tail holds
+  // tells whether it's the whole conversation
+  void loadTail_(const quint64 from_user_id, const quint64 to_user_id) {
+    const auto length = tail_cache_.length();
+
+    auto& query = statement_(sql::msgs_backward);
+    query.bindValue(0, from_user_id);
+    query.bindValue(1, to_user_id);
+    query.bindValue(2, 0);
+    query.bindValue(3, std::numeric_limits<qint64>::max());
+    query.bindValue(4, to_user_id);
+    query.bindValue(5, from_user_id);
+    query.bindValue(6, 0);
+    query.bindValue(7, std::numeric_limits<qint64>::max());
+    query.bindValue(8, static_cast<qint64>(length) + 1);
+    // a failed read gives the reservation up, the conversation is reserved
+    // and read again on its next miss
+    if (!query.exec()) {
+      tail_cache_.cancel(from_user_id, to_user_id);
+      return;
+    }
+
+    QList<TailCache::message_t> tail;
+    bool complete = true;
+    while (query.next()) {
+      if (tail.size() == length) {
+        complete = false;
+        query.finish();
+        break;
+      }
+      tail.push_back({query.value(2).toULongLong(),
+                      query.value(0).toULongLong(), query.value(1).toString()});
+    }
+    if (query.lastError().isValid()) {
+      tail_cache_.cancel(from_user_id, to_user_id);
+      return;
+    }
+    std::reverse(tail.begin(), tail.end());
+
+    tail_cache_.fill(from_user_id, to_user_id, std::move(tail), complete);
+  }
+
+  // sql must be one of the sql:: constants, they double as cache keys
+  QSqlQuery& statement_(const char* sql) { return pool_.statement(sql); }
+
+  bool touchConversation_(const quint64 user_id, const quint64 peer_id,
+                          const quint64 message_id, const QString& preview,
+                          const quint64 unread) {
+    auto& query = statement_(sql::touch_conversation);
+    query.bindValue(0, user_id);
+    query.bindValue(1, peer_id);
+    query.bindValue(2, message_id);
+    query.bindValue(3, preview);
+    query.bindValue(4, unread);
+    return query.exec();
+  }
+
+  DB() = default;
+
   ~DB() = default;
 };
 
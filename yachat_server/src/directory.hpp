@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+
+#include "common.hpp"
+
+namespace db {
+
+struct directory_stats_t {
+  qsizetype users = 0;
+  qsizetype bytes = 0;  // approximate heap footprint of both maps
+};
+
+// username <-> user id of every user, loaded once on startup and kept up to
+// date by DB::createUser, so resolving a user never touches the database;
+// users created behind the server's back aren't seen until a restart
+class UserDirectory {
+ public:
+  bool load(const QSqlDatabase& sdb) {
+    QSqlQuery query(sdb);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT user_id, username FROM users")) {
+      return false;
+    }
+
+    QWriteLocker locker(&lock_);
+    ids_.clear();
+    usernames_.clear();
+    while (query.next()) {
+      insert_(query.value(0).toULongLong(), query.value(1).toString());
+    }
+
+    return true;
+  }
+
+  void add(const quint64 user_id, const QString& username) {
+    QWriteLocker locker(&lock_);
+    insert_(user_id, username);
+  }
+
+  common::result_t<quint64> id(const QString& username) const {
+    QReadLocker locker(&lock_);
+
+    const auto it = ids_.constFind(username);
+    if (it == ids_.cend()) {
+      return {};
+    }
+
+    common::result_t<quint64> id_monad;
+    id_monad.error = false;
+    id_monad.data = *it;
+
+    return id_monad;
+  }
+
+  common::result_t<QString> username(const quint64 user_id) const {
+    QReadLocker locker(&lock_);
+
+    const auto it = usernames_.constFind(user_id);
+    if (it == usernames_.cend()) {
+      return {};
+    }
+
+    common::result_t<QString> username_monad;
+    username_monad.error = false;
+    username_monad.data = *it;
+
+    return username_monad;
+  }
+
+  directory_stats_t stats() const {
+    QReadLocker locker(&lock_);
+
+    directory_stats_t stats;
+    stats.users = ids_.size();
+
+    // both maps share the same string data, it's counted once
+    for (auto it = ids_.cbegin(); it != ids_.cend(); ++it) {
+      stats.bytes += sizeof(QArrayData) + it.key().capacity() * sizeof(QChar);
+    }
+    stats.bytes += (ids_.capacity() + usernames_.capacity()) *
+                   (sizeof(QString) + sizeof(quint64));
+
+    return stats;
+  }
+
+ private:
+  mutable QReadWriteLock lock_;
+  QHash<QString, quint64> ids_;        // <username, user id>
+  QHash<quint64, QString> usernames_;  // <user id, username>
+
+  void insert_(const quint64 user_id, const QString& username) {
+    ids_.insert(username, user_id);
+    usernames_.insert(user_id, username);
+  }
+};
+
+};  // namespace db
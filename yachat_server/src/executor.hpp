@@ -0,0 +1,130 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QObject>
+#include <QPointer>
+#include <QThreadPool>
+#include <type_traits>
+#include <utility>
+
+#include "common.hpp"
+#include "trace.hpp"
+
+namespace db {
+
+struct executor_stats_t {
+  qint64 queue_depth = 0;      // jobs waiting for a free DB thread
+  qint64 running = 0;          // jobs being executed right now
+  quint64 completed = 0;       // jobs finished since startup
+  quint64 total_wait_us = 0;   // time the finished jobs spent in the queue
+  quint64 max_wait_us = 0;     // the longest time a job spent in the queue
+};
+
+// runs DB work on a dedicated pool of threads, so a slow query never stalls
+// the event loops serving the sockets
+class Executor {
+ public:
+  Executor() {
+    // every DB thread keeps its own SQLite connection, so threads are never
+    // retired and the connections are never reopened
+    pool_.setExpiryTimeout(-1);
+    pool_.setMaxThreadCount(1);
+  }
+
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  void setThreadCount(const int threads) {
+    pool_.setMaxThreadCount(qMax(threads, 1));
+  }
+
+  int threadCount() const { return pool_.maxThreadCount(); }
+
+  // runs job() on a DB thread and then continuation(result) on the thread of
+  // context; the continuation is dropped if context is gone by then. Both
+  // run as part of the traced request of the caller, if any
+  template <typename Job, typename Continuation>
+  void submit(QObject* context, Job job, Continuation continuation) {
+    using result_type = std::invoke_result_t<Job&>;
+
+    QElapsedTimer queued;
+    queued.start();
+    queue_depth_.fetchAndAddRelaxed(1);
+
+    const auto trace_id = trace::current();
+    const auto queued_ns = trace_id ? trace::tracer.now() : 0;
+
+    QPointer<QObject> guard(context);
+    pool_.start([this, queued, trace_id, queued_ns, guard, job = std::move(job),
+                 continuation = std::move(continuation)]() mutable {
+      const auto wait_us = static_cast<quint64>(queued.nsecsElapsed() / 1000);
+      queue_depth_.fetchAndAddRelaxed(-1);
+      running_.fetchAndAddRelaxed(1);
+      recordWait_(wait_us);
+
+      const trace::Scope scope(trace_id);
+      if (trace_id) {
+        trace::tracer.complete(trace_id, "db queue", queued_ns,
+                               trace::tracer.now());
+      }
+
+      result_type result = [&]() {
+        const trace::Span span("db query");
+        return job();
+      }();
+
+      running_.fetchAndAddRelaxed(-1);
+      completed_.fetchAndAddRelaxed(1);
+
+      if (!guard) {
+        return;
+      }
+
+      QMetaObject::invokeMethod(
+          guard.data(),
+          [trace_id, continuation = std::move(continuation),
+           result = std::move(result)]() mutable {
+            const trace::Scope scope(trace_id);
+            continuation(std::move(result));
+          },
+          Qt::QueuedConnection);
+    });
+  }
+
+  // blocks until every queued job is finished, used on shutdown
+  void waitForDone() { pool_.waitForDone(); }
+
+  executor_stats_t stats() const {
+    executor_stats_t stats;
+    stats.queue_depth = queue_depth_.loadRelaxed();
+    stats.running = running_.loadRelaxed();
+    stats.completed = completed_.loadRelaxed();
+    stats.total_wait_us = total_wait_us_.loadRelaxed();
+    stats.max_wait_us = max_wait_us_.loadRelaxed();
+    return stats;
+  }
+
+ private:
+  QThreadPool pool_;
+
+  QAtomicInteger<qint64> queue_depth_;
+  QAtomicInteger<qint64> running_;
+  QAtomicInteger<quint64> completed_;
+  QAtomicInteger<quint64> total_wait_us_;
+  QAtomicInteger<quint64> max_wait_us_;
+
+  void recordWait_(const quint64 wait_us) {
+    total_wait_us_.fetchAndAddRelaxed(wait_us);
+
+    auto max_wait_us = max_wait_us_.loadRelaxed();
+    while (wait_us > max_wait_us &&
+           !max_wait_us_.testAndSetRelaxed(max_wait_us, wait_us, max_wait_us)) {
+    }
+  }
+};
+
+Executor executor;
+
+};  // namespace db
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QtEndian>
+
+#include "common.hpp"
+
+namespace frame {
+
+// every packet on the wire is prefixed with its payload length
+// (quint32, big-endian)
+constexpr qsizetype header_size = sizeof(quint32);
+constexpr quint32 max_payload_size = 16 * 1024 * 1024;
+
+// buffers bigger than this are released once fully consumed, so one huge
+// frame doesn't pin its memory for the rest of the connection lifetime
+constexpr qsizetype max_idle_capacity = 256 * 1024;
+
+// a payload the peer would reject, see Decoder::next(); such a frame must
+// not be sent, the peer would drop the connection
+bool oversized(const qsizetype payload_size) {
+  return payload_size > static_cast<qsizetype>(max_payload_size);
+}
+
+QByteArray encode(const QByteArray& payload) {
+  QByteArray frame;
+  frame.reserve(header_size + payload.size());
+  frame.resize(header_size);
+  qToBigEndian<quint32>(static_cast<quint32>(payload.size()), frame.data());
+  frame.append(payload);
+  return frame;
+}
+
+// appends the frame to an already filled output buffer without the temporary
+void encodeTo(QByteArray& out, const QByteArray& payload) {
+  const auto offset = out.size();
+  out.resize(offset + header_size);
+  qToBigEndian<quint32>(static_cast<quint32>(payload.size()),
+                        out.data() + offset);
+  out.append(payload);
+}
+
+// for payloads written in place: reserves the header, the payload is then
+// appended to out and endFrame() fills the header in
+qsizetype beginFrame(QByteArray& out) {
+  const auto offset = out.size();
+  out.resize(offset + header_size);
+  return offset;
+}
+
+// returns false if the payload is oversized(), the frame is then left
+// unfinished and must be discarded
+bool endFrame(QByteArray& out, const qsizetype offset) {
+  const auto payload_size = out.size() - offset - header_size;
+  if (oversized(payload_size)) {
+    return false;
+  }
+
+  qToBigEndian<quint32>(static_cast<quint32>(payload_size),
+                        out.data() + offset);
+  return true;
+}
+
+// incremental decoder with a reusable receive buffer, one per connection
+class Decoder {
+ public:
+  // moves everything the device has buffered into the receive buffer,
+  // returns the number of bytes read or -1 on a read error
+  qint64 readFrom(QIODevice* device) {
+    compact_();
+
+    const auto available = device->bytesAvailable();
+    if (available <= 0) {
+      return 0;
+    }
+
+    const auto old_size = buffer_.size();
+    buffer_.resize(old_size + available);
+    const auto read = device->read(buffer_.data() + old_size, available);
+    buffer_.resize(old_size + qMax<qint64>(read, 0));
+
+    return read;
+  }
+
+  // for callers that already have the bytes at hand
+  void append(const QByteArray& data) {
+    compact_();
+    buffer_.append(data);
+  }
+
+  // extracts the next complete frame payload; the returned data refers to
+  // the receive buffer and stays valid until the next readFrom()/append()
+  common::result_t<QByteArray> next() {
+    if (malformed_ || buffered() < header_size) {
+      return {};
+    }
+
+    const auto payload_size =
+        qFromBigEndian<quint32>(buffer_.constData() + offset_);
+    if (payload_size > max_payload_size) {
+      malformed_ = true;
+      return {};
+    }
+
+    if (buffered() < header_size + payload_size) {
+      return {};
+    }
+
+    common::result_t<QByteArray> frame_monad;
+    frame_monad.error = false;
+    frame_monad.data = QByteArray::fromRawData(
+        buffer_.constData() + offset_ + header_size, payload_size);
+
+    offset_ += header_size + payload_size;
+
+    return frame_monad;
+  }
+
+  // the peer announced a frame bigger than max_payload_size, the stream
+  // can't be resynchronized and the connection should be dropped
+  bool malformed() const { return malformed_; }
+
+  qsizetype buffered() const { return buffer_.size() - offset_; }
+
+ private:
+  QByteArray buffer_;
+  qsizetype offset_ = 0;  // start of the first unconsumed byte
+  bool malformed_ = false;
+
+  void compact_() {
+    if (offset_ == 0) {
+      return;
+    }
+
+    if (offset_ == buffer_.size()) {
+      buffer_.resize(0);  // keeps the capacity for the next read
+      if (buffer_.capacity() > max_idle_capacity) {
+        buffer_.squeeze();
+      }
+    } else {
+      buffer_.remove(0, offset_);
+    }
+
+    offset_ = 0;
+  }
+};
+
+};  // namespace frame
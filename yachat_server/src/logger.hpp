@@ -0,0 +1,262 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QScopedPointer>
+#include <QString>
+#include <QThread>
+#include <memory>
+#include <utility>
+
+namespace common {
+
+struct logger_stats_t {
+  quint64 written = 0;  // lines handed to the output since startup
+  quint64 dropped = 0;  // lines lost because the queue was full
+  quint64 batches = 0;  // journal writes, each one carries many lines
+};
+
+// lines are pushed by any thread into a bounded lock-free queue (a
+// sequence-numbered ring, as in Vyukov's MPMC queue) and written by one
+// background thread, which appends whole batches to the journal; a full
+// queue drops the line and counts it instead of blocking the caller. Fatal
+// lines and lines logged while the logger isn't running are written on the
+// spot
+class Logger {
+ public:
+  static constexpr quint64 capacity = 8192;  // a power of two
+  static constexpr unsigned long flush_interval_ms = 20;
+
+  Logger() : slots_(new slot_t[capacity]) {
+    for (quint64 i = 0; i < capacity; ++i) {
+      slots_[i].sequence.storeRelaxed(i);
+    }
+  }
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  ~Logger() { stop(); }
+
+  // journal_path may be empty, then lines are only printed
+  void start(const QString& journal_path) {
+    if (thread_) {
+      return;
+    }
+
+    journal_.setFileName(journal_path);
+    if (!journal_path.isEmpty() &&
+        !journal_.open(QIODevice::WriteOnly | QIODevice::Text |
+                       QIODevice::Append)) {
+      qWarning().noquote() << "[LOGGER] Can't open the journal" << journal_path;
+    }
+
+    running_.storeRelease(1);
+    thread_.reset(QThread::create([this]() { run_(); }));
+    thread_->setObjectName("logger");
+    thread_->start();
+  }
+
+  // writes what's queued and joins the logger thread
+  void stop() {
+    if (!thread_) {
+      return;
+    }
+
+    running_.storeRelease(0);
+    thread_->wait();
+    thread_.reset();
+    journal_.close();
+  }
+
+  // lines less severe than type are dropped before they are formatted
+  void setLevel(const QtMsgType type) { level_.storeRelaxed(severity_(type)); }
+
+  bool enabled(const QtMsgType type) const {
+    return severity_(type) >= level_.loadRelaxed();
+  }
+
+  void push(const QtMsgType type, const QString& msg) {
+    line_t line{QDateTime::currentMSecsSinceEpoch(), type, msg};
+    if (type == QtFatalMsg || !running_.loadAcquire()) {
+      write_(line);
+      return;
+    }
+
+    if (!enqueue_(std::move(line))) {
+      dropped_.fetchAndAddRelaxed(1);
+    }
+  }
+
+  logger_stats_t stats() const {
+    logger_stats_t stats;
+    stats.written = written_.loadRelaxed();
+    stats.dropped = dropped_.loadRelaxed();
+    stats.batches = batches_.loadRelaxed();
+    return stats;
+  }
+
+ private:
+  struct line_t {
+    qint64 time_ms = 0;
+    QtMsgType type = QtDebugMsg;
+    QString msg;
+  };
+
+  // a slot is free for the producer at position p while its sequence is p
+  // and holds a line for the consumer at position p once it's p + 1
+  struct slot_t {
+    QAtomicInteger<quint64> sequence;
+    line_t line;
+  };
+
+  std::unique_ptr<slot_t[]> slots_;
+  QAtomicInteger<quint64> head_;  // next position to push, shared
+  quint64 tail_ = 0;              // next position to pop, logger thread only
+
+  QScopedPointer<QThread> thread_;
+  QAtomicInt running_;
+  QAtomicInt level_;
+  QFile journal_;
+
+  QAtomicInteger<quint64> written_;
+  QAtomicInteger<quint64> dropped_;
+  QAtomicInteger<quint64> batches_;
+
+  static int severity_(const QtMsgType type) {
+    switch (type) {
+      case QtDebugMsg:
+        return 0;
+      case QtInfoMsg:
+        return 1;
+      case QtWarningMsg:
+        return 2;
+      case QtCriticalMsg:
+        return 3;
+      case QtFatalMsg:
+        return 4;
+    }
+    return 0;
+  }
+
+  bool enqueue_(line_t&& line) {
+    auto position = head_.loadRelaxed();
+    forever {
+      auto& slot = slots_[position & (capacity - 1)];
+      const auto sequence = slot.sequence.loadAcquire();
+      const auto diff =
+          static_cast<qint64>(sequence) - static_cast<qint64>(position);
+      if (diff == 0) {
+        if (head_.testAndSetRelaxed(position, position + 1, position)) {
+          slot.line = std::move(line);
+          slot.sequence.storeRelease(position + 1);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // the consumer is a whole ring behind
+      } else {
+        position = head_.loadRelaxed();
+      }
+    }
+  }
+
+  bool dequeue_(line_t& line) {
+    auto& slot = slots_[tail_ & (capacity - 1)];
+    if (slot.sequence.loadAcquire() != tail_ + 1) {
+      return false;
+    }
+
+    line = std::move(slot.line);
+    slot.line = {};
+    slot.sequence.storeRelease(tail_ + capacity);
+    ++tail_;
+    return true;
+  }
+
+  void run_() {
+    forever {
+      // read before draining, so nothing pushed before stop() is left behind
+      const bool running = running_.loadAcquire();
+      if (!drain_() && !running) {
+        return;
+      }
+      if (running) {
+        QThread::msleep(flush_interval_ms);
+      }
+    }
+  }
+
+  // writes every queued line, the journal gets them in one write
+  bool drain_() {
+    QByteArray batch;
+    line_t line;
+    while (dequeue_(line)) {
+      print_(line);
+      batch += format_(line);
+    }
+    if (batch.isEmpty()) {
+      return false;
+    }
+
+    if (journal_.isOpen()) {
+      journal_.write(batch);
+      journal_.flush();
+    }
+    batches_.fetchAndAddRelaxed(1);
+    return true;
+  }
+
+  void write_(const line_t& line) {
+    if (journal_.isOpen() && line.type == QtFatalMsg) {
+      journal_.write(format_(line));
+      journal_.flush();
+    }
+    print_(line);
+  }
+
+  QByteArray format_(const line_t& line) const {
+    static constexpr const char* levels[] = {"DEBUG", "INFO", "WARNING",
+                                             "CRITICAL", "FATAL"};
+    return (QDateTime::fromMSecsSinceEpoch(line.time_ms)
+                .toString("(yyyy-MM-dd hh:mm:ss.zzz) ") +
+            levels[severity_(line.type)] + " " + line.msg + "\n")
+        .toUtf8();
+  }
+
+  void print_(const line_t& line) {
+    written_.fetchAndAddRelaxed(1);
+    switch (line.type) {
+      case QtDebugMsg: {
+        qDebug().noquote() << line.msg;
+        break;
+      };
+      case QtWarningMsg: {
+        qWarning().noquote() << line.msg;
+        break;
+      };
+      case QtCriticalMsg: {
+        qCritical().noquote() << line.msg;
+        break;
+      };
+      case QtFatalMsg: {
+        qFatal("%s", line.msg.toStdString().c_str());
+        break;
+      };
+      case QtInfoMsg: {
+        qInfo().noquote() << line.msg;
+        break;
+      };
+      default: {
+        qDebug().noquote() << line.msg;
+        break;
+      };
+    }
+  }
+};
+
+Logger logger;
+
+};  // namespace common
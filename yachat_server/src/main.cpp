@@ -7,14 +7,28 @@
 
 #define JOURNAL "journal.txt"
 
+#include "config.hpp"
 #include "server.hpp"
 
 int main(int argc, char *argv[]) {
   QCoreApplication a(argc, argv);
 
-  server::Server server(1234, &a);
+  const auto server_config = config::parse(a);
+
+  common::logger.setLevel(server_config.log_level);
+  common::logger.start(JOURNAL);
+  trace::tracer.start(server_config.trace_rate, server_config.trace_path);
+
+  if (!db::db.open(server_config.db_path)) {
+    return EXIT_FAILURE;
+  }
+
+  server::Server server(server_config, &a);
   common::logAll(QtDebugMsg, "[MAIN] Server started on port " +
-                                 QString::number(server.serverPort()));
+                                 QString::number(server.serverPort()) +
+                                 " with " +
+                                 QString::number(server_config.workers) +
+                                 " worker thread(s)");
 
   return a.exec();
 }
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QList>
+#include <QString>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <functional>
+#include <iterator>
+
+#include "common.hpp"
+#include "packet.hpp"
+
+namespace metrics {
+
+// upper bounds of the latency buckets in microseconds, the last bucket has
+// none (+Inf)
+constexpr quint64 latency_bounds_us[] = {
+    100,   250,   500,    1000,   2500,   5000,    10000,
+    25000, 50000, 100000, 250000, 500000, 1000000, 2500000};
+constexpr int latency_buckets = std::size(latency_bounds_us) + 1;
+
+// a request being served, copied into its continuations and recorded with
+// the reply that answers it
+struct request_t {
+  packet::packet_t::header_t::command_t command{};
+  QString request_id;
+  QElapsedTimer timer;
+};
+
+request_t start(const packet::packet_t::header_t& header) {
+  request_t request;
+  request.command = header.command;
+  request.request_id = header.request_id;
+  request.timer.start();
+  return request;
+}
+
+// a Prometheus histogram, the buckets are counted apart and summed up when
+// they are rendered
+class Histogram {
+ public:
+  void record(const quint64 us) {
+    int bucket = 0;
+    while (bucket < latency_buckets - 1 && us > latency_bounds_us[bucket]) {
+      ++bucket;
+    }
+    buckets_[bucket].fetchAndAddRelaxed(1);
+    sum_us_.fetchAndAddRelaxed(us);
+    count_.fetchAndAddRelaxed(1);
+  }
+
+  quint64 count() const { return count_.loadRelaxed(); }
+
+  // name_bucket, name_sum and name_count lines in seconds, labels are the
+  // ones shared by every line
+  void render(QByteArray& out, const QByteArray& name,
+              const QByteArray& labels) const {
+    quint64 cumulative = 0;
+    for (int bucket = 0; bucket < latency_buckets; ++bucket) {
+      cumulative += buckets_[bucket].loadRelaxed();
+      const auto le =
+          bucket < latency_buckets - 1
+              ? QByteArray::number(latency_bounds_us[bucket] / 1e6, 'g', 6)
+              : QByteArray("+Inf");
+      out += name + "_bucket{" + labels + ",le=\"" + le + "\"} " +
+             QByteArray::number(cumulative) + "\n";
+    }
+    out += name + "_sum{" + labels + "} " +
+           QByteArray::number(sum_us_.loadRelaxed() / 1e6, 'g', 12) + "\n";
+    out += name + "_count{" + labels + "} " +
+           QByteArray::number(count_.loadRelaxed()) + "\n";
+  }
+
+ private:
+  QAtomicInteger<quint64> buckets_[latency_buckets];
+  QAtomicInteger<quint64> sum_us_;
+  QAtomicInteger<quint64> count_;
+};
+
+// a value sampled when the metrics are scraped
+struct gauge_t {
+  QByteArray name;
+  QByteArray help;
+  qint64 value = 0;
+};
+
+// per-command counters and latency histograms, recording only takes
+// relaxed atomic increments so it stays on in production
+class Registry {
+ public:
+  // every command has its slot, the last one counts the unknown ones
+  static constexpr int commands =
+      static_cast<int>(packet::packet_t::header_t::command_t::READ) + 2;
+
+  void record(const request_t& request, const bool ok) {
+    auto& command = commands_[index_(request.command)];
+    (ok ? command.ok : command.failed).fetchAndAddRelaxed(1);
+    command.latency.record(
+        static_cast<quint64>(request.timer.nsecsElapsed() / 1000));
+  }
+
+  static const char* name(const packet::packet_t::header_t::command_t command) {
+    return name_(index_(command));
+  }
+
+  void connected() { sockets_.fetchAndAddRelaxed(1); }
+  void disconnected() { sockets_.fetchAndAddRelaxed(-1); }
+
+  // the Prometheus text format (version 0.0.4) of everything recorded, with
+  // gauges sampled by the caller; commands never received are left out
+  QByteArray render(const QList<gauge_t>& gauges) const {
+    QByteArray out;
+
+    out +=
+        "# HELP yachat_requests_total Requests answered, by command and "
+        "status.\n"
+        "# TYPE yachat_requests_total counter\n";
+    for (int i = 0; i < commands; ++i) {
+      if (commands_[i].latency.count() == 0) {
+        continue;
+      }
+      const auto label = QByteArray("command=\"") + name_(i) + "\"";
+      out += "yachat_requests_total{" + label + ",status=\"ok\"} " +
+             QByteArray::number(commands_[i].ok.loadRelaxed()) + "\n";
+      out += "yachat_requests_total{" + label + ",status=\"fail\"} " +
+             QByteArray::number(commands_[i].failed.loadRelaxed()) + "\n";
+    }
+
+    out +=
+        "# HELP yachat_request_duration_seconds Time from a request being "
+        "parsed to its reply being queued, by command.\n"
+        "# TYPE yachat_request_duration_seconds histogram\n";
+    for (int i = 0; i < commands; ++i) {
+      if (commands_[i].latency.count() == 0) {
+        continue;
+      }
+      commands_[i].latency.render(out, "yachat_request_duration_seconds",
+                                  QByteArray("command=\"") + name_(i) + "\"");
+    }
+
+    auto all_gauges = gauges;
+    all_gauges.push_front({"yachat_connected_sockets",
+                           "Client connections open.", sockets_.loadRelaxed()});
+    for (const auto& gauge : all_gauges) {
+      out += "# HELP " + gauge.name + " " + gauge.help + "\n";
+      out += "# TYPE " + gauge.name + " gauge\n";
+      out += gauge.name + " " + QByteArray::number(gauge.value) + "\n";
+    }
+
+    return out;
+  }
+
+ private:
+  struct command_metrics_t {
+    QAtomicInteger<quint64> ok;
+    QAtomicInteger<quint64> failed;
+    Histogram latency;
+  };
+
+  command_metrics_t commands_[commands];
+  QAtomicInteger<qint64> sockets_;
+
+  static int index_(const packet::packet_t::header_t::command_t command) {
+    const auto index = static_cast<int>(command);
+    return index < commands - 1 ? index : commands - 1;
+  }
+
+  static const char* name_(const int index) {
+    // in command_t order
+    static constexpr const char* names[commands] = {
+        "register", "login",   "sendmsg",  "getmsgs",  "notify", "logout",
+        "status",   "auth",    "msgs",     "getallmsgs", "allmsgs",
+        "setcodec", "getinbox", "inbox",   "read",     "unknown"};
+    return names[index];
+  }
+} registry;
+
+// serves scrape() to GET /metrics on localhost, one request per connection
+class Endpoint : public QTcpServer {
+ public:
+  explicit Endpoint(std::function<QByteArray()> scrape,
+                    QObject* parent = nullptr)
+      : QTcpServer(parent), scrape_(std::move(scrape)) {
+    connect(this, &QTcpServer::newConnection, this, [this]() {
+      while (auto socket = nextPendingConnection()) {
+        serve_(socket);
+      }
+    });
+  }
+
+  bool start(const quint16 port) {
+    if (!listen(QHostAddress::LocalHost, port)) {
+      common::logAll(QtWarningMsg,
+                     "[METRICS] Can't listen on port " + QString::number(port) +
+                         ": " + errorString());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  std::function<QByteArray()> scrape_;
+
+  void serve_(QTcpSocket* socket) {
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    connect(socket, &QTcpSocket::readyRead, socket, [this, socket]() {
+      // only the request line matters, the rest of the request is ignored
+      if (!socket->canReadLine()) {
+        return;
+      }
+      const auto request_line = socket->readLine();
+
+      QByteArray response;
+      if (request_line.startsWith("GET /metrics ")) {
+        const auto body = scrape_();
+        response =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " +
+            QByteArray::number(body.size()) + "\r\n\r\n" + body;
+      } else {
+        response =
+            "HTTP/1.0 404 Not Found\r\n"
+            "Content-Length: 0\r\n\r\n";
+      }
+
+      socket->write(response);
+      socket->disconnectFromHost();
+    });
+  }
+};
+
+};  // namespace metrics
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QString>
+#include <QStringList>
+
+#include "common.hpp"
+
+namespace migration {
+
+// the schema version of a database is kept in PRAGMA user_version, a
+// migration moves it from version - 1 to version
+struct migration_t {
+  int version;
+  QString description;
+  QStringList statements;
+};
+
+// append only, an applied migration is never changed
+const QList<migration_t>& all() {
+  static const QList<migration_t> migrations = {
+      {1,
+       "initial schema",
+       {"CREATE TABLE IF NOT EXISTS \"users\" ("
+        "\"user_id\" INTEGER NOT NULL, "
+        "\"username\" TEXT NOT NULL UNIQUE, "
+        "\"password\" TEXT NOT NULL, "
+        "\"is_deleted\" INTEGER NOT NULL DEFAULT 0, "
+        "PRIMARY KEY(\"user_id\" AUTOINCREMENT))",
+        "CREATE TABLE IF NOT EXISTS \"messages\" ("
+        "\"message_id\" INTEGER NOT NULL, "
+        "\"from_user_id\" INTEGER NOT NULL, "
+        "\"to_user_id\" INTEGER NOT NULL, "
+        "\"message\" TEXT NOT NULL, "
+        "PRIMARY KEY(\"message_id\" AUTOINCREMENT))"}},
+      // one index per direction of a conversation, both already ordered by
+      // message_id, so a conversation is an index range instead of a scan
+      {2,
+       "conversation indexes",
+       {"CREATE INDEX IF NOT EXISTS messages_from_to ON messages "
+        "(from_user_id, to_user_id, message_id)",
+        "CREATE INDEX IF NOT EXISTS messages_to_from ON messages "
+        "(to_user_id, from_user_id, message_id)"}},
+      // every message of a user in message_id order, so a delta sync reads
+      // only the rows past its high-water mark
+      {3,
+       "per-user message indexes",
+       {"CREATE INDEX IF NOT EXISTS messages_from ON messages "
+        "(from_user_id, message_id)",
+        "CREATE INDEX IF NOT EXISTS messages_to ON messages "
+        "(to_user_id, message_id)"}},
+      // one row per user and peer with the last message and the messages
+      // received since the user last read the conversation, kept up to date
+      // by DB::createMessage; existing conversations start with none unread
+      {4,
+       "conversation summaries",
+       {"CREATE TABLE IF NOT EXISTS \"conversations\" ("
+        "\"user_id\" INTEGER NOT NULL, "
+        "\"peer_id\" INTEGER NOT NULL, "
+        "\"last_message_id\" INTEGER NOT NULL, "
+        "\"last_message\" TEXT NOT NULL, "
+        "\"unread\" INTEGER NOT NULL DEFAULT 0, "
+        "PRIMARY KEY(\"user_id\", \"peer_id\")) WITHOUT ROWID",
+        // the bare columns come from the row with the highest message_id
+        "INSERT OR IGNORE INTO conversations (user_id, peer_id, "
+        "last_message_id, last_message) "
+        "SELECT user_id, peer_id, MAX(message_id), substr(message, 1, 100) "
+        "FROM (SELECT from_user_id AS user_id, to_user_id AS peer_id, "
+        "message_id, message FROM messages "
+        "UNION ALL "
+        "SELECT to_user_id, from_user_id, message_id, message FROM messages "
+        "WHERE from_user_id != to_user_id) "
+        "GROUP BY user_id, peer_id"}},
+  };
+  return migrations;
+}
+
+int latest() { return all().back().version; }
+
+int version(const QSqlDatabase& sdb) {
+  QSqlQuery query(sdb);
+  if (!query.exec("PRAGMA user_version") || !query.next()) {
+    return -1;
+  }
+  return query.value(0).toInt();
+}
+
+// applies every migration newer than the database up to target_version, each
+// one in its own transaction together with the version bump
+bool run(QSqlDatabase sdb, const int target_version = latest()) {
+  const auto current_version = version(sdb);
+  if (current_version < 0) {
+    common::logAll(QtCriticalMsg,
+                   "[MIGRATION] Can't read the schema version: " +
+                       sdb.lastError().text());
+    return false;
+  }
+
+  if (current_version > latest()) {
+    common::logAll(QtWarningMsg,
+                   "[MIGRATION] Database schema version " +
+                       QString::number(current_version) +
+                       " is newer than the server knows of (" +
+                       QString::number(latest()) + ")");
+    return true;
+  }
+
+  for (const auto& migration : all()) {
+    if (migration.version <= current_version ||
+        migration.version > target_version) {
+      continue;
+    }
+
+    if (!sdb.transaction()) {
+      common::logAll(QtCriticalMsg, "[MIGRATION] Can't begin transaction: " +
+                                        sdb.lastError().text());
+      return false;
+    }
+
+    QSqlQuery query(sdb);
+    for (const auto& statement : migration.statements) {
+      if (!query.exec(statement)) {
+        common::logAll(QtCriticalMsg,
+                       "[MIGRATION] Migration " +
+                           QString::number(migration.version) + " (" +
+                           migration.description +
+                           ") failed: " + query.lastError().text());
+        sdb.rollback();
+        return false;
+      }
+    }
+
+    // PRAGMA doesn't take bound parameters
+    if (!query.exec("PRAGMA user_version = " +
+                    QString::number(migration.version)) ||
+        !sdb.commit()) {
+      common::logAll(QtCriticalMsg,
+                     "[MIGRATION] Can't commit migration " +
+                         QString::number(migration.version) + ": " +
+                         sdb.lastError().text());
+      sdb.rollback();
+      return false;
+    }
+
+    common::logAll(QtDebugMsg, "[MIGRATION] Applied migration " +
+                                   QString::number(migration.version) + " (" +
+                                   migration.description + ")");
+  }
+
+  return true;
+}
+
+};  // namespace migration
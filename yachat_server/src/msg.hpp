@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QHash>
+#include <QObject>
 #include <cstdlib>
 #include <ctime>
 
@@ -8,107 +9,221 @@
 #include "common.hpp"
 #include "db.hpp"
 #include "packet.hpp"
+#include "writer.hpp"
 
 namespace msg {
 
+// validates the message and queues it on db::writer, returns false if it
+// can't be sent; done(committed, message_id) is called on the thread of
+// context once the message's batch is committed
+template <typename Continuation>
 bool sendMsg(const QString& session_id, const QString& sender_username,
-             const QString& target_username, const QString& message) {
+             const QString& target_username, const QString& message,
+             QObject* context, Continuation done) {
   if (!auth::isAuthorized(session_id, sender_username)) {
-    common::logAll(QtDebugMsg, "[MSG | SEND MESSAGE] Unathorized");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | SEND MESSAGE] Unathorized";
+    });
     return false;
   }
 
-  if (!db::db.getUserExists(target_username)) {
-    common::logAll(QtDebugMsg, "[MSG | SEND MESSAGE] User " + target_username +
-                                   " doesn't exist");
+  // the id lookup doubles as the existence check
+  const auto target_user_id_monad = db::db.getUserId(target_username);
+  if (target_user_id_monad.error) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | SEND MESSAGE] User " + target_username + " doesn't exist";
+    });
     return false;
   }
 
   const auto sender_user_id = db::db.getUserId(sender_username).unwrap();
-  const auto target_user_id = db::db.getUserId(target_username).unwrap();
+  const auto target_user_id = target_user_id_monad.data;
+
+  db::writer.submit(
+      context, sender_user_id, target_user_id, message,
+      [target_username, done = std::move(done)](
+          const bool committed, const quint64 message_id) mutable {
+        if (committed) {
+          common::logAll(QtDebugMsg, [&]() {
+            return "[MSG | SEND MESSAGE] Message to user " + target_username +
+                   " sent";
+          });
+        } else {
+          common::logAll(QtDebugMsg, [&]() {
+            return "[MSG | SEND MESSAGE] Can't send message to user " +
+                   target_username;
+          });
+        }
+        done(committed, message_id);
+      });
 
-  if (!db::db.createMessage(sender_user_id, target_user_id, message)) {
-    common::logAll(
-        QtDebugMsg,
-        "[MSG | SEND MESSAGE] Can't send message to user " + target_username);
-    return false;
+  return true;
+}
+
+// streams one page of the conversation of username with target_username to
+// visitor, the monad holds the cursor of the next page
+common::result_t<quint64> visitMsgs(const QString& session_id,
+                                    const QString& username,
+                                    const QString& target_username,
+                                    const db::DB::msg_visitor_t& visitor,
+                                    const db::page_t& page = {}) {
+  if (!auth::isAuthorized(session_id, username)) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET MESSAGES] Unathorized";
+    });
+    return {};
   }
 
-  common::logAll(QtDebugMsg, "[MSG | SEND MESSAGE] Message to user " +
-                                 target_username + " sent");
+  const auto target_user_id_monad = db::db.getUserId(target_username);
+  if (target_user_id_monad.error) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET MESSAGES] User " + target_username + " doesn't exist";
+    });
+    return {};
+  }
 
-  return true;
+  const auto user_id = db::db.getUserId(username).unwrap();
+  const auto target_user_id = target_user_id_monad.data;
+
+  const auto next_monad =
+      db::db.visitMsgs(user_id, target_user_id, visitor, page);
+  if (next_monad.error) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET MESSAGES] Can't get messages from users " + username +
+             " and " + target_username;
+    });
+    return {};
+  }
+
+  common::logAll(QtDebugMsg, [&]() {
+    return "[MSG | GET MESSAGES] Messages received from users " + username +
+           " and " + target_username;
+  });
+
+  return next_monad;
 }
 
 common::result_t<packet::packet_t::payload_t::target_t> getMsgs(
     const QString& session_id, const QString& username,
-    const QString& target_username) {
-  if (!auth::isAuthorized(session_id, username)) {
-    common::logAll(QtDebugMsg, "[MSG | GET MESSAGES] Unathorized");
+    const QString& target_username, const db::page_t& page = {}) {
+  common::result_t<packet::packet_t::payload_t::target_t> ret;
+  ret.data.username = target_username;
+  const auto next_monad =
+      visitMsgs(session_id, username, target_username,
+                [&](const QString& side, const QString& message) {
+                  ret.data.messages.push_back({side, message});
+                },
+                page);
+  if (next_monad.error) {
     return {};
   }
 
-  if (!db::db.getUserExists(target_username)) {
-    common::logAll(QtDebugMsg, "[MSG | GET MESSAGES] User " + target_username +
-                                   " doesn't exist");
+  ret.data.next = next_monad.data;
+  ret.error = false;
+  return ret;
+}
+
+// streams every conversation of username to visitor, one after another;
+// with since only the messages newer than it, the monad holds the new
+// high-water mark
+common::result_t<quint64> visitAllMsgs(
+    const QString& session_id, const QString& username,
+    const db::DB::conversation_msg_visitor_t& visitor,
+    const quint64 since = 0) {
+  if (!auth::isAuthorized(session_id, username)) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET ALL MESSAGES] Unathorized";
+    });
     return {};
   }
 
-  QList<packet::packet_t::payload_t::target_t::message_t> messages;
-
   const auto user_id = db::db.getUserId(username).unwrap();
-  const auto target_user_id = db::db.getUserId(target_username).unwrap();
 
-  const auto msgs_monad = db::db.getMsgs(user_id, target_user_id);
-  if (msgs_monad.error) {
-    common::logAll(QtDebugMsg,
-                   "[MSG | GET MESSAGES] Can't get messages from users " +
-                       username + " and " + target_username);
+  const auto last_monad = db::db.visitAllMsgs(user_id, visitor, since);
+  if (last_monad.error) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET ALL MESSAGES] Can't get all messages with user " +
+             username;
+    });
     return {};
   }
 
-  common::logAll(QtDebugMsg,
-                 "[MSG | GET MESSAGES] Messages received from users " +
-                     username + " and " + target_username);
+  common::logAll(QtDebugMsg, [&]() {
+    return "[MSG | GET ALL MESSAGES] All messages received with user " +
+           username;
+  });
 
+  return last_monad;
+}
+
+common::result_t<packet::packet_t::payload_t::target_t> getAllMsgs(
+    const QString& session_id, const QString& username,
+    const quint64 since = 0) {
   common::result_t<packet::packet_t::payload_t::target_t> ret;
-  ret.data.username = target_username;
-  ret.data.messages = msgs_monad.data;
-  ret.error = false;
+  const auto last_monad = visitAllMsgs(
+      session_id, username,
+      [&](const QString& target_username, const QString& side,
+          const QString& message) {
+        ret.data.all_messages[target_username].push_back({side, message});
+      },
+      since);
+  if (last_monad.error) {
+    return {};
+  }
 
+  ret.data.last = last_monad.data;
+  ret.error = false;
   return ret;
 }
 
-common::result_t<packet::packet_t::payload_t::target_t> getAllMsgs(
-    const QString& session_id, const QString& username) {
+// the conversations of username, the most recent one first
+common::result_t<QList<packet::packet_t::payload_t::target_t::conversation_t>>
+getInbox(const QString& session_id, const QString& username) {
   if (!auth::isAuthorized(session_id, username)) {
-    common::logAll(QtDebugMsg, "[MSG | GET ALL MESSAGES] Unathorized");
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET INBOX] Unathorized";
+    });
     return {};
   }
 
-  QHash<QString, QList<packet::packet_t::payload_t::target_t::message_t>>
-      all_messages;
-
   const auto user_id = db::db.getUserId(username).unwrap();
 
-  const auto msgs_monad = db::db.getAllMsgs(user_id);
-  if (msgs_monad.error) {
-    common::logAll(
-        QtDebugMsg,
-        "[MSG | GET ALL MESSAGES] Can't get all messages with user " +
-            username);
+  const auto inbox_monad = db::db.getInbox(user_id);
+  if (inbox_monad.error) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | GET INBOX] Can't get the inbox of user " + username;
+    });
     return {};
   }
 
-  common::logAll(
-      QtDebugMsg,
-      "[MSG | GET ALL MESSAGES] All messages received with user " + username);
+  return inbox_monad;
+}
 
-  common::result_t<packet::packet_t::payload_t::target_t> ret;
-  ret.data.all_messages = msgs_monad.data;
-  ret.error = false;
+// queues the read mark on db::writer, returns false if it's rejected;
+// done(committed) is called on the thread of context once it's committed
+template <typename Continuation>
+bool readConversation(const QString& session_id, const QString& username,
+                      const QString& target_username, QObject* context,
+                      Continuation done) {
+  if (!auth::isAuthorized(session_id, username)) {
+    common::logAll(QtDebugMsg, [&]() { return "[MSG | READ] Unathorized"; });
+    return false;
+  }
 
-  return ret;
+  const auto target_user_id_monad = db::db.getUserId(target_username);
+  if (target_user_id_monad.error) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[MSG | READ] User " + target_username + " doesn't exist";
+    });
+    return false;
+  }
+
+  const auto user_id = db::db.getUserId(username).unwrap();
+
+  db::writer.submitRead(context, user_id, target_user_id_monad.data,
+                        std::move(done));
+
+  return true;
 }
 
 };  // namespace msg
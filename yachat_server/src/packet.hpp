@@ -1,11 +1,13 @@
 #pragma once
 
+#include <QByteArrayView>
 #include <QHash>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QList>
 #include <QString>
+#include <cctype>
 
 #include "common.hpp"
 
@@ -15,6 +17,8 @@ namespace request_json_tags {
 
 constexpr auto header = "header";
 constexpr auto header_command = "command";
+constexpr auto header_request_id = "id";
+constexpr auto header_codec = "codec";
 constexpr auto payload = "payload";
 constexpr auto payload_auth_data = "auth_data";
 constexpr auto payload_auth_data_username = "username";
@@ -23,6 +27,10 @@ constexpr auto payload_auth_data_session_id = "session_id";
 constexpr auto payload_target = "target";
 constexpr auto payload_target_username = "username";
 constexpr auto payload_target_message = "message";
+constexpr auto payload_target_before = "before";
+constexpr auto payload_target_after = "after";
+constexpr auto payload_target_limit = "limit";
+constexpr auto payload_target_since = "since";
 
 };  // namespace request_json_tags
 
@@ -32,6 +40,7 @@ constexpr auto header = "header";
 constexpr auto header_command = "command";
 constexpr auto header_status = "status";
 constexpr auto header_msg = "msg";
+constexpr auto header_request_id = "id";
 constexpr auto payload = "payload";
 constexpr auto payload_auth_data = "auth_data";
 constexpr auto payload_auth_data_session_id = "session_id";
@@ -40,6 +49,13 @@ constexpr auto payload_target_username = "username";
 constexpr auto payload_target_messages = "messages";
 constexpr auto payload_target_messages_y = "y";
 constexpr auto payload_target_messages_t = "t";
+constexpr auto payload_target_next = "next";
+constexpr auto payload_target_last = "last";
+constexpr auto payload_target_inbox = "inbox";
+constexpr auto payload_target_inbox_username = "username";
+constexpr auto payload_target_inbox_last = "last";
+constexpr auto payload_target_inbox_message = "message";
+constexpr auto payload_target_inbox_unread = "unread";
 constexpr auto payload_target_all_messages = "all_messages";
 constexpr auto payload_target_all_messages_username = "username";
 constexpr auto payload_target_all_messages_messages = "messages";
@@ -48,6 +64,42 @@ constexpr auto payload_target_all_messages_messages_y = "y";
 
 };  // namespace response_json_tags
 
+namespace binary_tags {
+
+// every binary packet starts with this byte, a JSON document never does
+constexpr quint8 marker = 0x00;
+
+constexpr quint8 header_msg = 1;
+constexpr quint8 header_request_id = 2;
+constexpr quint8 header_codec = 3;
+constexpr quint8 payload_auth_data = 16;
+constexpr quint8 payload_auth_data_username = 17;
+constexpr quint8 payload_auth_data_password = 18;
+constexpr quint8 payload_auth_data_session_id = 19;
+constexpr quint8 payload_target = 32;
+constexpr quint8 payload_target_username = 33;
+constexpr quint8 payload_target_message = 34;
+constexpr quint8 payload_target_messages = 35;
+constexpr quint8 payload_target_all_messages = 36;
+constexpr quint8 payload_target_before = 37;
+constexpr quint8 payload_target_after = 38;
+constexpr quint8 payload_target_limit = 39;
+constexpr quint8 payload_target_next = 40;
+constexpr quint8 payload_target_since = 41;
+constexpr quint8 payload_target_last = 42;
+constexpr quint8 payload_target_inbox = 43;
+constexpr quint8 message = 48;
+constexpr quint8 message_side = 49;
+constexpr quint8 message_message = 50;
+constexpr quint8 conversation = 64;
+constexpr quint8 conversation_username = 65;
+constexpr quint8 conversation_messages = 66;
+constexpr quint8 conversation_last_message_id = 67;
+constexpr quint8 conversation_last_message = 68;
+constexpr quint8 conversation_unread = 69;
+
+};  // namespace binary_tags
+
 struct packet_t {
   struct header_t {
     enum class command_t : quint16 {
@@ -62,7 +114,11 @@ struct packet_t {
       MSGS,          // res (server -> client)
       GETALLMSGS,    // req (client -> server)
       ALLMSGS,       // res (server -> client)
-    } command;
+      SETCODEC,      // req (client -> server)
+      GETINBOX,      // req (client -> server)
+      INBOX,         // res (server -> client)
+      READ,          // req (client -> server)
+    } command{};
 
     [[maybe_unused]] static QString commandToQString(command_t c) noexcept {
       return QString::number(static_cast<quint16>(c));
@@ -75,7 +131,7 @@ struct packet_t {
     enum class status_t : quint16 {
       OK = 0,
       FAIL,
-    } status;  // res (server -> client)
+    } status{};  // res (server -> client)
 
     [[maybe_unused]] static QString statusToQString(status_t s) noexcept {
       return QString::number(static_cast<quint16>(s));
@@ -86,6 +142,18 @@ struct packet_t {
     }
 
     QString msg;  // res (server -> client)
+
+    // req, res (client -> server, server -> client)
+    // optional, echoed back in the response so that several requests can be
+    // in flight on one connection and answered out of order
+    QString request_id;
+
+    // wire format of the packets following a SETCODEC request, in both
+    // directions; JSON unless the client opts in
+    enum class codec_t : quint16 {
+      JSON = 0,
+      BINARY,
+    } codec{};  // req (client -> server)
   } header;
 
   struct __attribute_maybe_unused__ payload_t {
@@ -100,14 +168,892 @@ struct packet_t {
         QString side;
         QString message;
       };
+      // a line of the inbox
+      struct conversation_t {
+        QString username;
+        quint64 last_message_id = 0;
+        QString last_message;  // the first characters only
+        quint64 unread = 0;    // messages received since the last READ
+      };
       QString username;  // req, res (client -> server, server -> client)
       QString message;   // req (client -> server)
       QList<message_t> messages;                      // res (server -> client)
       QHash<QString, QList<message_t>> all_messages;  // res (server -> client)
+      QList<conversation_t> inbox;                    // res (server -> client)
+
+      // keyset pagination of GETMSGS on message_id, 0 means unset
+      quint64 before = 0;  // req, only messages older than this one
+      quint64 after = 0;   // req, only messages newer than this one
+      quint64 limit = 0;   // req, page size, 0 - the whole conversation
+      quint64 next = 0;    // res, cursor of the next page in the same
+                           // direction, 0 - there are no more messages
+
+      // delta sync of GETALLMSGS, 0 means a full one
+      quint64 since = 0;  // req, only messages newer than this one
+      quint64 last = 0;   // res, highest message_id the client has now, the
+                          // since of its next sync; in NOTIFY the id of
+                          // the pushed message
     } target;
   } payload;
 };
 
+// a packet as it travels over the wire, payload sections missing from it are
+// left in the error state
+struct wire_packet_t {
+  packet_t::header_t header;
+  common::result_t<packet_t::payload_t::auth_data_t> auth_data;
+  common::result_t<packet_t::payload_t::target_t> target;
+};
+
+// Binary packet layout:
+//   marker (1 byte) | command (varint) | status (1 byte) | field*
+//   field = tag (1 byte) | value length (varint) | value
+// Strings are UTF-8, empty ones are omitted. Sections (auth data, target) and
+// list items (messages, conversations) are fields whose value is a sequence
+// of fields again. Unknown tags are skipped, so fields can be added later
+// without breaking older peers.
+namespace binary {
+
+qsizetype varintSize(quint64 value) {
+  qsizetype size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+void writeVarint(QByteArray& out, quint64 value) {
+  while (value >= 0x80) {
+    out.append(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.append(static_cast<char>(value));
+}
+
+void writeField(QByteArray& out, const quint8 tag, const QByteArray& value) {
+  out.append(static_cast<char>(tag));
+  writeVarint(out, value.size());
+  out.append(value);
+}
+
+void writeString(QByteArray& out, const quint8 tag, const QString& value) {
+  if (value.isEmpty()) {
+    return;
+  }
+  writeField(out, tag, value.toUtf8());
+}
+
+// numbers are varints, zero ones are omitted like empty strings
+void writeNumber(QByteArray& out, const quint8 tag, const quint64 value) {
+  if (value == 0) {
+    return;
+  }
+  out.append(static_cast<char>(tag));
+  writeVarint(out, varintSize(value));
+  writeVarint(out, value);
+}
+
+void writeMessage(QByteArray& out, const QString& side,
+                  const QString& message) {
+  const auto side_data = side.toUtf8();
+  const auto message_data = message.toUtf8();
+
+  // the item size is known upfront, so it's written in place
+  out.append(static_cast<char>(binary_tags::message));
+  writeVarint(out, 1 + varintSize(side_data.size()) + side_data.size() + 1 +
+                       varintSize(message_data.size()) + message_data.size());
+  writeField(out, binary_tags::message_side, side_data);
+  writeField(out, binary_tags::message_message, message_data);
+}
+
+void writeMessages(
+    QByteArray& out,
+    const QList<packet_t::payload_t::target_t::message_t>& messages) {
+  for (const auto& msg : messages) {
+    writeMessage(out, msg.side, msg.message);
+  }
+}
+
+// fields whose size isn't known upfront get a fixed-width length, padded
+// with continuation bytes, that is filled in by endField()
+constexpr qsizetype reserved_length_size = 5;
+
+qsizetype beginField(QByteArray& out, const quint8 tag) {
+  out.append(static_cast<char>(tag));
+  const auto offset = out.size();
+  out.append(reserved_length_size, '\0');
+  return offset;
+}
+
+void endField(QByteArray& out, const qsizetype offset) {
+  auto size = static_cast<quint64>(out.size() - offset - reserved_length_size);
+  auto* length = out.data() + offset;
+  for (qsizetype i = 0; i < reserved_length_size - 1; ++i) {
+    length[i] = static_cast<char>((size & 0x7F) | 0x80);
+    size >>= 7;
+  }
+  length[reserved_length_size - 1] = static_cast<char>(size & 0x7F);
+}
+
+// bounds-checked cursor over an encoded packet or one of its fields
+class Reader {
+ public:
+  Reader() = default;
+  Reader(const char* begin, const char* end) : pos_(begin), end_(end) {}
+
+  bool atEnd() const { return pos_ >= end_; }
+
+  bool readByte(quint8& value) {
+    if (atEnd()) {
+      return false;
+    }
+    value = static_cast<quint8>(*pos_++);
+    return true;
+  }
+
+  bool readVarint(quint64& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      quint8 byte;
+      if (!readByte(byte)) {
+        return false;
+      }
+      value |= static_cast<quint64>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // reads one field, its value is handed out as a nested reader
+  bool readField(quint8& tag, Reader& value) {
+    quint64 size;
+    if (!readByte(tag) || !readVarint(size) ||
+        size > static_cast<quint64>(end_ - pos_)) {
+      return false;
+    }
+    value = Reader(pos_, pos_ + size);
+    pos_ += size;
+    return true;
+  }
+
+  QString toString() const { return QString::fromUtf8(pos_, end_ - pos_); }
+
+ private:
+  const char* pos_ = nullptr;
+  const char* end_ = nullptr;
+};
+
+bool readMessages(Reader& reader,
+                  QList<packet_t::payload_t::target_t::message_t>& messages) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    if (tag != binary_tags::message) {
+      continue;
+    }
+
+    packet_t::payload_t::target_t::message_t msg;
+    Reader field;
+    while (!value.atEnd()) {
+      if (!value.readField(tag, field)) {
+        return false;
+      }
+      if (tag == binary_tags::message_side) {
+        msg.side = field.toString();
+      } else if (tag == binary_tags::message_message) {
+        msg.message = field.toString();
+      }
+    }
+    messages.push_back(msg);
+  }
+  return true;
+}
+
+bool readAuthData(Reader& reader, packet_t::payload_t::auth_data_t& auth_data) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    switch (tag) {
+      case binary_tags::payload_auth_data_username: {
+        auth_data.username = value.toString();
+        break;
+      };
+      case binary_tags::payload_auth_data_password: {
+        auth_data.password = value.toString();
+        break;
+      };
+      case binary_tags::payload_auth_data_session_id: {
+        auth_data.session_id = value.toString();
+        break;
+      };
+      default: {
+        break;
+      };
+    }
+  }
+  return true;
+}
+
+bool readInbox(
+    Reader& reader,
+    QList<packet_t::payload_t::target_t::conversation_t>& inbox) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    if (tag != binary_tags::conversation) {
+      continue;
+    }
+
+    packet_t::payload_t::target_t::conversation_t conversation;
+    Reader field;
+    while (!value.atEnd()) {
+      if (!value.readField(tag, field)) {
+        return false;
+      }
+      if (tag == binary_tags::conversation_username) {
+        conversation.username = field.toString();
+      } else if (tag == binary_tags::conversation_last_message_id &&
+                 !field.readVarint(conversation.last_message_id)) {
+        return false;
+      } else if (tag == binary_tags::conversation_last_message) {
+        conversation.last_message = field.toString();
+      } else if (tag == binary_tags::conversation_unread &&
+                 !field.readVarint(conversation.unread)) {
+        return false;
+      }
+    }
+    inbox.push_back(conversation);
+  }
+  return true;
+}
+
+bool readTarget(Reader& reader, packet_t::payload_t::target_t& target) {
+  quint8 tag;
+  Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return false;
+    }
+    switch (tag) {
+      case binary_tags::payload_target_username: {
+        target.username = value.toString();
+        break;
+      };
+      case binary_tags::payload_target_message: {
+        target.message = value.toString();
+        break;
+      };
+      case binary_tags::payload_target_before: {
+        if (!value.readVarint(target.before)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_after: {
+        if (!value.readVarint(target.after)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_limit: {
+        if (!value.readVarint(target.limit)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_next: {
+        if (!value.readVarint(target.next)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_since: {
+        if (!value.readVarint(target.since)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_last: {
+        if (!value.readVarint(target.last)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_inbox: {
+        if (!readInbox(value, target.inbox)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_messages: {
+        if (!readMessages(value, target.messages)) {
+          return false;
+        }
+        break;
+      };
+      case binary_tags::payload_target_all_messages: {
+        Reader conversation;
+        while (!value.atEnd()) {
+          if (!value.readField(tag, conversation)) {
+            return false;
+          }
+          if (tag != binary_tags::conversation) {
+            continue;
+          }
+
+          QString username;
+          QList<packet_t::payload_t::target_t::message_t> messages;
+          Reader field;
+          while (!conversation.atEnd()) {
+            if (!conversation.readField(tag, field)) {
+              return false;
+            }
+            if (tag == binary_tags::conversation_username) {
+              username = field.toString();
+            } else if (tag == binary_tags::conversation_messages &&
+                       !readMessages(field, messages)) {
+              return false;
+            }
+          }
+          target.all_messages[username].append(messages);
+        }
+        break;
+      };
+      default: {
+        break;
+      };
+    }
+  }
+  return true;
+}
+
+};  // namespace binary
+
+namespace json {
+
+// appends value as a JSON string literal, escaped like QJsonDocument does
+void writeString(QByteArray& out, const QString& value) {
+  static constexpr char hex[] = "0123456789abcdef";
+
+  const auto data = value.toUtf8();
+  const char* run = data.constData();
+  const char* const end = run + data.size();
+
+  out.append('"');
+  for (const char* it = run; it != end; ++it) {
+    const auto c = static_cast<quint8>(*it);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    out.append(run, it - run);
+    run = it + 1;
+
+    switch (c) {
+      case '"': {
+        out.append("\\\"");
+        break;
+      };
+      case '\\': {
+        out.append("\\\\");
+        break;
+      };
+      case '\b': {
+        out.append("\\b");
+        break;
+      };
+      case '\f': {
+        out.append("\\f");
+        break;
+      };
+      case '\n': {
+        out.append("\\n");
+        break;
+      };
+      case '\r': {
+        out.append("\\r");
+        break;
+      };
+      case '\t': {
+        out.append("\\t");
+        break;
+      };
+      default: {
+        out.append("\\u00");
+        out.append(hex[c >> 4]);
+        out.append(hex[c & 0xF]);
+        break;
+      };
+    }
+  }
+  out.append(run, end - run);
+  out.append('"');
+}
+
+void writeKey(QByteArray& out, const char* key) {
+  out.append('"');
+  out.append(key);
+  out.append("\":");
+}
+
+// pull parser over a raw UTF-8 buffer with just enough JSON to decode
+// requests in one pass, without a QJsonDocument or intermediate QStrings;
+// keys are compared as raw bytes, so escaped keys never match a known tag
+class Reader {
+ public:
+  Reader(const char* begin, const char* end) : pos_(begin), end_(end) {}
+
+  bool failed() const { return failed_; }
+
+  // consumes the opening brace of an object
+  bool enterObject() {
+    skipWhitespace_();
+    if (!consume_('{')) {
+      return fail_();
+    }
+    first_member_ = true;
+    return true;
+  }
+
+  // moves to the next member of the object entered last and consumes its
+  // key and colon; returns false at the end of the object (the closing brace
+  // is consumed) or on malformed input
+  bool nextMember(QByteArrayView& key) {
+    if (failed_) {
+      return false;
+    }
+
+    skipWhitespace_();
+    if (consume_('}')) {
+      first_member_ = false;
+      return false;
+    }
+    if (!first_member_ && !consume_(',')) {
+      return fail_();
+    }
+    first_member_ = false;
+
+    skipWhitespace_();
+    const char* key_begin = pos_ + 1;
+    if (!skipString_()) {
+      return fail_();
+    }
+    key = QByteArrayView(key_begin, pos_ - 1 - key_begin);
+
+    skipWhitespace_();
+    if (!consume_(':')) {
+      return fail_();
+    }
+    return true;
+  }
+
+  // the next value is an object
+  bool peekObject() {
+    skipWhitespace_();
+    return pos_ < end_ && *pos_ == '{';
+  }
+
+  // reads a string value, other values are skipped and leave value empty
+  // the same way QJsonValue::toString() does
+  bool readString(QString& value) {
+    skipWhitespace_();
+    if (pos_ >= end_ || *pos_ != '"') {
+      value.clear();
+      return skipValue();
+    }
+
+    const char* begin = ++pos_;
+    while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\') {
+      ++pos_;
+    }
+    if (pos_ < end_ && *pos_ == '"') {
+      value = QString::fromUtf8(begin, pos_ - begin);
+      ++pos_;
+      return true;
+    }
+
+    // escaped strings are rare, they are unescaped into a separate buffer
+    QByteArray unescaped(begin, pos_ - begin);
+    while (pos_ < end_ && *pos_ != '"') {
+      if (*pos_ != '\\') {
+        unescaped.append(*pos_++);
+        continue;
+      }
+      if (++pos_ >= end_ || !unescape_(unescaped)) {
+        return fail_();
+      }
+    }
+    if (!consume_('"')) {
+      return fail_();
+    }
+
+    value = QString::fromUtf8(unescaped);
+    return true;
+  }
+
+  bool skipValue(const int depth = 0) {
+    // nesting limit, requests are never deeper than a few levels
+    constexpr int max_depth = 32;
+
+    skipWhitespace_();
+    if (pos_ >= end_ || depth > max_depth) {
+      return fail_();
+    }
+
+    switch (*pos_) {
+      case '"': {
+        return skipString_() || fail_();
+      };
+      case '{':
+      case '[': {
+        const char close = *pos_ == '{' ? '}' : ']';
+        const bool object = close == '}';
+        ++pos_;
+        skipWhitespace_();
+        if (consume_(close)) {
+          return true;
+        }
+        do {
+          if (object) {
+            skipWhitespace_();
+            if (!skipString_()) {
+              return fail_();
+            }
+            skipWhitespace_();
+            if (!consume_(':')) {
+              return fail_();
+            }
+          }
+          if (!skipValue(depth + 1)) {
+            return false;
+          }
+          skipWhitespace_();
+        } while (consume_(','));
+        return consume_(close) || fail_();
+      };
+      default: {
+        // numbers and literals
+        const char* begin = pos_;
+        while (pos_ < end_ && (std::isalnum(static_cast<quint8>(*pos_)) ||
+                               *pos_ == '-' || *pos_ == '+' || *pos_ == '.')) {
+          ++pos_;
+        }
+        return pos_ != begin || fail_();
+      };
+    }
+  }
+
+  // nothing but whitespace is left
+  bool atEnd() {
+    skipWhitespace_();
+    return pos_ == end_;
+  }
+
+ private:
+  const char* pos_;
+  const char* const end_;
+  bool failed_ = false;
+  bool first_member_ = true;
+
+  bool fail_() {
+    failed_ = true;
+    return false;
+  }
+
+  void skipWhitespace_() {
+    while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' ||
+                           *pos_ == '\t')) {
+      ++pos_;
+    }
+  }
+
+  bool consume_(const char c) {
+    if (pos_ < end_ && *pos_ == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool skipString_() {
+    if (!consume_('"')) {
+      return false;
+    }
+    while (pos_ < end_ && *pos_ != '"') {
+      // a trailing backslash has nothing to escape
+      if (*pos_ == '\\' && ++pos_ >= end_) {
+        return false;
+      }
+      ++pos_;
+    }
+    return consume_('"');
+  }
+
+  bool readHex4_(char32_t& value) {
+    if (end_ - pos_ < 4) {
+      return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+      const auto c = *pos_++;
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        value |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        value |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // pos_ is right after the backslash
+  bool unescape_(QByteArray& out) {
+    switch (*pos_++) {
+      case '"': {
+        out.append('"');
+        return true;
+      };
+      case '\\': {
+        out.append('\\');
+        return true;
+      };
+      case '/': {
+        out.append('/');
+        return true;
+      };
+      case 'b': {
+        out.append('\b');
+        return true;
+      };
+      case 'f': {
+        out.append('\f');
+        return true;
+      };
+      case 'n': {
+        out.append('\n');
+        return true;
+      };
+      case 'r': {
+        out.append('\r');
+        return true;
+      };
+      case 't': {
+        out.append('\t');
+        return true;
+      };
+      case 'u': {
+        char32_t code_point;
+        if (!readHex4_(code_point)) {
+          return false;
+        }
+        // a surrogate pair spans two escapes
+        if (code_point >= 0xD800 && code_point < 0xDC00) {
+          char32_t low;
+          if (!consume_('\\') || !consume_('u') || !readHex4_(low) ||
+              low < 0xDC00 || low >= 0xE000) {
+            return false;
+          }
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        }
+        out.append(QString::fromUcs4(&code_point, 1).toUtf8());
+        return true;
+      };
+      default: {
+        return false;
+      };
+    }
+  }
+};
+
+};  // namespace json
+
+bool isBinaryPacket(const QByteArray& data) {
+  return !data.isEmpty() &&
+         static_cast<quint8>(data.front()) == binary_tags::marker;
+}
+
+QByteArray binaryEncodePacket(const wire_packet_t& packet) {
+  QByteArray out;
+  out.append(static_cast<char>(binary_tags::marker));
+  binary::writeVarint(out, static_cast<quint16>(packet.header.command));
+  out.append(static_cast<char>(packet.header.status));
+
+  binary::writeString(out, binary_tags::header_msg, packet.header.msg);
+  binary::writeString(out, binary_tags::header_request_id,
+                      packet.header.request_id);
+  if (packet.header.codec != packet_t::header_t::codec_t::JSON) {
+    QByteArray codec;
+    binary::writeVarint(codec, static_cast<quint16>(packet.header.codec));
+    binary::writeField(out, binary_tags::header_codec, codec);
+  }
+
+  if (!packet.auth_data.error) {
+    QByteArray auth_data;
+    binary::writeString(auth_data, binary_tags::payload_auth_data_username,
+                        packet.auth_data.data.username);
+    binary::writeString(auth_data, binary_tags::payload_auth_data_password,
+                        packet.auth_data.data.password);
+    binary::writeString(auth_data,
+                        binary_tags::payload_auth_data_session_id,
+                        packet.auth_data.data.session_id);
+    binary::writeField(out, binary_tags::payload_auth_data, auth_data);
+  }
+
+  if (!packet.target.error) {
+    const auto& target = packet.target.data;
+
+    QByteArray target_data;
+    binary::writeString(target_data, binary_tags::payload_target_username,
+                        target.username);
+    binary::writeString(target_data, binary_tags::payload_target_message,
+                        target.message);
+    binary::writeNumber(target_data, binary_tags::payload_target_before,
+                        target.before);
+    binary::writeNumber(target_data, binary_tags::payload_target_after,
+                        target.after);
+    binary::writeNumber(target_data, binary_tags::payload_target_limit,
+                        target.limit);
+    binary::writeNumber(target_data, binary_tags::payload_target_next,
+                        target.next);
+    binary::writeNumber(target_data, binary_tags::payload_target_since,
+                        target.since);
+    binary::writeNumber(target_data, binary_tags::payload_target_last,
+                        target.last);
+
+    if (!target.messages.isEmpty()) {
+      QByteArray messages;
+      binary::writeMessages(messages, target.messages);
+      binary::writeField(target_data, binary_tags::payload_target_messages,
+                         messages);
+    }
+
+    if (!target.all_messages.isEmpty()) {
+      QByteArray all_messages;
+      for (auto it = target.all_messages.cbegin();
+           it != target.all_messages.cend(); ++it) {
+        QByteArray conversation;
+        binary::writeString(conversation, binary_tags::conversation_username,
+                            it.key());
+        QByteArray messages;
+        binary::writeMessages(messages, it.value());
+        binary::writeField(conversation, binary_tags::conversation_messages,
+                           messages);
+        binary::writeField(all_messages, binary_tags::conversation,
+                           conversation);
+      }
+      binary::writeField(target_data,
+                         binary_tags::payload_target_all_messages,
+                         all_messages);
+    }
+
+    if (!target.inbox.isEmpty()) {
+      QByteArray inbox;
+      for (const auto& line : target.inbox) {
+        QByteArray conversation;
+        binary::writeString(conversation, binary_tags::conversation_username,
+                            line.username);
+        binary::writeNumber(conversation,
+                            binary_tags::conversation_last_message_id,
+                            line.last_message_id);
+        binary::writeString(conversation,
+                            binary_tags::conversation_last_message,
+                            line.last_message);
+        binary::writeNumber(conversation, binary_tags::conversation_unread,
+                            line.unread);
+        binary::writeField(inbox, binary_tags::conversation, conversation);
+      }
+      binary::writeField(target_data, binary_tags::payload_target_inbox,
+                         inbox);
+    }
+
+    binary::writeField(out, binary_tags::payload_target, target_data);
+  }
+
+  return out;
+}
+
+auto binaryDecodePacket(const QByteArray& data)
+    -> common::result_t<wire_packet_t> {
+  binary::Reader reader(data.constData(), data.constData() + data.size());
+
+  quint8 marker;
+  quint64 command;
+  quint8 status;
+  if (!reader.readByte(marker) || marker != binary_tags::marker ||
+      !reader.readVarint(command) || !reader.readByte(status)) {
+    return {};
+  }
+
+  common::result_t<wire_packet_t> packet_monad;
+  auto& packet = packet_monad.data;
+  packet.header.command =
+      static_cast<packet_t::header_t::command_t>(command);
+  packet.header.status = static_cast<packet_t::header_t::status_t>(status);
+
+  quint8 tag;
+  binary::Reader value;
+  while (!reader.atEnd()) {
+    if (!reader.readField(tag, value)) {
+      return {};
+    }
+    switch (tag) {
+      case binary_tags::header_msg: {
+        packet.header.msg = value.toString();
+        break;
+      };
+      case binary_tags::header_request_id: {
+        packet.header.request_id = value.toString();
+        break;
+      };
+      case binary_tags::header_codec: {
+        quint64 codec;
+        if (!value.readVarint(codec)) {
+          return {};
+        }
+        packet.header.codec =
+            static_cast<packet_t::header_t::codec_t>(codec);
+        break;
+      };
+      case binary_tags::payload_auth_data: {
+        if (!binary::readAuthData(value, packet.auth_data.data)) {
+          return {};
+        }
+        packet.auth_data.error = false;
+        break;
+      };
+      case binary_tags::payload_target: {
+        if (!binary::readTarget(value, packet.target.data)) {
+          return {};
+        }
+        packet.target.error = false;
+        break;
+      };
+      default: {
+        break;
+      };
+    }
+  }
+
+  packet_monad.error = false;
+  return packet_monad;
+}
+
 auto jsonExtractPacketHeader(const QJsonDocument& jsonObj)
     -> common::result_t<packet_t::header_t> {
   common::result_t<packet_t::header_t> header_monad;
@@ -123,9 +1069,20 @@ auto jsonExtractPacketHeader(const QJsonDocument& jsonObj)
     return {};
   }
 
+  const auto header_request_id_data =
+      header_data[request_json_tags::header_request_id];
+  const auto header_codec_data = header_data[request_json_tags::header_codec];
+
   header_monad.error = false;
   header_monad.data.command = packet::packet_t::header_t::QStringToCommand(
       header_command_data.toString());
+  if (!header_request_id_data.isUndefined()) {
+    header_monad.data.request_id = header_request_id_data.toString();
+  }
+  if (!header_codec_data.isUndefined()) {
+    header_monad.data.codec = static_cast<packet_t::header_t::codec_t>(
+        header_codec_data.toString().toInt());
+  }
 
   return header_monad;
 }
@@ -193,22 +1150,155 @@ auto jsonExtractTargetData(const QJsonDocument& jsonObj)
   if (!payload_target_message_data.isUndefined()) {
     target_data_monad.data.message = payload_target_message_data.toString();
   }
+  target_data_monad.data.before =
+      payload_target_data[request_json_tags::payload_target_before]
+          .toString()
+          .toULongLong();
+  target_data_monad.data.after =
+      payload_target_data[request_json_tags::payload_target_after]
+          .toString()
+          .toULongLong();
+  target_data_monad.data.limit =
+      payload_target_data[request_json_tags::payload_target_limit]
+          .toString()
+          .toULongLong();
+  target_data_monad.data.since =
+      payload_target_data[request_json_tags::payload_target_since]
+          .toString()
+          .toULongLong();
 
   target_data_monad.error = false;
   return target_data_monad;
 }
 
+auto jsonExtractPacket(const QJsonDocument& jsonObj)
+    -> common::result_t<wire_packet_t> {
+  const auto header_monad = jsonExtractPacketHeader(jsonObj);
+  if (header_monad.error) {
+    return {};
+  }
+
+  common::result_t<wire_packet_t> packet_monad;
+  packet_monad.error = false;
+  packet_monad.data.header = header_monad.data;
+  packet_monad.data.auth_data = jsonExtractAuthData(jsonObj);
+  packet_monad.data.target = jsonExtractTargetData(jsonObj);
+
+  return packet_monad;
+}
+
+// decodes a JSON request straight from the receive buffer in one pass, for
+// well-formed requests the result is the same as
+// jsonExtractPacket(QJsonDocument::fromJson(data))
+auto jsonDecodePacket(const QByteArray& data)
+    -> common::result_t<wire_packet_t> {
+  json::Reader reader(data.constData(), data.constData() + data.size());
+  common::result_t<wire_packet_t> packet_monad;
+  auto& packet = packet_monad.data;
+
+  bool has_command = false;
+  QString value;
+  QByteArrayView key;
+
+  if (!reader.enterObject()) {
+    return {};
+  }
+  while (reader.nextMember(key)) {
+    if (key == request_json_tags::header && reader.peekObject()) {
+      reader.enterObject();
+      while (reader.nextMember(key)) {
+        if (key == request_json_tags::header_command) {
+          has_command = true;
+          reader.readString(value);
+          packet.header.command = packet_t::header_t::QStringToCommand(value);
+        } else if (key == request_json_tags::header_request_id) {
+          reader.readString(packet.header.request_id);
+        } else if (key == request_json_tags::header_codec) {
+          reader.readString(value);
+          packet.header.codec =
+              static_cast<packet_t::header_t::codec_t>(value.toInt());
+        } else {
+          reader.skipValue();
+        }
+      }
+    } else if (key == request_json_tags::payload && reader.peekObject()) {
+      reader.enterObject();
+      while (reader.nextMember(key)) {
+        if (key == request_json_tags::payload_auth_data &&
+            reader.peekObject()) {
+          auto& auth_data = packet.auth_data;
+          auth_data.error = false;
+          reader.enterObject();
+          while (reader.nextMember(key)) {
+            if (key == request_json_tags::payload_auth_data_username) {
+              reader.readString(auth_data.data.username);
+            } else if (key == request_json_tags::payload_auth_data_password) {
+              reader.readString(auth_data.data.password);
+            } else if (key ==
+                       request_json_tags::payload_auth_data_session_id) {
+              reader.readString(auth_data.data.session_id);
+            } else {
+              reader.skipValue();
+            }
+          }
+        } else if (key == request_json_tags::payload_target &&
+                   reader.peekObject()) {
+          auto& target = packet.target;
+          target.error = false;
+          reader.enterObject();
+          while (reader.nextMember(key)) {
+            if (key == request_json_tags::payload_target_username) {
+              reader.readString(target.data.username);
+            } else if (key == request_json_tags::payload_target_message) {
+              reader.readString(target.data.message);
+            } else if (key == request_json_tags::payload_target_before) {
+              reader.readString(value);
+              target.data.before = value.toULongLong();
+            } else if (key == request_json_tags::payload_target_after) {
+              reader.readString(value);
+              target.data.after = value.toULongLong();
+            } else if (key == request_json_tags::payload_target_limit) {
+              reader.readString(value);
+              target.data.limit = value.toULongLong();
+            } else if (key == request_json_tags::payload_target_since) {
+              reader.readString(value);
+              target.data.since = value.toULongLong();
+            } else {
+              reader.skipValue();
+            }
+          }
+        } else {
+          reader.skipValue();
+        }
+      }
+    } else {
+      reader.skipValue();
+    }
+  }
+
+  if (reader.failed() || !reader.atEnd() || !has_command) {
+    return {};
+  }
+
+  packet_monad.error = false;
+  return packet_monad;
+}
+
 struct Response {
   Response() = default;
   ~Response() = default;
 
   virtual QJsonDocument to_json() { return {}; };
+  virtual wire_packet_t to_packet() { return {}; };
+
+  QByteArray to_binary() { return binaryEncodePacket(to_packet()); }
 };
 
 struct StatusResponse : public Response {
   QString header_command;
   QString header_status;
   QString header_msg;
+  QString header_request_id;  // set by the server right before sending
 
   StatusResponse(packet::packet_t::header_t::command_t header_command,
                  packet::packet_t::header_t::status_t header_status,
@@ -221,6 +1311,30 @@ struct StatusResponse : public Response {
 
   QJsonDocument to_json() {
     QJsonObject response;
+
+    const auto header_json = headerToJson_();
+
+    response.insert(packet::response_json_tags::header, header_json);
+
+    QJsonDocument doc(response);
+    return doc;
+  }
+
+  wire_packet_t to_packet() {
+    wire_packet_t packet;
+
+    packet.header.command =
+        packet::packet_t::header_t::QStringToCommand(header_command);
+    packet.header.status =
+        packet::packet_t::header_t::QStringToStatus(header_status);
+    packet.header.msg = header_msg;
+    packet.header.request_id = header_request_id;
+
+    return packet;
+  }
+
+ protected:
+  QJsonObject headerToJson_() const {
     QJsonObject header_json;
 
     header_json.insert(packet::response_json_tags::header_command,
@@ -228,11 +1342,12 @@ struct StatusResponse : public Response {
     header_json.insert(packet::response_json_tags::header_status,
                        header_status);
     header_json.insert(packet::response_json_tags::header_msg, header_msg);
+    if (!header_request_id.isEmpty()) {
+      header_json.insert(packet::response_json_tags::header_request_id,
+                         header_request_id);
+    }
 
-    response.insert(packet::response_json_tags::header, header_json);
-
-    QJsonDocument doc(response);
-    return doc;
+    return header_json;
   }
 };
 
@@ -248,7 +1363,6 @@ struct AuthResponse : public StatusResponse {
 
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject auth_data_json;
 
@@ -259,11 +1373,7 @@ struct AuthResponse : public StatusResponse {
     payload_json.insert(packet::response_json_tags::payload_auth_data,
                         auth_data_json);
 
-    header_json.insert(packet::response_json_tags::header_command,
-                       header_command);
-    header_json.insert(packet::response_json_tags::header_status,
-                       header_status);
-    header_json.insert(packet::response_json_tags::header_msg, header_msg);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::response_json_tags::payload, payload_json);
     response.insert(packet::response_json_tags::header, header_json);
@@ -271,10 +1381,23 @@ struct AuthResponse : public StatusResponse {
     QJsonDocument doc(response);
     return doc;
   }
+
+  wire_packet_t to_packet() {
+    auto packet = StatusResponse::to_packet();
+
+    packet.auth_data.error = false;
+    packet.auth_data.data.session_id = payload_auth_data_session_id;
+
+    return packet;
+  }
 };
 
+// with a message id the notification carries the message itself, as the
+// only item of messages and with its id as last
 struct NotifyResponse : public StatusResponse {
   QString payload_target_username;
+  quint64 payload_target_message_id = 0;
+  packet::packet_t::payload_t::target_t::message_t payload_target_message;
 
   NotifyResponse(packet::packet_t::header_t::command_t header_command,
                  packet::packet_t::header_t::status_t header_status,
@@ -285,21 +1408,25 @@ struct NotifyResponse : public StatusResponse {
 
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject target_json;
 
     target_json.insert(packet::response_json_tags::payload_target_username,
                        payload_target_username);
+    if (payload_target_message_id != 0) {
+      QJsonObject message_json;
+      message_json.insert(payload_target_message.side,
+                          payload_target_message.message);
+      target_json.insert(packet::response_json_tags::payload_target_messages,
+                         QJsonArray{message_json});
+      target_json.insert(packet::response_json_tags::payload_target_last,
+                         QString::number(payload_target_message_id));
+    }
 
     payload_json.insert(packet::response_json_tags::payload_target,
                         target_json);
 
-    header_json.insert(packet::response_json_tags::header_command,
-                       header_command);
-    header_json.insert(packet::response_json_tags::header_status,
-                       header_status);
-    header_json.insert(packet::response_json_tags::header_msg, header_msg);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::response_json_tags::payload, payload_json);
     response.insert(packet::response_json_tags::header, header_json);
@@ -307,11 +1434,25 @@ struct NotifyResponse : public StatusResponse {
     QJsonDocument doc(response);
     return doc;
   }
+
+  wire_packet_t to_packet() {
+    auto packet = StatusResponse::to_packet();
+
+    packet.target.error = false;
+    packet.target.data.username = payload_target_username;
+    if (payload_target_message_id != 0) {
+      packet.target.data.messages = {payload_target_message};
+      packet.target.data.last = payload_target_message_id;
+    }
+
+    return packet;
+  }
 };
 
 struct MsgsResponse : public NotifyResponse {
   QList<packet::packet_t::payload_t::target_t::message_t>
       payload_target_messages;
+  quint64 payload_target_next = 0;  // cursor of the next page, 0 - last page
 
   MsgsResponse(packet::packet_t::header_t::command_t header_command,
                packet::packet_t::header_t::status_t header_status,
@@ -325,7 +1466,6 @@ struct MsgsResponse : public NotifyResponse {
 
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject target_json;
     QJsonArray messages_json;
@@ -340,15 +1480,15 @@ struct MsgsResponse : public NotifyResponse {
                        messages_json);
     target_json.insert(packet::response_json_tags::payload_target_username,
                        payload_target_username);
+    if (payload_target_next != 0) {
+      target_json.insert(packet::response_json_tags::payload_target_next,
+                         QString::number(payload_target_next));
+    }
 
     payload_json.insert(packet::response_json_tags::payload_target,
                         target_json);
 
-    header_json.insert(packet::response_json_tags::header_command,
-                       header_command);
-    header_json.insert(packet::response_json_tags::header_status,
-                       header_status);
-    header_json.insert(packet::response_json_tags::header_msg, header_msg);
+    const auto header_json = headerToJson_();
 
     response.insert(packet::response_json_tags::payload, payload_json);
     response.insert(packet::response_json_tags::header, header_json);
@@ -356,11 +1496,21 @@ struct MsgsResponse : public NotifyResponse {
     QJsonDocument doc(response);
     return doc;
   }
+
+  wire_packet_t to_packet() {
+    auto packet = NotifyResponse::to_packet();
+
+    packet.target.data.messages = payload_target_messages;
+    packet.target.data.next = payload_target_next;
+
+    return packet;
+  }
 };
 
 struct AllMsgsResponse : public StatusResponse {
   QHash<QString, QList<packet::packet_t::payload_t::target_t::message_t>>
       payload_target_all_messages;
+  quint64 payload_target_last = 0;  // high-water mark, 0 - not reported
 
   AllMsgsResponse(
       packet::packet_t::header_t::command_t header_command,
@@ -374,7 +1524,6 @@ struct AllMsgsResponse : public StatusResponse {
 
   QJsonDocument to_json() {
     QJsonObject response;
-    QJsonObject header_json;
     QJsonObject payload_json;
     QJsonObject target_json;
     QJsonArray all_messages_json;
@@ -401,15 +1550,75 @@ struct AllMsgsResponse : public StatusResponse {
 
     target_json.insert(packet::response_json_tags::payload_target_all_messages,
                        all_messages_json);
+    if (payload_target_last != 0) {
+      target_json.insert(packet::response_json_tags::payload_target_last,
+                         QString::number(payload_target_last));
+    }
 
     payload_json.insert(packet::response_json_tags::payload_target,
                         target_json);
 
-    header_json.insert(packet::response_json_tags::header_command,
-                       header_command);
-    header_json.insert(packet::response_json_tags::header_status,
-                       header_status);
-    header_json.insert(packet::response_json_tags::header_msg, header_msg);
+    const auto header_json = headerToJson_();
+
+    response.insert(packet::response_json_tags::payload, payload_json);
+    response.insert(packet::response_json_tags::header, header_json);
+
+    QJsonDocument doc(response);
+    return doc;
+  }
+
+  wire_packet_t to_packet() {
+    auto packet = StatusResponse::to_packet();
+
+    packet.target.error = false;
+    packet.target.data.all_messages = payload_target_all_messages;
+    packet.target.data.last = payload_target_last;
+
+    return packet;
+  }
+};
+
+struct InboxResponse : public StatusResponse {
+  QList<packet::packet_t::payload_t::target_t::conversation_t>
+      payload_target_inbox;
+
+  InboxResponse(
+      packet::packet_t::header_t::command_t header_command,
+      packet::packet_t::header_t::status_t header_status,
+      const QString& header_msg,
+      const QList<packet::packet_t::payload_t::target_t::conversation_t>&
+          payload_target_inbox)
+      : StatusResponse(header_command, header_status, header_msg),
+        payload_target_inbox(payload_target_inbox) {}
+
+  QJsonDocument to_json() {
+    QJsonObject response;
+    QJsonObject payload_json;
+    QJsonObject target_json;
+    QJsonArray inbox_json;
+
+    for (const auto& line : payload_target_inbox) {
+      QJsonObject line_json;
+      line_json.insert(
+          packet::response_json_tags::payload_target_inbox_username,
+          line.username);
+      line_json.insert(packet::response_json_tags::payload_target_inbox_last,
+                       QString::number(line.last_message_id));
+      line_json.insert(
+          packet::response_json_tags::payload_target_inbox_message,
+          line.last_message);
+      line_json.insert(packet::response_json_tags::payload_target_inbox_unread,
+                       QString::number(line.unread));
+      inbox_json.append(line_json);
+    }
+
+    target_json.insert(packet::response_json_tags::payload_target_inbox,
+                       inbox_json);
+
+    payload_json.insert(packet::response_json_tags::payload_target,
+                        target_json);
+
+    const auto header_json = headerToJson_();
 
     response.insert(packet::response_json_tags::payload, payload_json);
     response.insert(packet::response_json_tags::header, header_json);
@@ -417,6 +1626,192 @@ struct AllMsgsResponse : public StatusResponse {
     QJsonDocument doc(response);
     return doc;
   }
+
+  wire_packet_t to_packet() {
+    auto packet = StatusResponse::to_packet();
+
+    packet.target.error = false;
+    packet.target.data.inbox = payload_target_inbox;
+
+    return packet;
+  }
+};
+
+// streams a MSGS or ALLMSGS response into a buffer while the rows are read
+// from the database, so the history never exists as a message list or a
+// QJsonObject tree; the output is the same as MsgsResponse/AllMsgsResponse
+// would produce. The messages of one conversation must come in a row.
+class HistoryWriter {
+ public:
+  // username is the target of a MSGS response and unused for ALLMSGS
+  HistoryWriter(QByteArray& out, const packet_t::header_t::codec_t codec,
+                const packet_t::header_t& header,
+                const QString& username = {})
+      : out_(out),
+        binary_(codec == packet_t::header_t::codec_t::BINARY),
+        all_messages_(header.command ==
+                      packet_t::header_t::command_t::ALLMSGS) {
+    if (binary_) {
+      out_.append(static_cast<char>(binary_tags::marker));
+      binary::writeVarint(out_, static_cast<quint16>(header.command));
+      out_.append(static_cast<char>(header.status));
+      binary::writeString(out_, binary_tags::header_msg, header.msg);
+      binary::writeString(out_, binary_tags::header_request_id,
+                          header.request_id);
+
+      target_ = binary::beginField(out_, binary_tags::payload_target);
+      if (all_messages_) {
+        list_ =
+            binary::beginField(out_, binary_tags::payload_target_all_messages);
+      } else {
+        binary::writeString(out_, binary_tags::payload_target_username,
+                            username);
+        list_ = binary::beginField(out_, binary_tags::payload_target_messages);
+      }
+      return;
+    }
+
+    out_.append('{');
+    json::writeKey(out_, response_json_tags::header);
+    out_.append('{');
+    json::writeKey(out_, response_json_tags::header_command);
+    json::writeString(out_,
+                      packet_t::header_t::commandToQString(header.command));
+    out_.append(',');
+    json::writeKey(out_, response_json_tags::header_status);
+    json::writeString(out_, packet_t::header_t::statusToQString(header.status));
+    out_.append(',');
+    json::writeKey(out_, response_json_tags::header_msg);
+    json::writeString(out_, header.msg);
+    if (!header.request_id.isEmpty()) {
+      out_.append(',');
+      json::writeKey(out_, response_json_tags::header_request_id);
+      json::writeString(out_, header.request_id);
+    }
+    out_.append("},");
+
+    json::writeKey(out_, response_json_tags::payload);
+    out_.append('{');
+    json::writeKey(out_, response_json_tags::payload_target);
+    out_.append('{');
+    if (all_messages_) {
+      json::writeKey(out_, response_json_tags::payload_target_all_messages);
+    } else {
+      json::writeKey(out_, response_json_tags::payload_target_username);
+      json::writeString(out_, username);
+      out_.append(',');
+      json::writeKey(out_, response_json_tags::payload_target_messages);
+    }
+    out_.append('[');
+  }
+
+  HistoryWriter(const HistoryWriter&) = delete;
+  HistoryWriter& operator=(const HistoryWriter&) = delete;
+
+  // ALLMSGS only, the messages written next belong to this conversation
+  void conversation(const QString& username) {
+    endConversation_();
+
+    if (binary_) {
+      conversation_ = binary::beginField(out_, binary_tags::conversation);
+      binary::writeString(out_, binary_tags::conversation_username, username);
+      conversation_messages_ =
+          binary::beginField(out_, binary_tags::conversation_messages);
+    } else {
+      if (conversations_ > 0) {
+        out_.append(',');
+      }
+      out_.append('{');
+      json::writeKey(out_,
+                     response_json_tags::payload_target_all_messages_username);
+      json::writeString(out_, username);
+      out_.append(',');
+      json::writeKey(out_,
+                     response_json_tags::payload_target_all_messages_messages);
+      out_.append('[');
+    }
+
+    ++conversations_;
+    in_conversation_ = true;
+    first_message_ = true;
+  }
+
+  void message(const QString& side, const QString& message) {
+    if (binary_) {
+      binary::writeMessage(out_, side, message);
+    } else {
+      if (!first_message_) {
+        out_.append(',');
+      }
+      out_.append('{');
+      json::writeString(out_, side);
+      out_.append(':');
+      json::writeString(out_, message);
+      out_.append('}');
+    }
+
+    first_message_ = false;
+    ++messages_;
+  }
+
+  // closes every open section, nothing may be written afterwards; cursor is
+  // the next page of MSGS (0 if this one is the last) or the high-water mark
+  // of ALLMSGS
+  void finish(const quint64 cursor = 0) {
+    endConversation_();
+
+    const auto cursor_tag = all_messages_
+                                ? binary_tags::payload_target_last
+                                : binary_tags::payload_target_next;
+    const auto cursor_key = all_messages_
+                                ? response_json_tags::payload_target_last
+                                : response_json_tags::payload_target_next;
+
+    if (binary_) {
+      binary::endField(out_, list_);
+      binary::writeNumber(out_, cursor_tag, cursor);
+      binary::endField(out_, target_);
+    } else {
+      out_.append(']');
+      if (cursor != 0) {
+        out_.append(',');
+        json::writeKey(out_, cursor_key);
+        json::writeString(out_, QString::number(cursor));
+      }
+      out_.append("}}}");
+    }
+  }
+
+  quint64 messages() const { return messages_; }
+
+ private:
+  QByteArray& out_;
+  const bool binary_;
+  const bool all_messages_;
+  bool in_conversation_ = false;
+  bool first_message_ = true;
+  quint64 conversations_ = 0;
+  quint64 messages_ = 0;
+  // offsets of the open binary fields
+  qsizetype target_ = 0;
+  qsizetype list_ = 0;
+  qsizetype conversation_ = 0;
+  qsizetype conversation_messages_ = 0;
+
+  void endConversation_() {
+    if (!in_conversation_) {
+      return;
+    }
+
+    if (binary_) {
+      binary::endField(out_, conversation_messages_);
+      binary::endField(out_, conversation_);
+    } else {
+      out_.append("]}");
+    }
+
+    in_conversation_ = false;
+  }
 };
 
-};  // namespace packet
\ No newline at end of file
+};  // namespace packet
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QString>
+#include <QThread>
+#include <QThreadStorage>
+
+#include "common.hpp"
+
+namespace db {
+
+struct statement_stats_t {
+  quint64 hits = 0;    // statements reused from the cache
+  quint64 misses = 0;  // statements compiled, once per thread and statement
+};
+
+struct pool_stats_t {
+  qint64 readers = 0;  // open read-only connections, one per reading thread
+  qint64 writers = 0;  // open read-write connections, the main one included
+};
+
+// one SQLite connection per thread, since a QSqlDatabase connection can only
+// be used by the thread that opened it. The thread that opens the pool keeps
+// the main connection (migrations, startup), the thread that claims the
+// writer gets the only other read-write one and every other thread a
+// read-only one, which in WAL mode reads alongside the writer instead of
+// waiting for it. A thread's connection and its statements are closed when
+// the thread exits.
+class ConnectionPool {
+ public:
+  ConnectionPool() = default;
+  ConnectionPool(const ConnectionPool&) = delete;
+  ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+  // opens the main connection on the calling thread, every other connection
+  // is a clone of it
+  bool open(const QString& path) {
+    auto main = QSqlDatabase::addDatabase("QSQLITE");
+    main.setDatabaseName(path);
+    // the writer and the main connection wait for each other's write locks
+    // instead of failing with SQLITE_BUSY
+    main.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+    if (!main.open()) {
+      common::logAll(QtCriticalMsg, "[DB | POOL] " + main.lastError().text());
+      return false;
+    }
+
+    // readers don't block the writer and the other way round, every commit
+    // is synced to the WAL before it's acknowledged
+    QSqlQuery pragma(main);
+    if (!pragma.exec("PRAGMA journal_mode=WAL")) {
+      common::logAll(QtWarningMsg, "[DB | POOL] Can't enable WAL: " +
+                                       pragma.lastError().text());
+    }
+    configure_(main, role_t::MAIN);
+
+    main_thread_.storeRelease(QThread::currentThread());
+    writers_.fetchAndAddRelaxed(1);
+
+    return true;
+  }
+
+  // the calling thread becomes the writer, it must be called before the
+  // thread's first query
+  void claimWriter() { writer_thread_.storeRelease(QThread::currentThread()); }
+
+  // the calling thread's connection, opened on first use
+  QSqlDatabase connection() { return slot_().connection; }
+
+  // every statement is compiled once per connection and reused afterwards,
+  // so a call only binds and steps it; sql must outlive the pool (a string
+  // literal), and a statement must be read to the end or finish()ed before
+  // it's used again
+  QSqlQuery& statement(const char* sql) {
+    auto& statements = slot_().statements;
+
+    auto it = statements.find(sql);
+    if (it != statements.end()) {
+      statement_hits_.fetchAndAddRelaxed(1);
+      return *it;
+    }
+
+    statement_misses_.fetchAndAddRelaxed(1);
+    it = statements.insert(sql, QSqlQuery(slot_().connection));
+    it->setForwardOnly(true);
+    if (!it->prepare(sql)) {
+      common::logAll(QtCriticalMsg, "[DB | POOL] Can't prepare statement: " +
+                                        it->lastError().text());
+    }
+    return *it;
+  }
+
+  statement_stats_t statementStats() const {
+    statement_stats_t stats;
+    stats.hits = statement_hits_.loadRelaxed();
+    stats.misses = statement_misses_.loadRelaxed();
+    return stats;
+  }
+
+  pool_stats_t stats() const {
+    pool_stats_t stats;
+    stats.readers = readers_.loadRelaxed();
+    stats.writers = writers_.loadRelaxed();
+    return stats;
+  }
+
+ private:
+  enum class role_t { MAIN, WRITER, READER };
+
+  struct slot_t {
+    ConnectionPool* pool = nullptr;
+    role_t role = role_t::READER;
+    QString name;
+    QSqlDatabase connection;
+    QHash<const char*, QSqlQuery> statements;
+
+    // runs on the exiting thread, the statements go before their connection
+    ~slot_t() {
+      statements.clear();
+      if (role == role_t::MAIN) {
+        return;  // owned by QSqlDatabase's default connection
+      }
+
+      connection.close();
+      connection = QSqlDatabase();
+      QSqlDatabase::removeDatabase(name);
+      (role == role_t::READER ? pool->readers_ : pool->writers_)
+          .fetchAndAddRelaxed(-1);
+    }
+  };
+
+  QThreadStorage<slot_t*> slots_;
+  QAtomicPointer<QThread> main_thread_;
+  QAtomicPointer<QThread> writer_thread_;
+  QAtomicInt connections_count_;
+
+  QAtomicInteger<qint64> readers_;
+  QAtomicInteger<qint64> writers_;
+  QAtomicInteger<quint64> statement_hits_;
+  QAtomicInteger<quint64> statement_misses_;
+
+  slot_t& slot_() {
+    if (slots_.hasLocalData()) {
+      return *slots_.localData();
+    }
+
+    auto* slot = new slot_t;
+    slot->pool = this;
+
+    const auto thread = QThread::currentThread();
+    if (thread == main_thread_.loadAcquire()) {
+      slot->role = role_t::MAIN;
+      slot->name = QSqlDatabase::defaultConnection;
+      slot->connection = QSqlDatabase::database();
+      slots_.setLocalData(slot);
+      return *slot;
+    }
+
+    slot->role = thread == writer_thread_.loadAcquire() ? role_t::WRITER
+                                                        : role_t::READER;
+    slot->name = "yachat_thread_" +
+                 QString::number(connections_count_.fetchAndAddRelaxed(1));
+    slot->connection = QSqlDatabase::cloneDatabase(
+        QSqlDatabase::defaultConnection, slot->name);
+    if (!slot->connection.open()) {
+      common::logAll(QtCriticalMsg,
+                     "[DB | POOL] " + slot->connection.lastError().text());
+    }
+    configure_(slot->connection, slot->role);
+    (slot->role == role_t::READER ? readers_ : writers_)
+        .fetchAndAddRelaxed(1);
+
+    slots_.setLocalData(slot);
+    return *slot;
+  }
+
+  // per connection settings, the journal mode is kept in the file
+  static void configure_(const QSqlDatabase& connection, const role_t role) {
+    QSqlQuery pragma(connection);
+    if (role == role_t::READER) {
+      // a reader that tries to write fails instead of taking the write lock
+      pragma.exec("PRAGMA query_only=ON");
+    } else {
+      pragma.exec("PRAGMA synchronous=FULL");
+    }
+  }
+};
+
+};  // namespace db
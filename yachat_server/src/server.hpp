@@ -2,579 +2,1427 @@
 
 #include <stdlib.h>
 
+#include <QAtomicInteger>
 #include <QCoreApplication>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QList>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QWeakPointer>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
 
 #include "auth.hpp"
 #include "common.hpp"
+#include "config.hpp"
+#include "executor.hpp"
+#include "frame.hpp"
+#include "metrics.hpp"
 #include "msg.hpp"
 #include "packet.hpp"
+#include "trace.hpp"
+#include "writer.hpp"
 
 namespace server {
 
-class Server : public QTcpServer {
+// Qt stops pulling from the kernel once this much unread data is buffered,
+// which is what lets a paused connection push back on its client
+constexpr qint64 socket_read_buffer_size = 64 * 1024;
+
+// how often the buffered trace events are appended to the trace file
+constexpr int trace_flush_interval_ms = 1000;
+
+// a request answered asynchronously holds a QWeakPointer to its connection:
+// once the connection is dropped the descriptor may be handed to the next
+// client, which must not get the answer
+struct connection_t {
+  QTcpSocket *socket = nullptr;
+  qintptr socket_descriptor = 0;
+  frame::Decoder decoder;
+  QByteArray outbox;  // frames waiting for the next flush
+  bool flush_scheduled = false;
+  bool reading_paused = false;  // outbound data is above the high watermark
+  int in_flight = 0;  // requests dispatched but not answered yet
+  bool throttled = false;  // in_flight reached the cap, reading stopped
+  packet::packet_t::header_t::codec_t codec =
+      packet::packet_t::header_t::codec_t::JSON;  // of the outgoing packets
+  QList<trace::trace_id_t> traced;  // sampled requests answered in the outbox
+};
+
+// process-wide outbound counters, reported by Server::logStats_
+struct {
+  QAtomicInteger<quint64> shed_notifications;
+  QAtomicInteger<qint64> paused_connections;
+} outbound_stats;
+
+class Worker;
+
+// <socket descriptor, worker> for the connections of every worker, lets one
+// worker reach a socket owned by another one
+struct {
  public:
-  explicit Server(quint16 port, QObject *parent = nullptr)
-      : QTcpServer(parent) {
-    connect(this, &QTcpServer::newConnection, this, &Server::onNewConnection_);
+  void add(const qintptr socket_descriptor, Worker *worker) {
+    QWriteLocker locker(&lock_);
+    workers_.insert(socket_descriptor, worker);
+  }
 
-    if (!listen(QHostAddress::Any, port)) {
-      common::logAll(QtFatalMsg,
-                     "[SERVER | CONSTRUCTOR] Unable to start the server: " +
-                         errorString());
-      QCoreApplication::exit(EXIT_FAILURE);
-    }
+  void remove(const qintptr socket_descriptor) {
+    QWriteLocker locker(&lock_);
+    workers_.remove(socket_descriptor);
   }
 
- private slots:
-  void onNewConnection_() {
-    QTcpSocket *clientSocket = nextPendingConnection();
+  Worker *get(const qintptr socket_descriptor) const {
+    QReadLocker locker(&lock_);
+    return workers_.value(socket_descriptor, nullptr);
+  }
 
-    common::logAll(QtDebugMsg, "[SERVER | ON NEW CONNECTION] " +
-                                   clientSocket->localAddress().toString() +
-                                   " connected");
+ private:
+  mutable QReadWriteLock lock_;
+  QHash<qintptr, Worker *> workers_;
+} registry;
+
+// owns a share of the connections and serves them on its own event loop
+class Worker : public QObject {
+ public:
+  explicit Worker(const config::config_t &config, QObject *parent = nullptr)
+      : QObject(parent),
+        high_watermark_(config.high_watermark),
+        low_watermark_(config.low_watermark),
+        max_in_flight_(config.max_in_flight) {}
+
+  // must be called on the worker thread
+  void addConnection(qintptr socket_descriptor) {
+    QTcpSocket *clientSocket = new QTcpSocket(this);
+    if (!clientSocket->setSocketDescriptor(socket_descriptor)) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | ON NEW CONNECTION] Can't take over socket " +
+               QString::number(socket_descriptor) + ": " +
+               clientSocket->errorString();
+      });
+      delete clientSocket;
+      return;
+    }
+
+    common::logAll(QtDebugMsg, [&]() {
+      return "[SERVER | ON NEW CONNECTION] " +
+             clientSocket->localAddress().toString() + " connected";
+    });
+
+    clientSocket->setReadBufferSize(socket_read_buffer_size);
 
-    const auto socket_descriptor = clientSocket->socketDescriptor();
-    sockets_.insert(socket_descriptor, clientSocket);
+    auto connection = QSharedPointer<connection_t>::create();
+    connection->socket = clientSocket;
+    connection->socket_descriptor = socket_descriptor;
+    connections_.insert(socket_descriptor, connection);
+    registry.add(socket_descriptor, this);
+    metrics::registry.connected();
 
     connect(clientSocket, &QTcpSocket::readyRead, this,
-            [=]() { processConnection_(clientSocket); });
+            [=]() { processConnection_(socket_descriptor); });
+    connect(clientSocket, &QTcpSocket::bytesWritten, this,
+            [=]() { onBytesWritten_(socket_descriptor); });
     connect(clientSocket, &QTcpSocket::disconnected, this,
             [=]() { onDisconnection_(clientSocket, socket_descriptor); });
   }
 
-  void processConnection_(QTcpSocket *clientSocket) {
-    QByteArray requestData = clientSocket->readAll();
-    QString requestString = QString::fromUtf8(requestData);
-    QJsonDocument requestJson = QJsonDocument::fromJson(requestString.toUtf8());
+  // must be called on the worker thread, queues the frame for the next flush
+  // and silently drops it if the connection is already gone; sheddable
+  // frames are dropped as well while the client doesn't keep up
+  void deliver(qintptr socket_descriptor, const QByteArray &data,
+               bool sheddable = false) {
+    deliver_(connections_.value(socket_descriptor), data, sheddable);
+  }
+
+  // must be called on the worker thread, notifications are the first thing
+  // shed when the target lags behind; dropped as well if the target's
+  // session left the socket since it was looked up
+  void notify(qintptr socket_descriptor, const QString &target_username,
+              packet::NotifyResponse response) {
+    const auto socket_descriptor_monad =
+        auth::sessions.getSocketDescriptor(target_username);
+    if (socket_descriptor_monad.error ||
+        socket_descriptor_monad.data != socket_descriptor) {
+      return;
+    }
+    send_(connections_.value(socket_descriptor), response, true);
+  }
+
+ private slots:
+  void processConnection_(qintptr socket_descriptor) {
+    // keeps the connection alive even if it's dropped while dispatching
+    const auto connection = connections_.value(socket_descriptor);
+    if (!connection || connection->reading_paused || connection->throttled) {
+      return;
+    }
 
-    auto header_monad = packet::jsonExtractPacketHeader(requestJson);
-    if (header_monad.error) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | PROCESS CONNECTION] Error parsing received JSON "
-          "[header section]");
+    if (connection->decoder.readFrom(connection->socket) < 0) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | PROCESS CONNECTION] Error reading from socket " +
+               QString::number(socket_descriptor);
+      });
       return;
     }
 
-    const auto header = header_monad.unwrap();
-    const auto command = header.command;
+    // every complete frame received so far is dispatched in this turn,
+    // unless the client stops reading our responses in the meantime or has
+    // too many requests in flight, counted from their dispatch until they
+    // are answered (see answered_), as most are answered asynchronously
+    while (!connection->reading_paused) {
+      if (connection->in_flight >= max_in_flight_) {
+        connection->throttled = true;
+        common::logAll(QtDebugMsg, [&]() {
+          return "[SERVER | PROCESS CONNECTION] Socket " +
+                 QString::number(socket_descriptor) +
+                 " has too many requests in flight, reading paused";
+        });
+        break;
+      }
+
+      const auto frame_monad = connection->decoder.next();
+      if (frame_monad.error) {
+        break;
+      }
 
-    const auto response = processCommand_(command, std::move(requestJson),
-                                          clientSocket->socketDescriptor());
+      processRequest_(frame_monad.data, socket_descriptor);
+    }
 
-    clientSocket->write(response.toJson(QJsonDocument::Indented));
-    clientSocket->flush();
+    if (connection->decoder.malformed()) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | PROCESS CONNECTION] Frame size limit exceeded on "
+               "socket " + QString::number(socket_descriptor) +
+               ", dropping the connection";
+      });
+      connection->socket->disconnectFromHost();
+    }
   }
 
-  void onDisconnection_(QTcpSocket *clientSocket, qint16 socket_descriptor) {
-    common::logAll(QtDebugMsg, "[SERVER | ON DISCONNECTION] " +
-                                   clientSocket->localAddress().toString() +
-                                   " disconnected");
-    sockets_.remove(socket_descriptor);
+  // writes everything queued since the last flush with a single write()
+  void flush_(qintptr socket_descriptor) {
+    const auto connection = connections_.value(socket_descriptor);
+    if (!connection) {
+      return;
+    }
+
+    connection->flush_scheduled = false;
+    if (connection->outbox.isEmpty()) {
+      return;
+    }
+
+    const auto write_ns = trace::tracer.now();
+    connection->socket->write(connection->outbox);
+    connection->outbox.resize(0);  // keeps the capacity for the next batch
+
+    // the requests end once their replies are handed to the socket
+    for (const auto trace_id : std::as_const(connection->traced)) {
+      trace::tracer.complete(trace_id, "write", write_ns, trace::tracer.now());
+      trace::tracer.end(trace_id);
+    }
+    connection->traced.clear();
+  }
+
+  void onBytesWritten_(qintptr socket_descriptor) {
+    const auto connection = connections_.value(socket_descriptor);
+    if (!connection || !connection->reading_paused ||
+        pending_(*connection) > low_watermark_) {
+      return;
+    }
+
+    connection->reading_paused = false;
+    outbound_stats.paused_connections.fetchAndAddRelaxed(-1);
+    common::logAll(QtDebugMsg, [&]() {
+      return "[SERVER | ON BYTES WRITTEN] Socket " +
+             QString::number(socket_descriptor) +
+             " is below the low watermark, reading resumed";
+    });
+
+    // requests that arrived while paused are still buffered
+    processConnection_(socket_descriptor);
+  }
+
+  void onDisconnection_(QTcpSocket *clientSocket, qintptr socket_descriptor) {
+    common::logAll(QtDebugMsg, [&]() {
+      return "[SERVER | ON DISCONNECTION] " +
+             clientSocket->localAddress().toString() + " disconnected";
+    });
+    const auto connection = connections_.take(socket_descriptor);
+    if (connection && connection->reading_paused) {
+      outbound_stats.paused_connections.fetchAndAddRelaxed(-1);
+    }
+    if (connection) {
+      metrics::registry.disconnected();
+    }
+    registry.remove(socket_descriptor);
     auth::forcedLogOutUser(socket_descriptor);
     clientSocket->disconnectFromHost();
     clientSocket->deleteLater();
   }
 
  private:
-  QHash<qintptr, QTcpSocket *> sockets_;  // <socket descriptor, socket>
+  QHash<qintptr, QSharedPointer<connection_t>>
+      connections_;  // <socket descriptor, connection>
+  qint64 high_watermark_;
+  qint64 low_watermark_;
+  int max_in_flight_;
+
+  // the connection may be null if it's already gone, the frame is dropped
+  void deliver_(const QSharedPointer<connection_t> &connection,
+                const QByteArray &data, bool sheddable = false) {
+    if (!connection) {
+      return;
+    }
+    const auto socket_descriptor = connection->socket_descriptor;
+
+    if (sheddable && pending_(*connection) >= high_watermark_) {
+      outbound_stats.shed_notifications.fetchAndAddRelaxed(1);
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | DELIVER] Socket " +
+               QString::number(socket_descriptor) +
+               " is above the high watermark, notification dropped";
+      });
+      return;
+    }
+
+    connection->outbox.append(data);
+    if (!sheddable && trace::current()) {
+      connection->traced.push_back(trace::current());
+    }
+
+    if (!connection->reading_paused &&
+        pending_(*connection) >= high_watermark_) {
+      connection->reading_paused = true;
+      outbound_stats.paused_connections.fetchAndAddRelaxed(1);
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | DELIVER] Socket " +
+               QString::number(socket_descriptor) +
+               " is above the high watermark, reading paused";
+      });
+    }
+
+    if (!connection->flush_scheduled) {
+      connection->flush_scheduled = true;
+      QMetaObject::invokeMethod(
+          this, [=]() { flush_(socket_descriptor); }, Qt::QueuedConnection);
+    }
+  }
+
+  // bytes queued for the client, both ours and Qt's not yet sent ones
+  qint64 pending_(const connection_t &connection) const {
+    return connection.outbox.size() + connection.socket->bytesToWrite();
+  }
+
+  // both wire formats are accepted at any time, they are told apart by the
+  // first byte of the frame
+  void processRequest_(const QByteArray &requestData,
+                       qintptr socket_descriptor) {
+    // a sampled request stays the current one of every thread it reaches,
+    // see trace::Scope
+    const trace::Scope scope(trace::tracer.sample());
+    const auto begin_ns = trace::tracer.now();
+
+    common::result_t<packet::wire_packet_t> request_monad;
+    {
+      const trace::Span span("parse");
+      if (packet::isBinaryPacket(requestData)) {
+        request_monad = packet::binaryDecodePacket(requestData);
+      } else {
+        request_monad = packet::jsonDecodePacket(requestData);
+      }
+    }
+
+    if (request_monad.error) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | PROCESS CONNECTION] Error parsing received packet "
+               "[header section]";
+      });
+      return;
+    }
+
+    if (trace::current()) {
+      trace::tracer.begin(
+          trace::current(),
+          metrics::Registry::name(request_monad.data.header.command),
+          begin_ns);
+    }
+
+    processCommand_(request_monad.unwrap(), socket_descriptor);
+  }
+
+  // every response echoes the id of the request it answers
+  void reply_(const QWeakPointer<connection_t> &client,
+              const QString &request_id, packet::StatusResponse &&response) {
+    response.header_request_id = request_id;
+    send_(client.toStrongRef(), response, false);
+  }
+
+  // a reply that answers call, its latency is recorded with the reply
+  void reply_(const QWeakPointer<connection_t> &client,
+              const metrics::request_t &call,
+              packet::StatusResponse &&response) {
+    answered_(client, call,
+              response.header_status ==
+                  packet::packet_t::header_t::statusToQString(
+                      packet::packet_t::header_t::status_t::OK));
+    reply_(client, call.request_id, std::move(response));
+  }
+
+  // every request dispatched by processCommand_ ends here exactly once;
+  // reading resumes on the next turn if too many were in flight
+  void answered_(const QWeakPointer<connection_t> &client,
+                 const metrics::request_t &call, bool ok) {
+    metrics::registry.record(call, ok);
 
-  QJsonDocument processCommand_(packet::packet_t::header_t::command_t command,
-                                QJsonDocument &&packetData,
-                                qintptr socketDescriptor) {
-    QJsonDocument response;
+    const auto connection = client.toStrongRef();
+    if (!connection) {
+      return;
+    }
+
+    connection->in_flight = qMax(connection->in_flight - 1, 0);
+    if (connection->throttled && connection->in_flight < max_in_flight_) {
+      connection->throttled = false;
+      // captures the weak pointer, a strong one would keep a dropped
+      // connection alive
+      QMetaObject::invokeMethod(
+          this,
+          [this, client]() {
+            if (const auto connection = client.toStrongRef()) {
+              processConnection_(connection->socket_descriptor);
+            }
+          },
+          Qt::QueuedConnection);
+    }
+  }
+
+  packet::packet_t::header_t::codec_t codec_(qintptr socket_descriptor) const {
+    const auto connection = connections_.value(socket_descriptor);
+    return connection ? connection->codec
+                      : packet::packet_t::header_t::codec_t::JSON;
+  }
 
-    switch (command) {
+  // encodes the response in the wire format negotiated by the connection; a
+  // response too big for a frame is replaced with a FAIL, or dropped if it's
+  // a notification
+  void send_(const QSharedPointer<connection_t> &connection,
+             packet::StatusResponse &response, bool sheddable) {
+    if (!connection) {
+      return;
+    }
+
+    QByteArray encoded;
+    {
+      const trace::Span span("serialize");
+      if (connection->codec == packet::packet_t::header_t::codec_t::BINARY) {
+        encoded = frame::encode(response.to_binary());
+      } else {
+        encoded =
+            frame::encode(response.to_json().toJson(QJsonDocument::Compact));
+      }
+    }
+
+    if (frame::oversized(encoded.size() - frame::header_size)) {
+      common::logAll(QtWarningMsg,
+                     "[SERVER | SEND] A response of " +
+                         QString::number(encoded.size()) +
+                         " bytes doesn't fit in a frame, socket " +
+                         QString::number(connection->socket_descriptor));
+      if (sheddable) {
+        return;
+      }
+
+      packet::StatusResponse too_large(
+          packet::packet_t::header_t::command_t::STATUS,
+          packet::packet_t::header_t::status_t::FAIL, "Response too large");
+      too_large.header_request_id = response.header_request_id;
+      send_(connection, too_large, false);
+      return;
+    }
+    deliver_(connection, encoded, sheddable);
+  }
+
+  // parsing happens here, everything that touches the database runs on the
+  // db::executor and replies from a continuation on this worker's thread
+  void processCommand_(packet::wire_packet_t &&request,
+                       qintptr socketDescriptor) {
+    const auto &header = request.header;
+    const auto call = metrics::start(header);
+    // the answers go to this connection, not to whoever holds its socket
+    // descriptor by the time they are ready
+    const QWeakPointer<connection_t> client =
+        connections_.value(socketDescriptor);
+    if (const auto connection = client.toStrongRef()) {
+      ++connection->in_flight;
+    }
+
+    switch (header.command) {
       case packet::packet_t::header_t::command_t::REGISTER: {
-        const auto auth_data = packet::jsonExtractAuthData(packetData);
+        const auto auth_data = request.auth_data;
         if (auth_data.error) {
-          response =
-              packet::StatusResponse(
-                  packet::packet_t::header_t::command_t::STATUS,
-                  packet::packet_t::header_t::status_t::FAIL,
-                  "Error parsing received JSON on register [auth data section]")
-                  .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on register "
+                     "[auth data section]"));
           break;
         }
 
-        if (commandRegister_(auth_data.data)) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::OK,
-                         "Command 'register' completed")
-                         .to_json();
-        } else {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Command 'register' failed")
-                         .to_json();
+        // the executor threads only read, the user is inserted by the
+        // message writer
+        const auto register_done = [=](bool registered) {
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     registered ? packet::packet_t::header_t::status_t::OK
+                                : packet::packet_t::header_t::status_t::FAIL,
+                     registered ? "Command 'register' completed"
+                                : "Command 'register' failed"));
+        };
+        if (!commandRegister_(auth_data.data, register_done)) {
+          register_done(false);
         }
 
         break;
       };
       case packet::packet_t::header_t::command_t::LOGIN: {
-        const auto auth_data = packet::jsonExtractAuthData(packetData);
+        const auto auth_data = request.auth_data;
         if (auth_data.error) {
-          response =
-              packet::StatusResponse(
-                  packet::packet_t::header_t::command_t::STATUS,
-                  packet::packet_t::header_t::status_t::FAIL,
-                  "Error parsing received JSON on login [auth data section]")
-                  .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on login "
+                     "[auth data section]"));
           break;
         }
 
-        const auto session_id_monad =
-            commandLogIn_(auth_data.data, socketDescriptor);
-        if (!session_id_monad.error) {
-          response = packet::AuthResponse(
-                         packet::packet_t::header_t::command_t::AUTH,
-                         packet::packet_t::header_t::status_t::OK,
-                         "Command 'login' completed", session_id_monad.data)
-                         .to_json();
-        } else {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Command 'login' failed")
-                         .to_json();
-        }
+        // only the credentials are checked on the executor, the session is
+        // bound here, where a disconnection can't slip in between the check
+        // of the connection and the binding
+        db::executor.submit(
+            this, [=]() { return commandLogIn_(auth_data.data); },
+            [=](bool credentials_ok) {
+              common::result_t<auth::session_id_t> session_id_monad;
+              const auto connection = client.toStrongRef();
+              if (credentials_ok && connection) {
+                session_id_monad = auth::logInUser(
+                    auth_data.data.username, connection->socket_descriptor);
+              }
+              if (!session_id_monad.error) {
+                reply_(client, call,
+                       packet::AuthResponse(
+                           packet::packet_t::header_t::command_t::AUTH,
+                           packet::packet_t::header_t::status_t::OK,
+                           "Command 'login' completed", session_id_monad.data));
+              } else {
+                reply_(client, call,
+                       packet::StatusResponse(
+                           packet::packet_t::header_t::command_t::STATUS,
+                           packet::packet_t::header_t::status_t::FAIL,
+                           "Command 'login' failed"));
+              }
+            });
 
         break;
       };
       case packet::packet_t::header_t::command_t::LOGOUT: {
-        const auto auth_data = packet::jsonExtractAuthData(packetData);
+        const auto auth_data = request.auth_data;
         if (auth_data.error) {
-          response =
-              packet::StatusResponse(
-                  packet::packet_t::header_t::command_t::STATUS,
-                  packet::packet_t::header_t::status_t::FAIL,
-                  "Error parsing received JSON on logout [auth data section]")
-                  .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on logout "
+                     "[auth data section]"));
           break;
         }
 
-        if (commandLogOut_(auth_data.data)) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::OK,
-                         "Command 'logout' completed")
-                         .to_json();
-        } else {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Command 'logout' failed")
-                         .to_json();
-        }
+        db::executor.submit(
+            this, [=]() { return commandLogOut_(auth_data.data); },
+            [=](bool logged_out) {
+              if (logged_out) {
+                reply_(client, call,
+                       packet::StatusResponse(
+                           packet::packet_t::header_t::command_t::STATUS,
+                           packet::packet_t::header_t::status_t::OK,
+                           "Command 'logout' completed"));
+              } else {
+                reply_(client, call,
+                       packet::StatusResponse(
+                           packet::packet_t::header_t::command_t::STATUS,
+                           packet::packet_t::header_t::status_t::FAIL,
+                           "Command 'logout' failed"));
+              }
+            });
 
         break;
       };
       case packet::packet_t::header_t::command_t::SENDMSG: {
-        const auto auth_data = packet::jsonExtractAuthData(packetData);
+        const auto auth_data = request.auth_data;
         if (auth_data.error) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Error parsing received JSON on "
-                         "send message [auth data section]")
-                         .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on "
+                     "send message [auth data section]"));
           break;
         }
 
-        const auto target_data = packet::jsonExtractTargetData(packetData);
+        const auto target_data = request.target;
         if (target_data.error) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Error parsing received JSON on send "
-                         "message [target data section]")
-                         .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on send "
+                     "message [target data section]"));
           break;
         }
 
-        if (commandSendMsg_(auth_data.data, target_data.data)) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::OK,
-                         "Command 'sendmsg' completed")
-                         .to_json();
-          // send a "notify" packet to the target user
-          sendNotify_(auth_data.data, target_data.data);
-        } else {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Command 'sendmsg' failed")
-                         .to_json();
+        // validation is answered from memory, only the insert is deferred to
+        // the message writer; OK is sent once the message is committed
+        const auto sendmsg_done = [=](bool sent, quint64 message_id) {
+          if (sent) {
+            reply_(client, call,
+                   packet::StatusResponse(
+                       packet::packet_t::header_t::command_t::STATUS,
+                       packet::packet_t::header_t::status_t::OK,
+                       "Command 'sendmsg' completed"));
+            // push the message to the target user
+            sendNotify_(auth_data.data, target_data.data, message_id);
+          } else {
+            reply_(client, call,
+                   packet::StatusResponse(
+                       packet::packet_t::header_t::command_t::STATUS,
+                       packet::packet_t::header_t::status_t::FAIL,
+                       "Command 'sendmsg' failed"));
+          }
+        };
+        if (!commandSendMsg_(auth_data.data, target_data.data, sendmsg_done)) {
+          sendmsg_done(false, 0);
         }
 
         break;
       };
       case packet::packet_t::header_t::command_t::GETMSGS: {
-        const auto auth_data = packet::jsonExtractAuthData(packetData);
+        const auto auth_data = request.auth_data;
         if (auth_data.error) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Error parsing received JSON on "
-                         "get messages [auth data section]")
-                         .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on "
+                     "get messages [auth data section]"));
           break;
         }
 
-        const auto target_data = packet::jsonExtractTargetData(packetData);
+        const auto target_data = request.target;
         if (target_data.error) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Error parsing received JSON on get "
-                         "messages [target data section]")
-                         .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on get "
+                     "messages [target data section]"));
           break;
         }
 
-        const auto target_monad =
-            commandGetMsgs_(auth_data.data, target_data.data);
-        if (!target_monad.error) {
-          response = packet::MsgsResponse(
-                         packet::packet_t::header_t::command_t::MSGS,
-                         packet::packet_t::header_t::status_t::OK,
-                         "Command 'getmsgs' completed",
-                         target_monad.data.username, target_monad.data.messages)
-                         .to_json();
-        } else {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Command 'getmsgs' failed")
-                         .to_json();
-        }
+        // the response is encoded on the executor thread while the rows are
+        // read, only the finished frame comes back to this thread
+        const auto codec = codec_(socketDescriptor);
+        db::executor.submit(
+            this,
+            [=]() {
+              return commandGetMsgs_(auth_data.data, target_data.data,
+                                     header.request_id, codec);
+            },
+            [=](common::result_t<QByteArray> frame_monad) {
+              if (!frame_monad.error) {
+                answered_(client, call, true);
+                deliver_(client.toStrongRef(), frame_monad.data);
+              } else {
+                reply_(client, call,
+                       packet::StatusResponse(
+                           packet::packet_t::header_t::command_t::STATUS,
+                           packet::packet_t::header_t::status_t::FAIL,
+                           "Command 'getmsgs' failed"));
+              }
+            });
 
         break;
       };
       case packet::packet_t::header_t::command_t::GETALLMSGS: {
-        const auto auth_data = packet::jsonExtractAuthData(packetData);
+        const auto auth_data = request.auth_data;
         if (auth_data.error) {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Error parsing received JSON on "
-                         "get messages [auth data section]")
-                         .to_json();
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on "
+                     "get messages [auth data section]"));
           break;
         }
 
-        const auto target_monad = commandGetAllMsgs_(auth_data.data);
-        if (!target_monad.error) {
-          response = packet::AllMsgsResponse(
-                         packet::packet_t::header_t::command_t::ALLMSGS,
-                         packet::packet_t::header_t::status_t::OK,
-                         "Command 'getallmsgs' completed",
-                         target_monad.data.all_messages)
-                         .to_json();
-        } else {
-          response = packet::StatusResponse(
-                         packet::packet_t::header_t::command_t::STATUS,
-                         packet::packet_t::header_t::status_t::FAIL,
-                         "Command 'getallmsgs' failed")
-                         .to_json();
+        // the target section is optional, it only carries the high-water
+        // mark of a delta sync
+        const auto since =
+            request.target.error ? 0 : request.target.data.since;
+        const auto codec = codec_(socketDescriptor);
+        db::executor.submit(
+            this,
+            [=]() {
+              return commandGetAllMsgs_(auth_data.data, since,
+                                        header.request_id, codec);
+            },
+            [=](common::result_t<QByteArray> frame_monad) {
+              if (!frame_monad.error) {
+                answered_(client, call, true);
+                deliver_(client.toStrongRef(), frame_monad.data);
+              } else {
+                reply_(client, call,
+                       packet::StatusResponse(
+                           packet::packet_t::header_t::command_t::STATUS,
+                           packet::packet_t::header_t::status_t::FAIL,
+                           "Command 'getallmsgs' failed"));
+              }
+            });
+
+        break;
+      };
+      case packet::packet_t::header_t::command_t::GETINBOX: {
+        const auto auth_data = request.auth_data;
+        if (auth_data.error) {
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on "
+                     "get inbox [auth data section]"));
+          break;
         }
 
+        db::executor.submit(
+            this, [=]() { return commandGetInbox_(auth_data.data); },
+            [=](common::result_t<QList<
+                    packet::packet_t::payload_t::target_t::conversation_t>>
+                    inbox_monad) {
+              if (!inbox_monad.error) {
+                reply_(client, call,
+                       packet::InboxResponse(
+                           packet::packet_t::header_t::command_t::INBOX,
+                           packet::packet_t::header_t::status_t::OK,
+                           "Command 'getinbox' completed", inbox_monad.data));
+              } else {
+                reply_(client, call,
+                       packet::StatusResponse(
+                           packet::packet_t::header_t::command_t::STATUS,
+                           packet::packet_t::header_t::status_t::FAIL,
+                           "Command 'getinbox' failed"));
+              }
+            });
+
+        break;
+      };
+      case packet::packet_t::header_t::command_t::READ: {
+        const auto auth_data = request.auth_data;
+        if (auth_data.error) {
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on "
+                     "read [auth data section]"));
+          break;
+        }
+
+        const auto target_data = request.target;
+        if (target_data.error) {
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Error parsing received JSON on "
+                     "read [target data section]"));
+          break;
+        }
+
+        // like SENDMSG the read mark is written by the message writer
+        const auto read_done = [=](bool read) {
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     read ? packet::packet_t::header_t::status_t::OK
+                          : packet::packet_t::header_t::status_t::FAIL,
+                     read ? "Command 'read' completed"
+                          : "Command 'read' failed"));
+        };
+        if (!commandRead_(auth_data.data, target_data.data, read_done)) {
+          read_done(false);
+        }
+
+        break;
+      };
+      case packet::packet_t::header_t::command_t::SETCODEC: {
+        const auto connection = connections_.value(socketDescriptor);
+        if (!connection ||
+            (header.codec != packet::packet_t::header_t::codec_t::JSON &&
+             header.codec != packet::packet_t::header_t::codec_t::BINARY)) {
+          reply_(client, call,
+                 packet::StatusResponse(
+                     packet::packet_t::header_t::command_t::STATUS,
+                     packet::packet_t::header_t::status_t::FAIL,
+                     "Command 'setcodec' failed"));
+          break;
+        }
+
+        // the answer already goes out in the new format, the client tells
+        // the formats apart by the first byte of the frame
+        connection->codec = header.codec;
+        reply_(client, call,
+               packet::StatusResponse(
+                   packet::packet_t::header_t::command_t::STATUS,
+                   packet::packet_t::header_t::status_t::OK,
+                   "Command 'setcodec' completed"));
         break;
       };
       case packet::packet_t::header_t::command_t::NOTIFY: {
-        response = packet::StatusResponse(
-                       packet::packet_t::header_t::command_t::STATUS,
-                       packet::packet_t::header_t::status_t::OK,
-                       "Command 'notify' not implemented")
-                       .to_json();
+        reply_(client, call,
+               packet::StatusResponse(
+                   packet::packet_t::header_t::command_t::STATUS,
+                   packet::packet_t::header_t::status_t::OK,
+                   "Command 'notify' not implemented"));
         break;
       };
       default: {
-        response =
-            packet::StatusResponse(
-                packet::packet_t::header_t::command_t::STATUS,
-                packet::packet_t::header_t::status_t::FAIL, "Unknown command")
-                .to_json();
+        reply_(client, call,
+               packet::StatusResponse(
+                   packet::packet_t::header_t::command_t::STATUS,
+                   packet::packet_t::header_t::status_t::FAIL,
+                   "Unknown command"));
         break;
       };
     }
-
-    return response;
   }
 
-  // returns success or failure
-  bool commandRegister_(packet::packet_t::payload_t::auth_data_t auth_data) {
+  // commandRegister_, commandSendMsg_ and commandRead_ run on the worker
+  // thread and hand their writes to db::writer; the other command*_
+  // handlers run on the db::executor threads and must not touch the
+  // worker's own state, connections_ included
+
+  // returns false if the user is rejected, otherwise done(registered) is
+  // called once it's committed
+  template <typename Continuation>
+  bool commandRegister_(packet::packet_t::payload_t::auth_data_t auth_data,
+                        Continuation done) {
     const auto username = auth_data.username;
     if (username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | REGISTER] Can't parse required field [auth data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | REGISTER] Can't parse required field [auth data "
+               "section -> username]";
+      });
       return false;
     }
 
     const auto password = auth_data.password;
     if (password.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | REGISTER] Can't parse required field [auth data "
-          "section -> "
-          "password]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | REGISTER] Can't parse required field [auth data "
+               "section -> password]";
+      });
       return false;
     }
 
-    if (!auth::registerUser(username, password)) {
-      common::logAll(QtDebugMsg, "[SERVER | REGISTER] Can't register");
+    if (!auth::registerUser(username, password, this, std::move(done))) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | REGISTER] Can't register";
+      });
       return false;
     }
 
     return true;
   }
 
-  // returns session_id monad
-  common::result_t<auth::session_id_t> commandLogIn_(
-      packet::packet_t::payload_t::auth_data_t auth_data,
-      qintptr socket_descriptor) {
+  // returns whether the credentials are valid, the session is bound by the
+  // caller on the worker thread
+  bool commandLogIn_(packet::packet_t::payload_t::auth_data_t auth_data) {
     const auto username = auth_data.username;
     if (username.isEmpty()) {
-      common::logAll(QtDebugMsg,
-                     "[SERVER | LOG IN] Can't parse required field [auth data "
-                     "section -> "
-                     "username]");
-      return {};
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | LOG IN] Can't parse required field [auth data "
+               "section -> username]";
+      });
+      return false;
     }
 
     const auto password = auth_data.password;
     if (password.isEmpty()) {
-      common::logAll(QtDebugMsg,
-                     "[SERVER | LOG IN] Can't parse required field [auth data "
-                     "section -> "
-                     "password]");
-      return {};
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | LOG IN] Can't parse required field [auth data "
+               "section -> password]";
+      });
+      return false;
     }
 
-    const auto session_id_monad =
-        auth::logInUser(username, password, socket_descriptor);
-    if (session_id_monad.error) {
-      common::logAll(QtDebugMsg, "[SERVER | LOG IN] Can't log in");
-      return {};
+    if (!auth::checkCredentials(username, password)) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | LOG IN] Can't log in";
+      });
+      return false;
     }
 
-    return session_id_monad;
+    return true;
   }
 
   // returns success or failure
   bool commandLogOut_(packet::packet_t::payload_t::auth_data_t auth_data) {
     const auto session_id = auth_data.session_id;
     if (session_id.isEmpty()) {
-      common::logAll(QtDebugMsg,
-                     "[SERVER | LOG OUT] Can't parse required field [auth data "
-                     "section -> "
-                     "session_id]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | LOG OUT] Can't parse required field [auth data "
+               "section -> session_id]";
+      });
       return false;
     }
 
     const auto username = auth_data.username;
     if (username.isEmpty()) {
-      common::logAll(QtDebugMsg,
-                     "[SERVER | LOG OUT] Can't parse required field [auth data "
-                     "section -> "
-                     "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | LOG OUT] Can't parse required field [auth data "
+               "section -> username]";
+      });
       return false;
     }
 
     if (!auth::logOutUser(session_id, username)) {
-      common::logAll(QtDebugMsg, "[SERVER | LOG OUT] Can't log out");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | LOG OUT] Can't log out";
+      });
       return false;
     }
 
     return true;
   }
 
-  // returns success or failure
+  // returns false if the message is rejected, otherwise done(sent) is called
+  // once it's committed
+  template <typename Continuation>
   bool commandSendMsg_(packet::packet_t::payload_t::auth_data_t auth_data,
-                       packet::packet_t::payload_t::target_t target_data) {
+                       packet::packet_t::payload_t::target_t target_data,
+                       Continuation done) {
     const auto session_id = auth_data.session_id;
     if (session_id.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | SEND MESSAGE] Can't parse required field [auth data "
-          "section -> "
-          "session_id]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND MESSAGE] Can't parse required field [auth data "
+               "section -> session_id]";
+      });
       return false;
     }
 
     const auto sender_username = auth_data.username;
     if (sender_username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | SEND MESSAGE] Can't parse required field [auth data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND MESSAGE] Can't parse required field [auth data "
+               "section -> username]";
+      });
       return false;
     }
 
     const auto target_username = target_data.username;
     if (target_username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | SEND MESSAGE] Can't parse required field [target data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND MESSAGE] Can't parse required field [target "
+               "data section -> username]";
+      });
       return false;
     }
 
     const auto message = target_data.message;
     if (message.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | SEND MESSAGE] Can't parse required field [target data "
-          "section -> "
-          "message]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND MESSAGE] Can't parse required field [target "
+               "data section -> message]";
+      });
       return false;
     }
 
-    if (!msg::sendMsg(session_id, sender_username, target_username, message)) {
-      common::logAll(QtDebugMsg, "[SERVER | SEND MESSAGE] Can't send message");
+    if (!msg::sendMsg(session_id, sender_username, target_username, message,
+                      this, std::move(done))) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND MESSAGE] Can't send message";
+      });
       return false;
     }
 
     return true;
   }
 
-  // returns target_t monad
-  common::result_t<packet::packet_t::payload_t::target_t> commandGetMsgs_(
+  // returns the framed MSGS response monad
+  common::result_t<QByteArray> commandGetMsgs_(
       packet::packet_t::payload_t::auth_data_t auth_data,
-      packet::packet_t::payload_t::target_t target_data) {
+      packet::packet_t::payload_t::target_t target_data,
+      const QString &request_id, packet::packet_t::header_t::codec_t codec) {
     const auto session_id = auth_data.session_id;
     if (session_id.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | GET MESSAGES] Can't parse required field [auth data "
-          "section -> "
-          "session_id]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET MESSAGES] Can't parse required field [auth data "
+               "section -> session_id]";
+      });
       return {};
     }
 
     const auto username = auth_data.username;
     if (username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | GET MESSAGES] Can't parse required field [auth data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET MESSAGES] Can't parse required field [auth data "
+               "section -> username]";
+      });
       return {};
     }
 
     const auto target_username = target_data.username;
     if (target_username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | GET MESSAGES] Can't parse required field [target data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET MESSAGES] Can't parse required field [target "
+               "data section -> username]";
+      });
       return {};
     }
 
-    const auto target_monad =
-        msg::getMsgs(session_id, username, target_username);
-    if (target_monad.error) {
-      common::logAll(QtDebugMsg, "[SERVER | GET MESSAGES] Can't get messages");
+    common::result_t<QByteArray> frame_monad;
+    const auto offset = frame::beginFrame(frame_monad.data);
+    packet::HistoryWriter writer(
+        frame_monad.data, codec,
+        historyHeader_(packet::packet_t::header_t::command_t::MSGS,
+                       "Command 'getmsgs' completed", request_id),
+        target_username);
+
+    db::page_t page;
+    page.before = target_data.before;
+    page.after = target_data.after;
+    page.limit = target_data.limit;
+
+    const auto next_monad = msg::visitMsgs(
+        session_id, username, target_username,
+        [&](const QString &side, const QString &message) {
+          writer.message(side, message);
+        },
+        page);
+    if (next_monad.error) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET MESSAGES] Can't get messages";
+      });
       return {};
     }
 
-    return target_monad;
+    writer.finish(next_monad.data);
+    if (!frame::endFrame(frame_monad.data, offset)) {
+      common::logAll(QtWarningMsg,
+                     "[SERVER | GET MESSAGES] The conversation of " +
+                         username + " with " + target_username +
+                         " doesn't fit in a frame, it must be paged");
+      return {};
+    }
+    frame_monad.error = false;
+
+    return frame_monad;
   }
 
-  // returns target_t monad
-  common::result_t<packet::packet_t::payload_t::target_t> commandGetAllMsgs_(
-      packet::packet_t::payload_t::auth_data_t auth_data) {
+  // returns the framed ALLMSGS response monad, with since only the messages
+  // newer than it
+  common::result_t<QByteArray> commandGetAllMsgs_(
+      packet::packet_t::payload_t::auth_data_t auth_data, const quint64 since,
+      const QString &request_id, packet::packet_t::header_t::codec_t codec) {
     const auto session_id = auth_data.session_id;
     if (session_id.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | GET ALL MESSAGES] Can't parse required field [auth data "
-          "section -> "
-          "session_id]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET ALL MESSAGES] Can't parse required field [auth "
+               "data section -> session_id]";
+      });
       return {};
     }
 
     const auto username = auth_data.username;
     if (username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | GET ALL MESSAGES] Can't parse required field [auth data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET ALL MESSAGES] Can't parse required field [auth "
+               "data section -> username]";
+      });
       return {};
     }
 
-    const auto target_monad = msg::getAllMsgs(session_id, username);
-    if (target_monad.error) {
-      common::logAll(QtDebugMsg,
-                     "[SERVER | GET ALL MESSAGES] Can't get all messages");
+    common::result_t<QByteArray> frame_monad;
+    const auto offset = frame::beginFrame(frame_monad.data);
+    packet::HistoryWriter writer(
+        frame_monad.data, codec,
+        historyHeader_(packet::packet_t::header_t::command_t::ALLMSGS,
+                       "Command 'getallmsgs' completed", request_id));
+
+    QString current_username;
+    const auto last_monad = msg::visitAllMsgs(
+        session_id, username,
+        [&](const QString &target_username, const QString &side,
+            const QString &message) {
+          if (writer.messages() == 0 || target_username != current_username) {
+            current_username = target_username;
+            writer.conversation(target_username);
+          }
+          writer.message(side, message);
+        },
+        since);
+    if (last_monad.error) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET ALL MESSAGES] Can't get all messages";
+      });
       return {};
     }
 
-    return target_monad;
+    writer.finish(last_monad.data);
+    if (!frame::endFrame(frame_monad.data, offset)) {
+      common::logAll(QtWarningMsg,
+                     "[SERVER | GET ALL MESSAGES] The history of " + username +
+                         " doesn't fit in a frame, it must be synced from a "
+                         "high-water mark");
+      return {};
+    }
+    frame_monad.error = false;
+
+    return frame_monad;
+  }
+
+  // returns the inbox monad
+  common::result_t<
+      QList<packet::packet_t::payload_t::target_t::conversation_t>>
+  commandGetInbox_(packet::packet_t::payload_t::auth_data_t auth_data) {
+    const auto session_id = auth_data.session_id;
+    if (session_id.isEmpty()) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET INBOX] Can't parse required field [auth data "
+               "section -> session_id]";
+      });
+      return {};
+    }
+
+    const auto username = auth_data.username;
+    if (username.isEmpty()) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | GET INBOX] Can't parse required field [auth data "
+               "section -> username]";
+      });
+      return {};
+    }
+
+    return msg::getInbox(session_id, username);
+  }
+
+  // returns false if the read mark is rejected, otherwise done(read) is
+  // called once it's committed
+  template <typename Continuation>
+  bool commandRead_(packet::packet_t::payload_t::auth_data_t auth_data,
+                    packet::packet_t::payload_t::target_t target_data,
+                    Continuation done) {
+    const auto session_id = auth_data.session_id;
+    if (session_id.isEmpty()) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | READ] Can't parse required field [auth data section "
+               "-> session_id]";
+      });
+      return false;
+    }
+
+    const auto username = auth_data.username;
+    if (username.isEmpty()) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | READ] Can't parse required field [auth data section "
+               "-> username]";
+      });
+      return false;
+    }
+
+    const auto target_username = target_data.username;
+    if (target_username.isEmpty()) {
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | READ] Can't parse required field [target data "
+               "section -> username]";
+      });
+      return false;
+    }
+
+    return msg::readConversation(session_id, username, target_username, this,
+                                 std::move(done));
+  }
+
+  static packet::packet_t::header_t historyHeader_(
+      packet::packet_t::header_t::command_t command, const QString &msg,
+      const QString &request_id) {
+    packet::packet_t::header_t header;
+    header.command = command;
+    header.status = packet::packet_t::header_t::status_t::OK;
+    header.msg = msg;
+    header.request_id = request_id;
+    return header;
   }
 
   // background dispatch
+  // the notification carries the message, so the target appends it without
+  // asking for the conversation again
   void sendNotify_(packet::packet_t::payload_t::auth_data_t auth_data,
-                   packet::packet_t::payload_t::target_t target_data) {
+                   packet::packet_t::payload_t::target_t target_data,
+                   const quint64 message_id) {
     const auto username = auth_data.username;
     if (username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | SEND NOTIFY] Can't parse required field [auth data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND NOTIFY] Can't parse required field [auth data "
+               "section -> username]";
+      });
       return;
     }
 
     const auto target_username = target_data.username;
     if (target_username.isEmpty()) {
-      common::logAll(
-          QtDebugMsg,
-          "[SERVER | SEND NOTIFY] Can't parse required field [target data "
-          "section -> "
-          "username]");
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND NOTIFY] Can't parse required field [target data "
+               "section -> username]";
+      });
       return;
     }
 
+    // runs on the worker thread, the target was already checked by
+    // msg::sendMsg, so only the in-memory session store is consulted here
     const auto socket_descriptor_monad =
-        auth::getSocketDescriptor(target_username);
+        auth::sessions.getSocketDescriptor(target_username);
     if (socket_descriptor_monad.error) {
-      common::logAll(QtDebugMsg,
-                     "[SERVER | SEND NOTIFY] Can't get the socket descriptor "
-                     "of the target user " +
-                         target_username);
+      common::logAll(QtDebugMsg, [&]() {
+        return "[SERVER | SEND NOTIFY] Can't get the socket descriptor of the "
+               "target user " + target_username;
+      });
       return;
     }
 
-    const auto socket = sockets_.value(socket_descriptor_monad.data);
+    const auto target_socket_descriptor = socket_descriptor_monad.data;
+    const auto worker = registry.get(target_socket_descriptor);
+    if (!worker) {
+      return;
+    }
 
-    const auto response =
-        packet::NotifyResponse(packet::packet_t::header_t::command_t::NOTIFY,
-                               packet::packet_t::header_t::status_t::OK,
-                               "Notify", username)
-            .to_json();
+    auto response = packet::NotifyResponse(
+        packet::packet_t::header_t::command_t::NOTIFY,
+        packet::packet_t::header_t::status_t::OK, "Notify", username);
+    response.payload_target_message_id = message_id;
+    response.payload_target_message = {
+        username == target_username
+            ? packet::response_json_tags::payload_target_messages_y
+            : packet::response_json_tags::payload_target_messages_t,
+        target_data.message};
+
+    // encoded by the target's worker, which knows the target's wire format
+    if (worker == this) {
+      notify(target_socket_descriptor, target_username, response);
+    } else {
+      QMetaObject::invokeMethod(
+          worker,
+          [=]() {
+            worker->notify(target_socket_descriptor, target_username, response);
+          },
+          Qt::QueuedConnection);
+    }
 
-    socket->write(response.toJson(QJsonDocument::Indented));
-    socket->flush();
+    common::logAll(QtDebugMsg, [&]() {
+      return "[SERVER | SEND NOTIFY] Sent a notification to user " +
+             target_username;
+    });
+  }
+};
+
+class Server : public QTcpServer {
+ public:
+  explicit Server(const config::config_t &config, QObject *parent = nullptr)
+      : QTcpServer(parent) {
+    if (config.workers == 0) {
+      workers_.push_back(new Worker(config, this));
+    } else {
+      for (int i = 0; i < config.workers; ++i) {
+        auto thread = new QThread(this);
+        thread->setObjectName("worker " + QString::number(i));
+
+        auto worker = new Worker(config);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+
+        thread->start();
+
+        threads_.push_back(thread);
+        workers_.push_back(worker);
+      }
+    }
+
+    db::executor.setThreadCount(config.db_threads);
+    db::writer.start(config.batch_size, config.batch_interval);
+    db::db.configureTailCache(config.tail_length, config.tail_cache);
+
+    if (config.stats_interval > 0) {
+      connect(&statsTimer_, &QTimer::timeout, this, &Server::logStats_);
+      statsTimer_.start(config.stats_interval * 1000);
+    }
+
+    if (config.metrics_port > 0) {
+      metrics_.start(config.metrics_port);
+    }
+
+    if (trace::tracer.enabled()) {
+      connect(&traceTimer_, &QTimer::timeout, this,
+              []() { trace::tracer.flush(); });
+      traceTimer_.start(trace_flush_interval_ms);
+    }
+
+    if (!listen(QHostAddress::Any, config.port)) {
+      common::logAll(QtFatalMsg,
+                     "[SERVER | CONSTRUCTOR] Unable to start the server: " +
+                         errorString());
+      QCoreApplication::exit(EXIT_FAILURE);
+    }
+  }
+
+  ~Server() {
+    // pending continuations are posted to the workers, so the DB threads and
+    // the message writer have to finish before the worker threads go away
+    db::executor.waitForDone();
+    db::writer.stop();
+
+    for (auto thread : threads_) {
+      thread->quit();
+      thread->wait();
+    }
+  }
+
+ protected:
+  // hands the accepted descriptor to the workers in round-robin order, the
+  // socket object is created on the thread of its worker
+  void incomingConnection(qintptr socket_descriptor) override {
+    const auto worker = workers_[next_worker_];
+    next_worker_ = (next_worker_ + 1) % workers_.size();
+
+    QMetaObject::invokeMethod(
+        worker, [=]() { worker->addConnection(socket_descriptor); });
+  }
+
+ private:
+  QList<QThread *> threads_;
+  QList<Worker *> workers_;
+  qsizetype next_worker_ = 0;
+  QTimer statsTimer_;
+  QTimer traceTimer_;
+  metrics::Endpoint metrics_{&Server::scrapeMetrics_};
+
+  // called on the main thread for every scrape, the request metrics are
+  // recorded by the workers and the gauges are sampled here
+  static QByteArray scrapeMetrics_() {
+    const auto executor_stats = db::executor.stats();
+    const auto writer_stats = db::writer.stats();
+    return metrics::registry.render(
+        {{"yachat_active_sessions", "Users logged in.",
+          static_cast<qint64>(auth::sessions.size())},
+         {"yachat_db_queue_depth", "Queries waiting for a DB thread.",
+          executor_stats.queue_depth},
+         {"yachat_db_running", "Queries being executed.",
+          executor_stats.running},
+         {"yachat_writer_queue_depth", "Writes waiting for their commit.",
+          writer_stats.queue_depth},
+         {"yachat_paused_connections",
+          "Connections not read while their client catches up.",
+          outbound_stats.paused_connections.loadRelaxed()}});
+  }
+
+  void logStats_() {
+    const auto stats = db::executor.stats();
+    const auto average_wait_us =
+        stats.completed ? stats.total_wait_us / stats.completed : 0;
+
+    common::logAll(QtInfoMsg, [&]() {
+      return "[SERVER | STATS] DB queue depth " +
+             QString::number(stats.queue_depth) + ", running " +
+             QString::number(stats.running) + ", completed " +
+             QString::number(stats.completed) + ", average wait " +
+             QString::number(average_wait_us) + " us, max wait " +
+             QString::number(stats.max_wait_us) + " us, paused connections " +
+             QString::number(outbound_stats.paused_connections.loadRelaxed()) +
+             ", shed notifications " +
+             QString::number(outbound_stats.shed_notifications.loadRelaxed());
+    });
+
+    const auto statement_stats = db::db.statementStats();
+    const auto pool_stats = db::db.poolStats();
+    common::logAll(QtInfoMsg, [&]() {
+      return "[SERVER | STATS] DB statement cache hits " +
+             QString::number(statement_stats.hits) + ", misses " +
+             QString::number(statement_stats.misses) +
+             ", read-only connections " + QString::number(pool_stats.readers) +
+             ", read-write connections " + QString::number(pool_stats.writers);
+    });
+
+    const auto writer_stats = db::writer.stats();
+    const auto average_batch =
+        writer_stats.batches
+            ? (writer_stats.messages + writer_stats.failed) /
+                  writer_stats.batches
+            : 0;
+    const auto average_commit_us =
+        writer_stats.batches
+            ? writer_stats.total_commit_us / writer_stats.batches
+            : 0;
+    common::logAll(QtInfoMsg, [&]() {
+      return "[SERVER | STATS] Message writer queue depth " +
+             QString::number(writer_stats.queue_depth) +
+             ", commits (WAL syncs) " + QString::number(writer_stats.batches) +
+             ", messages " + QString::number(writer_stats.messages) +
+             ", failed " + QString::number(writer_stats.failed) +
+             ", average batch " + QString::number(average_batch) +
+             ", max batch " + QString::number(writer_stats.max_batch) +
+             ", average commit " + QString::number(average_commit_us) +
+             " us, max commit " + QString::number(writer_stats.max_commit_us) +
+             " us";
+    });
+
+    const auto tail_stats = db::db.tailCacheStats();
+    const auto tail_lookups = tail_stats.hits + tail_stats.misses;
+    common::logAll(QtInfoMsg, [&]() {
+      return "[SERVER | STATS] Tail cache hits " +
+             QString::number(tail_stats.hits) + ", misses " +
+             QString::number(tail_stats.misses) + ", hit rate " +
+             QString::number(tail_lookups
+                                 ? tail_stats.hits * 100 / tail_lookups
+                                 : 0) +
+             "%, " + QString::number(tail_stats.conversations) +
+             " conversations, ~" + QString::number(tail_stats.bytes / 1024) +
+             " KiB";
+    });
+
+    const auto logger_stats = common::logger.stats();
+    common::logAll(QtInfoMsg, [&]() {
+      return "[SERVER | STATS] Logger lines " +
+             QString::number(logger_stats.written) + ", dropped " +
+             QString::number(logger_stats.dropped) + ", journal writes " +
+             QString::number(logger_stats.batches);
+    });
+
+    if (trace::tracer.enabled()) {
+      const auto trace_stats = trace::tracer.stats();
+      common::logAll(QtInfoMsg, [&]() {
+        return "[SERVER | STATS] Traced requests " +
+               QString::number(trace_stats.sampled) + ", events " +
+               QString::number(trace_stats.events) + ", dropped " +
+               QString::number(trace_stats.dropped);
+      });
+    }
 
-    common::logAll(QtDebugMsg,
-                   "[SERVER | SEND NOTIFY] Sent a notification to user " +
-                       target_username);
+    const auto directory_stats = db::db.directoryStats();
+    common::logAll(QtInfoMsg, [&]() {
+      return "[SERVER | STATS] User directory " +
+             QString::number(directory_stats.users) + " users, ~" +
+             QString::number(directory_stats.bytes / 1024) + " KiB";
+    });
   }
 };
 
-};  // namespace server
\ No newline at end of file
+};  // namespace server
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QCache>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <limits>
+
+namespace db {
+
+struct tail_cache_stats_t {
+  quint64 hits = 0;    // GETMSGS pages answered from memory
+  quint64 misses = 0;  // pages read from the database
+  qsizetype conversations = 0;
+  qsizetype bytes = 0;  // approximate heap footprint of the cached tails
+};
+
+// the last messages of the most recently read conversations, so paging
+// through the recent part of a hot conversation never reaches SQLite. A tail
+// is loaded on the first miss and then kept up to date by every committed
+// message; the least recently used tails are dropped once the cache holds
+// more than its budget of bytes. Messages inserted behind the server's back
+// aren't seen until their tail is dropped
+class TailCache {
+ public:
+  struct message_t {
+    quint64 message_id = 0;
+    quint64 sender_id = 0;
+    QString message;
+  };
+
+  TailCache() { cache_.setMaxCost(0); }
+  TailCache(const TailCache&) = delete;
+  TailCache& operator=(const TailCache&) = delete;
+
+  // length messages per conversation, 0 bytes disables the cache
+  void configure(const qsizetype length, const qsizetype bytes) {
+    QMutexLocker locker(&mutex_);
+    length_ = qMax<qsizetype>(length, 1);
+    cache_.clear();
+    cache_.setMaxCost(qMax<qsizetype>(bytes, 0));
+  }
+
+  qsizetype length() const {
+    QMutexLocker locker(&mutex_);
+    return length_;
+  }
+
+  // rows gets the page of the conversation in visiting order (oldest first)
+  // and next its cursor, as DB::visitMsgs would; false if the tail doesn't
+  // cover the page. Lookups are counted by the caller, see record()
+  bool page(const quint64 user_id, const quint64 peer_id, const quint64 before,
+            const quint64 after, const quint64 limit, const bool backward,
+            QList<message_t>& rows, quint64& next) {
+    const auto upper =
+        before != 0 ? before : std::numeric_limits<quint64>::max();
+
+    QMutexLocker locker(&mutex_);
+    const auto* entry = cache_.object(key_(user_id, peer_id));
+    if (!entry || entry->loading || !covers_(*entry, upper, after, limit,
+                                             backward)) {
+      return false;
+    }
+
+    rows.clear();
+    next = 0;
+    const auto& messages = entry->messages;
+    if (backward) {
+      // the newest limit messages below upper
+      auto end = messages.size();
+      while (end > 0 && messages[end - 1].message_id >= upper) {
+        --end;
+      }
+      const auto begin = qMax<qsizetype>(end - limit, 0);
+      rows = messages.mid(begin, end - begin);
+      // older messages than an incomplete tail's are in the database
+      if ((begin > 0 || !entry->complete) && !rows.isEmpty()) {
+        next = rows.front().message_id;
+      }
+    } else {
+      for (const auto& message : messages) {
+        if (message.message_id <= after || message.message_id >= upper) {
+          continue;
+        }
+        if (limit != 0 && static_cast<quint64>(rows.size()) == limit) {
+          next = rows.back().message_id;
+          break;
+        }
+        rows.push_back(message);
+      }
+    }
+
+    return true;
+  }
+
+  // a GETMSGS page answered without (hit) or with the database
+  void record(const bool hit) {
+    (hit ? hits_ : misses_).fetchAndAddRelaxed(1);
+  }
+
+  // reserves the conversation for the caller to load, false if it's already
+  // cached or being loaded, or if the cache is disabled; messages committed
+  // meanwhile are kept aside for fill()
+  bool reserve(const quint64 user_id, const quint64 peer_id) {
+    QMutexLocker locker(&mutex_);
+    const auto key = key_(user_id, peer_id);
+    if (cache_.maxCost() == 0 || cache_.contains(key)) {
+      return false;
+    }
+
+    auto* entry = new entry_t;
+    entry->loading = true;
+    return cache_.insert(key, entry, cost_(*entry));
+  }
+
+  // the tail read after reserve(), oldest first; complete if it's the whole
+  // conversation
+  void fill(const quint64 user_id, const quint64 peer_id,
+            QList<message_t>&& tail, const bool complete) {
+    QMutexLocker locker(&mutex_);
+    const auto key = key_(user_id, peer_id);
+    auto* entry = cache_.take(key);
+    if (!entry) {
+      return;  // evicted while it was read
+    }
+
+    const auto written = std::move(entry->written);
+    entry->messages = std::move(tail);
+    entry->complete = complete;
+    entry->loading = false;
+    entry->written.clear();
+    for (const auto& message : written) {
+      append_(*entry, message);
+    }
+
+    cache_.insert(key, entry, cost_(*entry));
+  }
+
+  // gives up a reservation whose tail couldn't be read, the next miss
+  // reserves the conversation again
+  void cancel(const quint64 user_id, const quint64 peer_id) {
+    QMutexLocker locker(&mutex_);
+    const auto key = key_(user_id, peer_id);
+    const auto* entry = cache_.object(key);
+    if (entry && entry->loading) {
+      cache_.remove(key);
+    }
+  }
+
+  // a committed message, only conversations already cached are updated
+  void append(const quint64 from_user_id, const quint64 to_user_id,
+              const message_t& message) {
+    QMutexLocker locker(&mutex_);
+    const auto key = key_(from_user_id, to_user_id);
+    auto* entry = cache_.take(key);
+    if (!entry) {
+      return;
+    }
+
+    if (entry->loading) {
+      entry->written.push_back(message);
+    } else {
+      append_(*entry, message);
+    }
+
+    cache_.insert(key, entry, cost_(*entry));
+  }
+
+  tail_cache_stats_t stats() const {
+    QMutexLocker locker(&mutex_);
+
+    tail_cache_stats_t stats;
+    stats.hits = hits_.loadRelaxed();
+    stats.misses = misses_.loadRelaxed();
+    stats.conversations = cache_.count();
+    stats.bytes = cache_.totalCost();
+    return stats;
+  }
+
+ private:
+  using key_t = QPair<quint64, quint64>;  // the lower user id first
+
+  struct entry_t {
+    QList<message_t> messages;  // oldest first, at most length_
+    bool complete = false;      // messages is the whole conversation
+    bool loading = false;       // reserved, not filled yet
+    QList<message_t> written;   // committed while loading
+  };
+
+  mutable QMutex mutex_;
+  QCache<key_t, entry_t> cache_;
+  qsizetype length_ = 1;
+
+  QAtomicInteger<quint64> hits_;
+  QAtomicInteger<quint64> misses_;
+
+  static key_t key_(const quint64 user_id, const quint64 peer_id) {
+    return {qMin(user_id, peer_id), qMax(user_id, peer_id)};
+  }
+
+  // every message with an id above after, or the limit newest ones below
+  // upper, must be in the tail to answer like the database would; an
+  // incomplete tail has older messages behind it, so a full page ending at
+  // its oldest message still has a next page
+  static bool covers_(const entry_t& entry, const quint64 upper,
+                      const quint64 after, const quint64 limit,
+                      const bool backward) {
+    if (entry.complete) {
+      return true;
+    }
+    if (entry.messages.isEmpty()) {
+      return false;
+    }
+
+    if (!backward) {
+      return after >= entry.messages.front().message_id;
+    }
+
+    quint64 below = 0;
+    for (const auto& message : entry.messages) {
+      below += message.message_id < upper;
+    }
+    return below >= limit;
+  }
+
+  void append_(entry_t& entry, const message_t& message) const {
+    // a message read with the tail may be committed again by the writer
+    if (!entry.messages.isEmpty() &&
+        message.message_id <= entry.messages.back().message_id) {
+      return;
+    }
+
+    entry.messages.push_back(message);
+    if (entry.messages.size() > length_) {
+      entry.messages.remove(0, entry.messages.size() - length_);
+      entry.complete = false;
+    }
+  }
+
+  static qsizetype cost_(const entry_t& entry) {
+    qsizetype bytes = sizeof(entry_t) + sizeof(key_t);
+    for (const auto& message : entry.messages) {
+      bytes += sizeof(message_t) + message.message.capacity() * sizeof(QChar);
+    }
+    for (const auto& message : entry.written) {
+      bytes += sizeof(message_t) + message.message.capacity() * sizeof(QChar);
+    }
+    return bytes;
+  }
+};
+
+};  // namespace db
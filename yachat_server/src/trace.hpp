@@ -0,0 +1,270 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QRandomGenerator>
+#include <QString>
+#include <QThread>
+#include <utility>
+
+#include "common.hpp"
+
+namespace trace {
+
+// a sampled request, 0 for the ones that aren't traced
+using trace_id_t = quint64;
+
+struct tracer_stats_t {
+  quint64 sampled = 0;  // requests traced since startup
+  quint64 events = 0;   // events written to the trace file
+  quint64 dropped = 0;  // events lost because too many were buffered
+};
+
+// the request the calling thread is working for, see Scope
+trace_id_t& current_() {
+  thread_local trace_id_t current = 0;
+  return current;
+}
+
+trace_id_t current() { return current_(); }
+
+// the phases of a sampled request, recorded as Chrome trace events (the
+// JSON array format, which a viewer opens even while the array is still
+// being appended to). Each phase is a complete event on the thread that ran
+// it, tagged with the request id, and the whole request is an async event
+// from the moment it's read to the moment its reply is written. Events are
+// buffered in memory and appended to the file by flush(); requests that
+// aren't sampled only pay for a thread-local read
+class Tracer {
+ public:
+  static constexpr qsizetype max_buffered = 1 << 20;
+
+  Tracer() = default;
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  ~Tracer() { stop(); }
+
+  // traces a share rate (0 to 1) of the requests into path, 0 disables
+  // tracing
+  void start(const double rate, const QString& path) {
+    if (rate <= 0 || file_.isOpen()) {
+      return;
+    }
+
+    file_.setFileName(path);
+    if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      common::logAll(QtWarningMsg,
+                     "[TRACE] Can't open the trace file " + path);
+      return;
+    }
+    file_.write("[\n");
+
+    clock_.start();
+    rate_ = qMin(rate, 1.0);
+    enabled_.storeRelease(1);
+  }
+
+  // writes what's buffered, the array is left open as the format allows
+  void stop() {
+    if (!enabled_.loadAcquire()) {
+      return;
+    }
+
+    enabled_.storeRelease(0);
+    flush();
+    file_.close();
+  }
+
+  bool enabled() const { return enabled_.loadRelaxed(); }
+
+  // a new request id if the request is sampled, otherwise 0
+  trace_id_t sample() {
+    if (!enabled_.loadRelaxed() ||
+        QRandomGenerator::global()->generateDouble() >= rate_) {
+      return 0;
+    }
+    sampled_.fetchAndAddRelaxed(1);
+    return next_id_.fetchAndAddRelaxed(1) + 1;
+  }
+
+  // nanoseconds since start(), the time base of every event
+  qint64 now() const { return enabled() ? clock_.nsecsElapsed() : 0; }
+
+  // a phase of request id that ran on the calling thread
+  void complete(const trace_id_t id, const char* name, const qint64 begin_ns,
+                const qint64 end_ns) {
+    push_({'X', name, id, begin_ns, end_ns - begin_ns, tid_()});
+  }
+
+  // the whole request, named after its command; it ends once its reply is
+  // written
+  void begin(const trace_id_t id, const char* name, const qint64 begin_ns) {
+    {
+      QMutexLocker locker(&mutex_);
+      open_.insert(id, name);
+    }
+    push_({'b', name, id, begin_ns, 0, tid_()});
+  }
+
+  void end(const trace_id_t id) {
+    const char* name = nullptr;
+    {
+      QMutexLocker locker(&mutex_);
+      name = open_.take(id);
+    }
+    if (name) {
+      push_({'e', name, id, now(), 0, tid_()});
+    }
+  }
+
+  // appends the buffered events to the trace file, called periodically on
+  // the main thread
+  void flush() {
+    QList<event_t> events;
+    {
+      QMutexLocker locker(&mutex_);
+      events.swap(events_);
+    }
+    if (events.isEmpty() || !file_.isOpen()) {
+      return;
+    }
+
+    QByteArray out;
+    for (const auto& event : events) {
+      out += QJsonDocument(toJson_(event)).toJson(QJsonDocument::Compact);
+      out += ",\n";
+    }
+    file_.write(out);
+    file_.flush();
+    written_.fetchAndAddRelaxed(events.size());
+  }
+
+  tracer_stats_t stats() const {
+    tracer_stats_t stats;
+    stats.sampled = sampled_.loadRelaxed();
+    stats.events = written_.loadRelaxed();
+    stats.dropped = dropped_.loadRelaxed();
+    return stats;
+  }
+
+ private:
+  struct event_t {
+    char phase = 'X';  // X complete, b/e async begin/end, M thread name
+    const char* name = nullptr;  // a string literal
+    trace_id_t id = 0;
+    qint64 begin_ns = 0;
+    qint64 duration_ns = 0;
+    int tid = 0;
+    QString thread_name;  // M only
+  };
+
+  QAtomicInt enabled_;
+  double rate_ = 0;
+  QElapsedTimer clock_;
+  QFile file_;
+
+  QMutex mutex_;
+  QList<event_t> events_;
+  QHash<trace_id_t, const char*> open_;  // <request, name> not ended yet
+
+  QAtomicInteger<trace_id_t> next_id_;
+  QAtomicInt next_tid_;
+  QAtomicInteger<quint64> sampled_;
+  QAtomicInteger<quint64> written_;
+  QAtomicInteger<quint64> dropped_;
+
+  // small ids in the order threads first record an event, the thread name
+  // is recorded along with it
+  int tid_() {
+    thread_local int tid = 0;
+    if (tid == 0) {
+      tid = next_tid_.fetchAndAddRelaxed(1) + 1;
+      auto name = QThread::currentThread()->objectName();
+      if (name.isEmpty()) {
+        name = "thread " + QString::number(tid);
+      }
+      push_({'M', "thread_name", 0, 0, 0, tid, name});
+    }
+    return tid;
+  }
+
+  void push_(event_t&& event) {
+    QMutexLocker locker(&mutex_);
+    if (events_.size() >= max_buffered) {
+      dropped_.fetchAndAddRelaxed(1);
+      return;
+    }
+    events_.push_back(std::move(event));
+  }
+
+  static QJsonObject toJson_(const event_t& event) {
+    QJsonObject json;
+    json.insert("name", event.name);
+    json.insert("ph", QString(QChar(event.phase)));
+    json.insert("pid", 1);
+    json.insert("tid", event.tid);
+
+    if (event.phase == 'M') {
+      json.insert("args", QJsonObject{{"name", event.thread_name}});
+      return json;
+    }
+
+    json.insert("ts", event.begin_ns / 1000.0);  // microseconds
+    json.insert("args",
+                QJsonObject{{"request", static_cast<qint64>(event.id)}});
+    if (event.phase == 'X') {
+      json.insert("dur", event.duration_ns / 1000.0);
+    } else {
+      json.insert("cat", "request");
+      json.insert("id", static_cast<qint64>(event.id));
+    }
+    return json;
+  }
+};
+
+Tracer tracer;
+
+// makes id the current request of the calling thread for its lifetime, the
+// spans opened meanwhile belong to it
+class Scope {
+ public:
+  explicit Scope(const trace_id_t id) : previous_(current_()) {
+    current_() = id;
+  }
+  ~Scope() { current_() = previous_; }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  trace_id_t previous_;
+};
+
+// records its own lifetime as a phase of the current request, if any
+class Span {
+ public:
+  explicit Span(const char* name)
+      : id_(current_()), name_(name), begin_ns_(id_ ? tracer.now() : 0) {}
+  ~Span() {
+    if (id_) {
+      tracer.complete(id_, name_, begin_ns_, tracer.now());
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+ private:
+  trace_id_t id_;
+  const char* name_;
+  qint64 begin_ns_;
+};
+
+};  // namespace trace
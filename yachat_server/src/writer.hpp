@@ -0,0 +1,339 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMetaObject>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QScopedPointer>
+#include <QThread>
+#include <QWaitCondition>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "common.hpp"
+#include "db.hpp"
+#include "trace.hpp"
+
+namespace db {
+
+struct writer_stats_t {
+  qint64 queue_depth = 0;        // entries waiting for their batch
+  quint64 batches = 0;           // transactions, with synchronous = FULL
+                                 // each committed one syncs the WAL once
+  quint64 messages = 0;          // messages committed since startup
+  quint64 failed = 0;            // entries whose statement or batch failed
+  quint64 max_batch = 0;         // the most entries committed at once
+  quint64 total_commit_us = 0;   // time spent inserting and committing
+  quint64 max_commit_us = 0;     // the slowest batch
+};
+
+// write-behind path of sent messages: they are queued and inserted by one
+// thread in a single transaction per batch, so many messages share one WAL
+// sync; a batch is committed once batch_size messages are queued or the
+// oldest one has waited batch_interval_ms, whichever comes first. It's the
+// only thread writing after startup, the others have read-only connections
+// (see ConnectionPool), so every other write goes through it as well
+class MessageWriter {
+ public:
+  MessageWriter() = default;
+  MessageWriter(const MessageWriter&) = delete;
+  MessageWriter& operator=(const MessageWriter&) = delete;
+
+  ~MessageWriter() { stop(); }
+
+  // must be called after DB::open, the writer thread opens its own
+  // connection
+  void start(const int batch_size, const int batch_interval_ms) {
+    batch_size_ = qMax(batch_size, 1);
+    batch_interval_ms_ = qMax(batch_interval_ms, 0);
+    stopping_ = false;
+
+    thread_.reset(QThread::create([this]() { run_(); }));
+    thread_->setObjectName("message writer");
+    thread_->start();
+  }
+
+  // commits what's queued and joins the writer thread, used on shutdown
+  void stop() {
+    if (!thread_) {
+      return;
+    }
+
+    {
+      QMutexLocker locker(&mutex_);
+      stopping_ = true;
+      wake_.wakeOne();
+    }
+
+    thread_->wait();
+    thread_.reset();
+  }
+
+  // queues the message and calls continuation(committed) on the thread of
+  // context once its batch is committed (or has failed); the continuation is
+  // dropped if context is gone by then. A continuation taking a second
+  // quint64 also gets the id of the message (0 if it failed)
+  template <typename Continuation>
+  void submit(QObject* context, const quint64 from_user_id,
+              const quint64 to_user_id, const QString& message,
+              Continuation continuation) {
+    pending_t pending;
+    pending.kind = pending_t::kind_t::MESSAGE;
+    pending.from_user_id = from_user_id;
+    pending.to_user_id = to_user_id;
+    pending.message = message;
+    enqueue_(std::move(pending), context, std::move(continuation));
+  }
+
+  // marks the conversation of user_id with peer_id read, in the same batches
+  // as the messages so the writer stays the only one writing
+  template <typename Continuation>
+  void submitRead(QObject* context, const quint64 user_id,
+                  const quint64 peer_id, Continuation continuation) {
+    pending_t pending;
+    pending.kind = pending_t::kind_t::READ;
+    pending.from_user_id = user_id;
+    pending.to_user_id = peer_id;
+    enqueue_(std::move(pending), context, std::move(continuation));
+  }
+
+  // creates the user, the directory learns it once its batch is committed
+  template <typename Continuation>
+  void submitUser(QObject* context, const QString& username,
+                  const QString& password, Continuation continuation) {
+    pending_t pending;
+    pending.kind = pending_t::kind_t::USER;
+    pending.username = username;
+    pending.password = password;
+    enqueue_(std::move(pending), context, std::move(continuation));
+  }
+
+  writer_stats_t stats() const {
+    writer_stats_t stats;
+    stats.queue_depth = queue_depth_.loadRelaxed();
+    stats.batches = batches_.loadRelaxed();
+    stats.messages = messages_.loadRelaxed();
+    stats.failed = failed_.loadRelaxed();
+    stats.max_batch = max_batch_.loadRelaxed();
+    stats.total_commit_us = total_commit_us_.loadRelaxed();
+    stats.max_commit_us = max_commit_us_.loadRelaxed();
+    return stats;
+  }
+
+ private:
+  struct pending_t {
+    enum class kind_t {
+      MESSAGE,  // from_user_id sends message to to_user_id
+      READ,     // from_user_id has read its conversation with to_user_id
+      USER,     // username registers with password
+    } kind{};
+    quint64 from_user_id = 0;
+    quint64 to_user_id = 0;
+    QString message;
+    QString username;
+    QString password;
+    QElapsedTimer queued;
+    trace::trace_id_t trace_id = 0;  // the request that submitted it
+    qint64 queued_ns = 0;            // on the tracer's clock, traced only
+    std::function<void(bool, quint64)> done;  // <committed, message id>
+  };
+
+  template <typename Continuation>
+  void enqueue_(pending_t&& pending, QObject* context,
+                Continuation continuation) {
+    QPointer<QObject> guard(context);
+    pending.queued.start();
+    pending.trace_id = trace::current();
+    if (pending.trace_id) {
+      pending.queued_ns = trace::tracer.now();
+    }
+    pending.done = [guard, trace_id = pending.trace_id,
+                    continuation = std::move(continuation)](
+                       const bool committed, const quint64 message_id) {
+      if (!guard) {
+        return;
+      }
+
+      QMetaObject::invokeMethod(
+          guard.data(),
+          [trace_id, continuation, committed, message_id]() mutable {
+            const trace::Scope scope(trace_id);
+            if constexpr (std::is_invocable_v<Continuation&, bool, quint64>) {
+              continuation(committed, message_id);
+            } else {
+              continuation(committed);
+            }
+          },
+          Qt::QueuedConnection);
+    };
+
+    QMutexLocker locker(&mutex_);
+    queue_.push_back(std::move(pending));
+    queue_depth_.storeRelaxed(queue_.size());
+
+    // the writer waits either for the first message or for a full batch
+    if (queue_.size() == 1 || queue_.size() >= batch_size_) {
+      wake_.wakeOne();
+    }
+  }
+
+  QScopedPointer<QThread> thread_;
+  QMutex mutex_;
+  QWaitCondition wake_;
+  QList<pending_t> queue_;
+  bool stopping_ = false;
+
+  qsizetype batch_size_ = 1;
+  int batch_interval_ms_ = 0;
+
+  QAtomicInteger<qint64> queue_depth_;
+  QAtomicInteger<quint64> batches_;
+  QAtomicInteger<quint64> messages_;
+  QAtomicInteger<quint64> failed_;
+  QAtomicInteger<quint64> max_batch_;
+  QAtomicInteger<quint64> total_commit_us_;
+  QAtomicInteger<quint64> max_commit_us_;
+
+  void run_() {
+    db.claimWriter();
+
+    forever {
+      QList<pending_t> batch;
+      {
+        QMutexLocker locker(&mutex_);
+        while (queue_.isEmpty() && !stopping_) {
+          wake_.wait(&mutex_);
+        }
+        if (queue_.isEmpty()) {
+          return;  // stopping and everything is committed
+        }
+
+        // the interval is counted from the oldest queued message
+        const QDeadlineTimer deadline(qMax<qint64>(
+            batch_interval_ms_ - queue_.front().queued.elapsed(), 0));
+        while (queue_.size() < batch_size_ && !stopping_ &&
+               !deadline.hasExpired()) {
+          wake_.wait(&mutex_, deadline);
+        }
+
+        const auto count = qMin(queue_.size(), batch_size_);
+        batch = queue_.mid(0, count);
+        queue_.remove(0, count);
+        queue_depth_.storeRelaxed(queue_.size());
+      }
+
+      commit_(batch);
+    }
+  }
+
+  void commit_(const QList<pending_t>& batch) {
+    QElapsedTimer timer;
+    timer.start();
+
+    for (const auto& pending : batch) {
+      if (pending.trace_id) {
+        trace::tracer.complete(pending.trace_id, "writer queue",
+                               pending.queued_ns, trace::tracer.now());
+      }
+    }
+
+    QList<bool> inserted;
+    inserted.reserve(batch.size());
+    QList<quint64> message_ids(batch.size(), 0);
+
+    bool committed = db.transaction();
+    if (committed) {
+      // each entry runs in its own savepoint, so a failed statement undoes
+      // and fails only its entry and the rest still commit; if the savepoint
+      // itself can't be taken or undone the whole batch fails
+      for (const auto& pending : batch) {
+        const trace::Scope scope(pending.trace_id);
+        const trace::Span span("db insert");
+        if (!db.savepoint()) {
+          committed = false;
+          break;
+        }
+
+        bool ok = false;
+        switch (pending.kind) {
+          case pending_t::kind_t::MESSAGE: {
+            const auto message_id_monad = db.createMessage(
+                pending.from_user_id, pending.to_user_id, pending.message);
+            if (!message_id_monad.error) {
+              message_ids[inserted.size()] = message_id_monad.data;
+            }
+            ok = !message_id_monad.error;
+            break;
+          }
+          case pending_t::kind_t::READ:
+            ok = db.markRead(pending.from_user_id, pending.to_user_id);
+            break;
+          case pending_t::kind_t::USER:
+            ok = db.createUser(pending.username, pending.password);
+            break;
+        }
+
+        if (!(ok ? db.releaseSavepoint() : db.rollbackToSavepoint())) {
+          committed = false;
+          break;
+        }
+        inserted.push_back(ok);
+      }
+
+      // the commit (and its WAL sync) is shared by every request in the batch
+      const auto commit_ns = trace::tracer.now();
+      committed = committed && db.commit();
+      if (!committed) {
+        db.rollback();
+      }
+      for (const auto& pending : batch) {
+        if (pending.trace_id) {
+          trace::tracer.complete(pending.trace_id, "db commit", commit_ns,
+                                 trace::tracer.now());
+        }
+      }
+    }
+
+    if (!committed) {
+      common::logAll(QtCriticalMsg,
+                     "[WRITER] Can't commit a batch of " +
+                         QString::number(batch.size()) + " messages");
+    }
+
+    record_(batch.size(), static_cast<quint64>(timer.nsecsElapsed() / 1000));
+
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+      const auto ok = committed && inserted[i];
+      if (ok) {
+        if (batch[i].kind == pending_t::kind_t::MESSAGE) {
+          messages_.fetchAndAddRelaxed(1);
+        }
+      } else {
+        failed_.fetchAndAddRelaxed(1);
+      }
+      batch[i].done(ok, ok ? message_ids[i] : 0);
+    }
+  }
+
+  void record_(const quint64 size, const quint64 commit_us) {
+    batches_.fetchAndAddRelaxed(1);
+    total_commit_us_.fetchAndAddRelaxed(commit_us);
+    recordMax_(max_batch_, size);
+    recordMax_(max_commit_us_, commit_us);
+  }
+
+  static void recordMax_(QAtomicInteger<quint64>& max, const quint64 value) {
+    auto current = max.loadRelaxed();
+    while (value > current && !max.testAndSetRelaxed(current, value, current)) {
+    }
+  }
+};
+
+MessageWriter writer;
+
+};  // namespace db
@@ -14,10 +14,21 @@ SOURCES += \
 HEADERS += \
         src/auth.hpp \
         src/common.hpp \
+        src/config.hpp \
         src/db.hpp \
+        src/directory.hpp \
+        src/executor.hpp \
+        src/frame.hpp \
+        src/logger.hpp \
+        src/metrics.hpp \
+        src/migration.hpp \
         src/msg.hpp \
         src/packet.hpp \
-        src/server.hpp
+        src/pool.hpp \
+        src/server.hpp \
+        src/tail_cache.hpp \
+        src/trace.hpp \
+        src/writer.hpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin